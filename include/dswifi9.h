@@ -169,6 +169,32 @@ void Wifi_EnableWifi(void);
 ///     It returns true if the mode change has finished, false otherwise.
 bool Wifi_LibraryModeReady(void);
 
+/// Handler of events sent by the ARM7.
+///
+/// The event is only valid while the handler is running.
+///
+/// @warning
+///     If lwIP is disabled, this handler is run from inside an interrupt
+///     handler, with the same restrictions as WifiPacketHandler. If lwIP is
+///     enabled it's run from the thread that updates the library.
+typedef void (*WifiEventHandler)(const Wifi_Event *event);
+
+/// Set a handler to be notified of changes in the state of the library.
+///
+/// The ARM7 sends events when APs are found, updated or removed from the list of
+/// APs, when it finishes scanning all channels, and when its mode or the state
+/// of the association with an AP changes. This can be used instead of calling
+/// Wifi_GetNumAP(), Wifi_GetAPData() or Wifi_AssocStatus() every frame to check
+/// if anything has changed.
+///
+/// Updates of APs are merged so that there is at most one event per AP every
+/// time the ARM7 updates the library. If the queue of events gets full the
+/// handler receives a WIFI_EVENT_OVERFLOW event.
+///
+/// @param handler
+///     Pointer to the handler, or NULL to stop receiving events.
+void Wifi_SetEventHandler(WifiEventHandler handler);
+
 /// Allows the DS to enter or leave a "promsicuous" mode.
 ///
 /// In this mode all data that can be received is forwarded to the ARM9 for user
@@ -291,6 +317,21 @@ void Wifi_ScanModeFilter(Wifi_APScanFlags flags);
 /// list).
 void Wifi_ScanMode(void);
 
+/// Sets the time spent on each channel while scanning in DSi mode.
+///
+/// In DSi mode the WiFi firmware scans all channels in one pass, and APs are
+/// added to the list as soon as they are found. Shorter times make each pass
+/// faster, but APs with a weak signal may be missed. This has no effect in DS
+/// mode.
+///
+/// @param active_dwell_ms
+///     Maximum time spent on each channel sending probe requests and waiting
+///     for responses, in milliseconds. Use 0 for the default value (20 ms).
+/// @param passive_dwell_ms
+///     Time spent on each channel listening to beacons, in milliseconds. Use
+///     0 for the default value (50 ms).
+void Wifi_SetScanDwellTime(unsigned int active_dwell_ms, unsigned int passive_dwell_ms);
+
 /// Returns the current number of APs that are known and tracked internally.
 ///
 /// @return
@@ -308,6 +349,75 @@ int Wifi_GetNumAP(void);
 ///     WIFI_RETURN enumeration value.
 int Wifi_GetAPData(int apnum, Wifi_AccessPoint *apdata);
 
+/// Copies the data of all APs that are known and tracked internally.
+///
+/// The list is copied all at once, so it's consistent even if the ARM7 updates
+/// it while it's being copied. This is a lot faster than calling
+/// Wifi_GetAPData() for each AP.
+///
+/// @param list
+///     Pointer to an array to store the retrieved data.
+/// @param max_aps
+///     Number of entries in the array.
+///
+/// @return
+///     The number of APs copied to the array, or WIFI_RETURN_PARAMERROR.
+int Wifi_GetAPList(Wifi_AccessPoint *list, int max_aps);
+
+/// Provides a table to store information of more APs than the internal list.
+///
+/// The ARM7 keeps a copy of all APs it finds in this table, in a compact format.
+/// When the table is full, the AP that has been updated least recently is
+/// replaced. The table is only accessed by the ARM7, use Wifi_QueryAPTable() to
+/// read it.
+///
+/// The size of Wifi_AccessPointCompact is 64 bytes, and the table must be
+/// aligned to 32 bytes (use memalign(), for example) so that the cache of the
+/// ARM9 can't corrupt it.
+///
+/// This function waits until the ARM7 has stopped using the previous table. It
+/// fails if WiFi isn't running or if the ARM7 doesn't acknowledge the change in
+/// about one second. In that case the ARM7 may still be using the previous
+/// table or the new one, so don't free them until a call to this function
+/// succeeds.
+///
+/// @param table
+///     Pointer to the table, or NULL to stop using a table.
+/// @param num_entries
+///     Number of entries in the table.
+///
+/// @return
+///     On success it returns 0, else it returns a negative value.
+int Wifi_SetAPTable(Wifi_AccessPointCompact *table, int num_entries);
+
+/// Asks the ARM7 for the APs of the table with the strongest signal.
+///
+/// The ARM7 looks for the APs that pass the filter and copies them to "results"
+/// sorted by RSSI, from the strongest to the weakest signal. The request is
+/// asynchronous, use Wifi_QueryAPTableResult() to check when it's done. Don't
+/// access "results" until then.
+///
+/// "results" has the same alignment requirements as the table passed to
+/// Wifi_SetAPTable().
+///
+/// @param filter
+///     Mask of WIFI_APTABLE_FILTER_* flags. All the conditions need to be met.
+/// @param results
+///     Buffer to store the APs.
+/// @param max_results
+///     Maximum number of APs to store in the buffer.
+///
+/// @return
+///     On success it returns 0, else it returns a negative value.
+int Wifi_QueryAPTable(u32 filter, Wifi_AccessPointCompact *results, int max_results);
+
+/// Checks if the request of Wifi_QueryAPTable() has finished.
+///
+/// @return
+///     The number of APs stored in the buffer passed to Wifi_QueryAPTable(), or
+///     a negative value if the request hasn't finished yet.
+int Wifi_QueryAPTableResult(void);
+
 /// Determines whether various APs exist in the local area.
 ///
 /// You provide a list of APs, and it will return the index of the first one in
@@ -417,6 +527,139 @@ void Wifi_AutoConnect(void);
 ///     A value from the WIFI_ASSOCSTATUS enum.
 int Wifi_AssocStatus(void);
 
+/// Value of the "magic" field of a valid Wifi_LastConnection struct.
+#define WIFI_LAST_CONNECTION_MAGIC      0x4C435744 // "DWCL"
+
+/// Current version of the Wifi_LastConnection struct.
+#define WIFI_LAST_CONNECTION_VERSION    1
+
+/// Information about the last successful connection to an AP.
+///
+/// This struct can be saved to a file as it is and loaded in a later session to
+/// reconnect to the same AP without scanning all channels (see
+/// Wifi_ConnectLastAP()).
+///
+/// @warning
+///     It contains the password of the AP. Store it somewhere safe.
+typedef struct {
+    /// Set to WIFI_LAST_CONNECTION_MAGIC.
+    u32 magic;
+    /// Set to WIFI_LAST_CONNECTION_VERSION.
+    u16 version;
+    /// CRC16 of the rest of the struct (starting at "ap").
+    u16 crc16;
+
+    /// Information of the AP: BSSID, SSID, channel and security settings.
+    Wifi_AccessPoint ap;
+
+    /// Length of the password of the AP (0 for open APs).
+    u8 key_len;
+    /// Set to 1 if the AP has been loaded from the WFC settings, 0 otherwise.
+    u8 from_wfc;
+    /// Set to 1 if the IP settings were obtained with DHCP, 0 if they are
+    /// static settings.
+    u8 dhcp;
+    u8 padding;
+    /// Password of the AP.
+    u8 key[64];
+    /// Pairwise Master Key derived from the SSID and password (WPA only). If
+    /// this is provided the library doesn't have to calculate it, which takes
+    /// several seconds.
+    u8 pmk[32];
+
+    /// IP settings of the console while it was connected to the AP.
+    u32 ip, gateway, subnet_mask, dns_primary, dns_secondary;
+} Wifi_LastConnection;
+
+/// Gets information about the last successful connection to an AP.
+///
+/// The information is updated every time Wifi_AssocStatus() returns
+/// ASSOCSTATUS_ASSOCIATED for the first time after starting a connection.
+///
+/// @param rec
+///     Pointer to the struct to be filled.
+///
+/// @return
+///     0 on success, -1 if the console hasn't connected to any AP yet.
+int Wifi_GetLastConnection(Wifi_LastConnection *rec);
+
+/// Connects to the AP described by a Wifi_LastConnection struct.
+///
+/// The ARM7 tries to connect to the AP right away in the channel saved in the
+/// struct, without scanning for APs first. If that fails (for example, if the
+/// AP has moved to a different channel), the library falls back to scanning for
+/// APs with the same SSID (or to scanning for APs saved in the WFC settings, if
+/// the connection was started with Wifi_AutoConnect()).
+///
+/// If the connection used static IP settings they are restored, otherwise DHCP
+/// is used. Use Wifi_AssocStatus() to check the status of the connection as
+/// usual.
+///
+/// Wifi_AutoConnect() uses this path automatically if the console has already
+/// connected to an AP from the WFC settings during this session.
+///
+/// @param rec
+///     Information about the connection.
+///
+/// @return
+///     0 on success, -1 if the struct isn't valid.
+int Wifi_ConnectLastAP(const Wifi_LastConnection *rec);
+
+/// Enables or disables roaming between APs with the same SSID.
+///
+/// When roaming is enabled and the signal of the current AP is weaker than the
+/// threshold, the library looks for other APs with the same SSID. If it finds
+/// one with a clearly stronger signal it switches to it. If the connection with
+/// the AP is lost, it scans all channels and connects to the AP with the same
+/// SSID with the best signal, preferring the old AP unless the new one is
+/// clearly stronger.
+/// The IP settings and the network interface are kept during the switch, so
+/// open connections aren't closed.
+///
+/// On DS the library scans other channels in the background while it's
+/// connected. On DSi only the APs of the current channel can be found while
+/// connected, so it only switches APs after losing the connection.
+///
+/// If the library can't connect to any AP, Wifi_AssocStatus() returns
+/// ASSOCSTATUS_CANNOTCONNECT.
+///
+/// @param enable
+///     True to enable roaming, false to disable it.
+/// @param rssi_threshold
+///     RSSI below which the library looks for other APs. It uses the same
+///     units as the "rssi" field of Wifi_AccessPoint.
+void Wifi_SetRoaming(bool enable, int rssi_threshold);
+
+/// Enables or disables automatic reconnection when the connection is lost.
+///
+/// When it's enabled and the connection with the AP is lost, the library tries
+/// to connect to the same AP again a few times. After that, it scans all
+/// channels before every attempt, looking for the AP with the same SSID that
+/// has the best signal. The delay between attempts starts at "base_delay_ms"
+/// and it doubles after every failed attempt, up to "max_delay_ms".
+///
+/// Only connections that have succeeded at least once are restored. During the
+/// reconnection Wifi_AssocStatus() keeps returning ASSOCSTATUS_ASSOCIATED. lwIP
+/// only sees the link going down and up, so the IP address and the DHCP lease
+/// are kept if the AP comes back.
+///
+/// If roaming is enabled with Wifi_SetRoaming(), it's only used after the
+/// automatic reconnection gives up.
+///
+/// @param enable
+///     True to enable automatic reconnection, false to disable it.
+/// @param same_bssid_retries
+///     Number of attempts to connect to the same AP before scanning.
+/// @param base_delay_ms
+///     Delay before the first attempt in milliseconds.
+/// @param max_delay_ms
+///     Maximum delay between attempts in milliseconds.
+/// @param max_attempts
+///     Number of attempts before giving up. Use 0 to never give up.
+void Wifi_SetAutoReconnect(bool enable, unsigned int same_bssid_retries,
+                           unsigned int base_delay_ms, unsigned int max_delay_ms,
+                           unsigned int max_attempts);
+
 /// Disassociate from the Access Point
 ///
 /// @return
@@ -491,8 +734,9 @@ void Wifi_MultiplayerAllowNewClients(bool allow);
 /// want here. Normally, a client would use this field to display the name of
 /// each DS that is in multiplayer host mode.
 ///
-/// If you use this function to overwrite the default values of DSWifi, you need
-/// to do it before calling Wifi_BeaconStart().
+/// If you call it before Wifi_BeaconStart(), the beacon will start with this
+/// name. If you call it afterwards, the ARM7 will update the name in the beacon
+/// frame that is being sent without interrupting beacon transmission.
 ///
 /// This function will copy exactly DSWIFI_BEACON_NAME_SIZE bytes from "buffer".
 /// By default, DSWifi uses the player name stored in the DS firmware, so the
@@ -537,6 +781,19 @@ void Wifi_MultiplayerHostName(const void *buffer, u8 len);
 ///     0 on success, a negative value on error.
 int Wifi_BeaconStart(const char *ssid, u32 game_id);
 
+/// Changes the game ID included in the beacon frames sent by this host.
+///
+/// The ARM7 updates the Nintendo vendor information of the beacon frame that is
+/// being sent without interrupting beacon transmission. It must be called after
+/// Wifi_BeaconStart().
+///
+/// @param game_id
+///     The new 32-bit game ID. See Wifi_BeaconStart().
+///
+/// @return
+///     0 on success, -1 if this DS isn't in multiplayer host mode.
+int Wifi_BeaconSetGameId(u32 game_id);
+
 /// Get the number of clients connected to this DS acting as a multiplayer host.
 ///
 /// Clients are considered connected when they are authenticated and associated.
@@ -710,6 +967,30 @@ void Wifi_MultiplayerFromClientSetPacketHandler(WifiFromClientPacketHandler func
 ///     On success it returns 0, else it returns a negative value.
 int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_t data_size);
 
+/// Sends a data frame to a group of clients.
+///
+/// The frame is only queued and sent once, to a group address, no matter how
+/// many clients are in the group. This is a lot cheaper than calling
+/// Wifi_MultiplayerHostToClientDataTxFrame() once per client. However, frames
+/// sent to a group address aren't acknowledged by the clients, so they aren't
+/// sent again if they are lost.
+///
+/// Clients receive them in the same way as the frames sent with
+/// Wifi_MultiplayerHostToClientDataTxFrame().
+///
+/// @param aid_mask
+///     Bit N set means that the client with AID N must receive the frame. Use
+///     Wifi_MultiplayerGetClientMask() to send it to all connected clients.
+/// @param data_src
+///     Pointer to the data to be sent.
+/// @param data_size
+///     Size of the data in bytes.
+///
+/// @return
+///     On success it returns 0, else it returns a negative value.
+int Wifi_MultiplayerHostToClientsDataTxFrame(u16 aid_mask, const void *data_src,
+                                             size_t data_size);
+
 /// Sends a data frame to the host.
 ///
 /// This function sends an arbitrary data packet without waiting for any packet
@@ -728,6 +1009,149 @@ int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_
 ///     On success it returns 0, else it returns a negative value.
 int Wifi_MultiplayerClientToHostDataTxFrame(const void *data_src, size_t data_size);
 
+/// Maximum number of reliable messages that can be waiting for an ack for each
+/// link between the host and a client. It can't be higher than 8.
+#define WIFI_MP_RELIABLE_WINDOW     8
+
+/// Maximum size of a message sent with Wifi_MultiplayerReliableSend().
+#define WIFI_MP_RELIABLE_MAX_SIZE   1500
+
+/// Minimum number of bytes used by the reliable channel in all multiplayer
+/// frames while it is enabled.
+///
+/// Add this to the sizes passed to Wifi_MultiplayerHostMode() and
+/// Wifi_MultiplayerClientMode(). Any extra space left in CMD and REPLY frames
+/// is used to send acks (4 bytes per client) without using any DATA frame.
+#define WIFI_MP_RELIABLE_OVERHEAD   4
+
+/// Handler of messages received through the reliable channel.
+///
+/// The first argument is the AID of the client that sent the message (on
+/// clients it's always 0, the host). The second argument is a pointer to the
+/// message and the third argument is its size. The pointer is only valid while
+/// the called function is executing.
+///
+/// Messages are received in the same order as they were sent, and only once.
+///
+/// @warning
+///     This handler is run from inside an interrupt handler, with the same
+///     restrictions as WifiFromHostPacketHandler.
+typedef void (*WifiReliableRxHandler)(int aid, const void *data, size_t size);
+
+/// Handler called when the library doesn't need a message buffer anymore.
+///
+/// The first argument is the AID passed to Wifi_MultiplayerReliableSend(), and
+/// the second and third arguments are the buffer and size passed to it. The
+/// last argument is true if the peer has acknowledged the message, or false if
+/// the peer has left or the channel has been disabled before that happened.
+///
+/// @warning
+///     This handler may be run from inside an interrupt handler, with the same
+///     restrictions as WifiFromHostPacketHandler.
+typedef void (*WifiReliableTxDoneHandler)(int aid, const void *data, size_t size,
+                                          bool acked);
+
+/// Enables the reliable channel for multiplayer mode.
+///
+/// The reliable channel delivers messages in order and without duplicates. It
+/// uses DATA frames with a sequence number per client. Acks are added to CMD
+/// and REPLY frames whenever possible. Messages that aren't acknowledged are
+/// sent again from Wifi_MultiplayerReliableUpdate().
+///
+/// While the channel is enabled, all multiplayer frames start with a small
+/// header that is removed before the data reaches the regular packet handlers.
+/// Both the host and the clients need to enable it.
+///
+/// Messages received out of order are copied to a pool of "reorder_slots"
+/// buffers of "max_size" bytes allocated by this function. If there are no
+/// free buffers the message is dropped and the sender will send it again.
+///
+/// @param max_size
+///     Maximum size of a message (up to WIFI_MP_RELIABLE_MAX_SIZE).
+/// @param reorder_slots
+///     Number of messages received out of order that can be stored.
+/// @param rx_handler
+///     Handler of received messages. It can't be NULL.
+/// @param tx_done_handler
+///     Handler called when a sent message buffer can be reused. It can be NULL.
+///
+/// @return
+///     On success it returns 0, else it returns a negative value.
+int Wifi_MultiplayerReliableInit(size_t max_size, unsigned int reorder_slots,
+                                 WifiReliableRxHandler rx_handler,
+                                 WifiReliableTxDoneHandler tx_done_handler);
+
+/// Disables the reliable channel and frees all memory used by it.
+///
+/// The TX done handler is called for all messages that haven't been
+/// acknowledged.
+void Wifi_MultiplayerReliableDeinit(void);
+
+/// Sends a message through the reliable channel.
+///
+/// The data isn't copied to any intermediate buffer. The library keeps the
+/// pointer until the message is acknowledged, so the buffer must not be
+/// modified or freed until the TX done handler is called for it.
+///
+/// @param aid
+///     On the host, AID of the client that will receive the message. On
+///     clients it's ignored (messages are always sent to the host).
+/// @param data
+///     Pointer to the message.
+/// @param size
+///     Size of the message in bytes.
+///
+/// @return
+///     On success it returns 0. If the window of messages of this client is
+///     full or there is any other error it returns a negative value.
+int Wifi_MultiplayerReliableSend(int aid, const void *data, size_t size);
+
+/// Returns the number of messages that can be sent to a peer right now.
+///
+/// @param aid
+///     On the host, AID of the client. On clients it's ignored.
+///
+/// @return
+///     Number of free entries in the window, or a negative value on error.
+int Wifi_MultiplayerReliableFreeSlots(int aid);
+
+/// Sends messages that haven't been acknowledged, and acks that haven't been
+/// sent in any CMD or REPLY frame.
+///
+/// Call this function once per frame while the reliable channel is enabled.
+void Wifi_MultiplayerReliableUpdate(void);
+
+/// Enables delta compression of CMD and REPLY frames.
+///
+/// Payloads passed to Wifi_MultiplayerHostCmdTxFrame() and
+/// Wifi_MultiplayerClientReplyTxFrame() are XORed with the last payload that
+/// the receivers have acknowledged, and runs of zeroes are compressed. The
+/// result is only sent if it's smaller than the original payload, so frames are
+/// shorter when the payload doesn't change much from one frame to the next.
+/// Payloads are decoded before they reach the packet handlers.
+///
+/// Acks are sent in the CMD and REPLY frames of the other direction, so both
+/// the host and the clients need to enable it. If a payload can't be decoded
+/// (because of lost frames, for example) it's dropped and the receiver asks for
+/// a full payload.
+///
+/// It uses the same frame header as the reliable channel, so
+/// WIFI_MP_RELIABLE_OVERHEAD needs to be added to the sizes passed to
+/// Wifi_MultiplayerHostMode() and Wifi_MultiplayerClientMode(), plus 4 bytes
+/// per client in CMD frames and 4 bytes in REPLY frames for acks.
+///
+/// @param cmd_size
+///     Maximum size of the payloads of CMD frames.
+/// @param reply_size
+///     Maximum size of the payloads of REPLY frames.
+///
+/// @return
+///     On success it returns 0, else it returns a negative value.
+int Wifi_MultiplayerDeltaInit(size_t cmd_size, size_t reply_size);
+
+/// Disables delta compression of CMD and REPLY frames and frees its memory.
+void Wifi_MultiplayerDeltaDeinit(void);
+
 /// @}
 /// @defgroup dswifi9_ip Utilities related to Internet access.
 /// @{
@@ -792,6 +1216,102 @@ struct in_addr Wifi_GetIPInfo(struct in_addr *pGateway, struct in_addr *pSnmask,
 ///     The new secondary dns server
 void Wifi_SetIP(u32 IPaddr, u32 gateway, u32 subnetmask, u32 dns1, u32 dns2);
 
+/// DHCP lease obtained from an AP, used by Wifi_SetDhcpLeaseCache().
+///
+/// All addresses use the same format as the value returned by Wifi_GetIP().
+typedef struct {
+    /// BSSID of the AP that was used to obtain the lease.
+    u8 bssid[6];
+    /// Number of valid bytes in the ssid field (0-32).
+    u8 ssid_len;
+    u8 padding;
+    /// SSID of the AP that was used to obtain the lease.
+    char ssid[32];
+
+    /// Leased IP address. If it's zero the entry is empty.
+    u32 ip;
+    u32 subnet_mask;
+    u32 gateway;
+    u32 dns_primary;
+    u32 dns_secondary;
+    /// Address of the DHCP server that granted the lease.
+    u32 server_id;
+
+    /// Seconds left in the lease when it was saved.
+    u32 lease_time_left;
+    /// Value of time(NULL) when the lease was saved.
+    u32 timestamp;
+} Wifi_DhcpLease;
+
+/// Sets a buffer used to remember DHCP leases between connections.
+///
+/// When DHCP gets an address, and when the console disconnects from the AP,
+/// the lease is saved in the buffer. When the console connects to an AP with
+/// the same SSID (preferably with the same BSSID) and the lease hasn't expired,
+/// DHCP starts in INIT-REBOOT state: it asks the server to confirm the saved
+/// address instead of doing a full DISCOVER/OFFER/REQUEST/ACK exchange. If the
+/// server rejects it, a regular DHCP negotiation starts.
+///
+/// The buffer isn't copied, it's modified by the library while it's set. It
+/// may be saved to the filesystem and restored in a later session, as long as
+/// the clock of the console is correct. Clear it with zeroes before using it
+/// for the first time.
+///
+/// This only has effect when lwIP is enabled.
+///
+/// @param leases
+///     Array of leases, or NULL to stop using the cache.
+/// @param num_leases
+///     Number of entries in the array.
+///
+/// @return
+///     0 on success, -1 if the number of entries isn't valid.
+int Wifi_SetDhcpLeaseCache(Wifi_DhcpLease *leases, int num_leases);
+
+/// Enables a cache of DNS replies in front of the resolver of lwIP.
+///
+/// gethostbyname() and getaddrinfo() check the cache before sending any
+/// request to the DNS server. Replies are kept for as long as their TTL says
+/// (up to one day). Names that don't exist are remembered for "negative_ttl_sec"
+/// seconds, so that they aren't requested again and again. The cache is flushed
+/// when the console disconnects from the AP.
+///
+/// Calling this function again resizes the cache and clears it.
+///
+/// @param num_entries
+///     Number of entries of the cache. Use 0 to disable the cache.
+/// @param negative_ttl_sec
+///     Time in seconds to remember names that don't exist.
+///
+/// @return
+///     0 on success, -1 on error.
+int Wifi_SetDnsCache(int num_entries, unsigned int negative_ttl_sec);
+
+/// Removes all entries from the DNS cache.
+void Wifi_FlushDnsCache(void);
+
+/// Registers a name to be resolved as soon as the console is connected to an
+/// AP, before the application needs it.
+///
+/// The result is stored in the DNS cache, so Wifi_SetDnsCache() must have been
+/// called. Up to 8 names can be registered.
+///
+/// @param name
+///     Name to be resolved. It is copied by the library.
+///
+/// @return
+///     0 on success, -1 on error.
+int Wifi_AddDnsPrefetch(const char *name);
+
+/// Returns the number of lookups answered by the DNS cache and the number of
+/// lookups that have been sent to the DNS server.
+///
+/// @param hits
+///     Pointer to store the number of hits. It can be NULL.
+/// @param misses
+///     Pointer to store the number of misses. It can be NULL.
+void Wifi_GetDnsCacheStats(u32 *hits, u32 *misses);
+
 /// @}
 /// @defgroup dswifi9_raw_tx_rx Raw transfer/reception of packets.
 /// @{
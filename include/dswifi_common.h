@@ -197,6 +197,12 @@ enum WIFI_STATS
     WSTAT_HW_1DE,
     WSTAT_HW_1DF,
 
+    // Statistics added after the hardware statistics so that the values of
+    // the previous entries don't change.
+    WSTAT_TXMBOXBYTES,      ///< Bytes written to the TX mailbox, including padding (DSi mode)
+    WSTAT_TXMBOXPADSAVED,   ///< Padding bytes avoided by byte mode SDIO transfers (DSi mode)
+    WSTAT_TXCREDITSTALLS,   ///< Number of times TX waited for the target to have free buffers (DSi mode)
+
     NUM_WIFI_STATS
 };
 
@@ -270,6 +276,109 @@ typedef struct WIFI_ACCESSPOINT
     u32 spinlock;
 } Wifi_AccessPoint;
 
+/// Compact information about an Access Point.
+///
+/// This is the format of the entries of the table passed to Wifi_SetAPTable().
+/// It doesn't include the information sent by Nintendo DS hosts. Use
+/// Wifi_GetAPList() to get it.
+typedef struct {
+    /// Name (SSID) of the Access Point. The last byte of the array is zero.
+    char ssid[33];
+    /// Number of valid bytes in the ssid field (0-32)
+    u8 ssid_len;
+    /// BSSID of the Access Point (usually the same value as the MAC address).
+    u8 bssid[6];
+    /// Valid channels are 1-14.
+    u8 channel;
+    /// Type of security used in this Access Point (Wifi_ApSecurityType).
+    u8 security_type;
+    /// Same as the field "rssi" of Wifi_AccessPoint.
+    s16 rssi;
+    /// Same as the field "flags" of Wifi_AccessPoint.
+    u16 flags;
+
+    // Private fields
+    // --------------
+
+    // Indices of other entries of the table, used by the ARM7 to find APs
+    u16 hash_next;
+    u16 lru_prev;
+    u16 lru_next;
+    // Value of the timeout counter of the ARM7 when this AP was last updated
+    u16 last_tick;
+    u8 padding[10];
+} Wifi_AccessPointCompact;
+
+/// Only return APs without encryption (see Wifi_QueryAPTable()).
+#define WIFI_APTABLE_FILTER_OPEN        BIT(0)
+/// Only return APs with encryption (see Wifi_QueryAPTable()).
+#define WIFI_APTABLE_FILTER_SECURE      BIT(1)
+/// Only return APs saved in the WFC settings (see Wifi_QueryAPTable()).
+#define WIFI_APTABLE_FILTER_WFC         BIT(2)
+/// Only return Nintendo DS multiplayer hosts (see Wifi_QueryAPTable()).
+#define WIFI_APTABLE_FILTER_NINTENDO    BIT(3)
+/// Only return APs that this console can connect to (see Wifi_QueryAPTable()).
+#define WIFI_APTABLE_FILTER_COMPATIBLE  BIT(4)
+
+/// Types of events sent by the ARM7 (see Wifi_SetEventHandler()).
+typedef enum {
+    /// A new AP has been added to the list of APs.
+    WIFI_EVENT_AP_ADDED         = 1,
+    /// The information of an AP of the list has changed (RSSI, flags, etc).
+    WIFI_EVENT_AP_UPDATED       = 2,
+    /// An AP has been removed from the list because it hasn't been seen for a
+    /// while, or because it has been replaced by a new AP.
+    WIFI_EVENT_AP_EXPIRED       = 3,
+    /// The ARM7 has finished scanning all channels once.
+    WIFI_EVENT_SCAN_SWEEP_DONE  = 4,
+    /// The mode of the ARM7 has changed. The new state is in "state".
+    WIFI_EVENT_MODE_CHANGED     = 5,
+    /// The ARM7 has progressed in the association process with an AP. The new
+    /// state is in "state".
+    WIFI_EVENT_ASSOC_CHANGED    = 6,
+    /// Some events have been lost because they haven't been handled in time.
+    WIFI_EVENT_OVERFLOW         = 7,
+    /// All APs have been removed from the list at once (for example, when
+    /// starting a new scan). No WIFI_EVENT_AP_EXPIRED events are sent for them.
+    WIFI_EVENT_AP_LIST_CLEARED  = 8,
+} Wifi_EventType;
+
+/// States of the ARM7 reported by events.
+typedef enum {
+    /// The WiFi hardware is off.
+    WIFI_STATE_DISABLED         = 0,
+    /// The WiFi hardware is on, but idle.
+    WIFI_STATE_IDLE             = 1,
+    /// Looking for APs.
+    WIFI_STATE_SCANNING         = 2,
+    /// Trying to authenticate with an AP.
+    WIFI_STATE_AUTHENTICATING   = 3,
+    /// Authenticated, trying to associate with an AP.
+    WIFI_STATE_ASSOCIATING      = 4,
+    /// Connected to an AP.
+    WIFI_STATE_CONNECTED        = 5,
+    /// The connection with the AP has failed.
+    WIFI_STATE_CANNOT_CONNECT   = 6,
+    /// Acting as a multiplayer host.
+    WIFI_STATE_HOST             = 7,
+} Wifi_State;
+
+/// Event sent by the ARM7.
+typedef struct {
+    /// Type of the event (Wifi_EventType).
+    u8 type;
+    /// New state (Wifi_State) for WIFI_EVENT_MODE_CHANGED and
+    /// WIFI_EVENT_ASSOC_CHANGED.
+    u8 state;
+    /// Channel of the AP for AP events.
+    u8 channel;
+    u8 reserved;
+    /// BSSID of the AP for AP events.
+    u8 bssid[6];
+    /// RSSI of the AP for AP events.
+    s16 rssi;
+} Wifi_Event;
+
 /// Possible states of a client
 typedef enum {
     /// This client is disconnected.
@@ -6,6 +6,7 @@
 #include <limits.h>
 
 #include "arm7/debug.h"
+#include "arm7/event.h"
 #include "arm7/ipc.h"
 #include "arm7/wfc.h"
 #include "common/mac_addresses.h"
@@ -13,10 +14,154 @@
 #include "common/spinlock.h"
 #include "common/wifi_shared.h"
 
+static_assert(WIFI_MAX_AP <= 32);
+
+// The size is a multiple of the size of a cache line so that the ARM9 cache
+// can't corrupt entries written by the ARM7.
+static_assert(sizeof(Wifi_AccessPointCompact) == 64);
+
+static void Wifi_APTableReset(void);
+static void Wifi_APTableAdd(int index);
+static void Wifi_APTableTick(u32 ticks, u32 timeout);
+
+// Active APs are hashed by their BSSID. Each bucket is a mask of the entries of
+// WifiData->aplist with that hash, so a lookup normally only needs to compare
+// one BSSID.
+#define WIFI_AP_BUCKETS 16
+
+static u32 wifi_ap_buckets[WIFI_AP_BUCKETS];
+
+// Active APs sorted from the most recently updated to the least recently
+// updated one. When the list is full, the last one is replaced.
+#define WIFI_AP_LRU_NONE 0xFF
+
+static u8 wifi_ap_lru_prev[WIFI_MAX_AP];
+static u8 wifi_ap_lru_next[WIFI_MAX_AP];
+static u8 wifi_ap_lru_head = WIFI_AP_LRU_NONE;
+static u8 wifi_ap_lru_tail = WIFI_AP_LRU_NONE;
+
+// Bit N is set if the SSID of aplist[N] is in the WFC settings. It's only
+// calculated when the AP is added, when its SSID changes or when the WFC
+// settings are loaded again, which is when the bit of aplist[N] in
+// wifi_ap_wfc_checked_mask is cleared.
+static u32 wifi_ap_in_wfc_mask;
+static u32 wifi_ap_wfc_checked_mask;
+
+// Bit N is set if aplist[N] has been updated since the last time the events of
+// the APs were sent. Beacons are received very often, so updates are only sent
+// once per update of the ARM7.
+static u32 wifi_ap_updated_mask;
+
+static unsigned int Wifi_AccessPointHash(const void *bssid)
+{
+    const u8 *mac = bssid;
+
+    return (mac[3] ^ mac[4] ^ mac[5] ^ (mac[5] >> 4)) % WIFI_AP_BUCKETS;
+}
+
+static void Wifi_AccessPointLruUnlink(int i)
+{
+    u8 prev = wifi_ap_lru_prev[i];
+    u8 next = wifi_ap_lru_next[i];
+
+    if (prev != WIFI_AP_LRU_NONE)
+        wifi_ap_lru_next[prev] = next;
+    else
+        wifi_ap_lru_head = next;
+
+    if (next != WIFI_AP_LRU_NONE)
+        wifi_ap_lru_prev[next] = prev;
+    else
+        wifi_ap_lru_tail = prev;
+}
+
+static void Wifi_AccessPointLruPushFront(int i)
+{
+    wifi_ap_lru_prev[i] = WIFI_AP_LRU_NONE;
+    wifi_ap_lru_next[i] = wifi_ap_lru_head;
+
+    if (wifi_ap_lru_head != WIFI_AP_LRU_NONE)
+        wifi_ap_lru_prev[wifi_ap_lru_head] = i;
+    else
+        wifi_ap_lru_tail = i;
+
+    wifi_ap_lru_head = i;
+}
+
+// Returns the index of the active AP with this BSSID, or -1. This must be
+// called with interrupts disabled.
+static int Wifi_AccessPointFind(const void *bssid)
+{
+    u32 mask = wifi_ap_buckets[Wifi_AccessPointHash(bssid)];
+
+    while (mask != 0)
+    {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (Wifi_CmpMacAddr(WifiData->aplist[i].bssid, bssid))
+            return i;
+    }
+
+    return -1;
+}
+
+// Removes an AP from the indices (but not from the AP list). This must be
+// called with interrupts disabled.
+static void Wifi_AccessPointUnindex(int i)
+{
+    Wifi_EventSendAP(WIFI_EVENT_AP_EXPIRED, &WifiData->aplist[i]);
+
+    wifi_ap_buckets[Wifi_AccessPointHash((const void *)WifiData->aplist[i].bssid)] &= ~BIT(i);
+    Wifi_AccessPointLruUnlink(i);
+    wifi_ap_in_wfc_mask &= ~BIT(i);
+    wifi_ap_wfc_checked_mask &= ~BIT(i);
+    wifi_ap_updated_mask &= ~BIT(i);
+
+    WifiData->aplist_active_mask &= ~BIT(i);
+}
+
+int Wifi_AccessPointGetRssi(const void *bssid)
+{
+    int oldIME = enterCriticalSection();
+
+    int i = Wifi_AccessPointFind(bssid);
+    int rssi = (i == -1) ? INT_MIN : WifiData->aplist[i].rssi;
+
+    leaveCriticalSection(oldIME);
+
+    return rssi;
+}
+
+void Wifi_AccessPointWfcReloaded(void)
+{
+    // Check the APs against the new settings the next time they are updated
+    wifi_ap_wfc_checked_mask = 0;
+}
+
 void Wifi_AccessPointClearAll(void)
 {
     // Remove all APs
 
+    int oldIME = enterCriticalSection();
+    WifiData->aplist_generation++;
+
+    // A single event is enough to tell the ARM9 that all APs are gone. Sending
+    // one per AP could fill the event queue.
+    if (WifiData->aplist_active_mask != 0)
+        Wifi_EventSend(WIFI_EVENT_AP_LIST_CLEARED);
+
+    WifiData->aplist_active_mask = 0;
+    wifi_ap_updated_mask = 0;
+
+    memset(wifi_ap_buckets, 0, sizeof(wifi_ap_buckets));
+    wifi_ap_lru_head = WIFI_AP_LRU_NONE;
+    wifi_ap_lru_tail = WIFI_AP_LRU_NONE;
+    wifi_ap_in_wfc_mask = 0;
+    wifi_ap_wfc_checked_mask = 0;
+
+    Wifi_APTableReset();
+
     for (int i = 0; i < WIFI_MAX_AP; i++)
     {
         while (Spinlock_Acquire(WifiData->aplist[i]) != SPINLOCK_OK)
@@ -31,6 +176,9 @@ void Wifi_AccessPointClearAll(void)
 
         Spinlock_Release(WifiData->aplist[i]);
     }
+
+    WifiData->aplist_generation++;
+    leaveCriticalSection(oldIME);
 }
 
 void Wifi_AccessPointAdd(const void *bssid, const void *sa,
@@ -47,51 +195,26 @@ void Wifi_AccessPointAdd(const void *bssid, const void *sa,
         Wifi_RandomAddEntropy(seed);
     }
 
-    // Now, check the list of APs that we have found so far. If the AP of this
-    // frame is already in the list, store it there. If not, this loop will
-    // finish without doing any work, and we will add it to the list later.
-    bool in_aplist = false;
-    int chosen_slot = -1;
-    for (int i = 0; i < WIFI_MAX_AP; i++)
-    {
-        // Check if the BSSID of the new AP matches the entry in the AP array.
-        if (!Wifi_CmpMacAddr(WifiData->aplist[i].bssid, bssid))
-        {
-            // It doesn't match. If it's unused, we can at least save the slot
-            // for later in case we need it.
-            if (!(WifiData->aplist[i].flags & WFLAG_APDATA_ACTIVE))
-            {
-                if (chosen_slot == -1)
-                    chosen_slot = i;
-            }
-
-            // Check next AP in the array
-            continue;
-        }
+    int oldIME = enterCriticalSection();
 
-        // If this point is reached, the BSSID of the new AP matches this entry
-        // in the AP array. We need to update it. There can't be another entry
-        // with this BSSID, so we can exit the loop.
-        in_aplist = true;
-        chosen_slot = i;
-        break;
-    }
+    // Now, check the list of APs that we have found so far. If the AP of this
+    // frame is already in the list, store it there. If not, use a free entry
+    // or, if there are none, replace the AP with the longest time without any
+    // updates.
+    int chosen_slot = Wifi_AccessPointFind(bssid);
+    bool in_aplist = chosen_slot >= 0;
 
-    // If the AP isn't in the list of found APs, and there aren't free slots,
-    // look for the AP with the longest time without any updates and replace it.
-    if ((!in_aplist) && (chosen_slot == -1))
+    if (!in_aplist)
     {
-        unsigned int max_timectr = 0;
-        chosen_slot = 0;
+        u32 free_mask = ~WifiData->aplist_active_mask;
+#if WIFI_MAX_AP < 32
+        free_mask &= BIT(WIFI_MAX_AP) - 1;
+#endif
 
-        for (int i = 0; i < WIFI_MAX_AP; i++)
-        {
-            if (WifiData->aplist[i].timectr > max_timectr)
-            {
-                max_timectr = WifiData->aplist[i].timectr;
-                chosen_slot = i;
-            }
-        }
+        if (free_mask != 0)
+            chosen_slot = __builtin_ctz(free_mask);
+        else
+            chosen_slot = wifi_ap_lru_tail;
     }
 
     // Replace the chosen slot by the new AP (or update it)
@@ -105,6 +228,23 @@ void Wifi_AccessPointAdd(const void *bssid, const void *sa,
     {
         volatile Wifi_AccessPoint *ap = &(WifiData->aplist[chosen_slot]);
 
+        WifiData->aplist_generation++;
+
+        if (in_aplist)
+        {
+            Wifi_AccessPointLruUnlink(chosen_slot);
+        }
+        else
+        {
+            // If an old AP is being replaced, remove it from the indices
+            if (WifiData->aplist_active_mask & BIT(chosen_slot))
+                Wifi_AccessPointUnindex(chosen_slot);
+
+            wifi_ap_buckets[Wifi_AccessPointHash(bssid)] |= BIT(chosen_slot);
+        }
+
+        Wifi_AccessPointLruPushFront(chosen_slot);
+
         // Save the BSSID only if this is a new AP (the BSSID is used to
         // identify APs that are already in the list, so we don't need to copy
         // it again).
@@ -144,21 +284,40 @@ void Wifi_AccessPointAdd(const void *bssid, const void *sa,
 
         if (ssid_ptr)
         {
-            ap->ssid_len = ssid_len;
-            if (ap->ssid_len > 32)
-                ap->ssid_len = 32;
+            if (ssid_len > 32)
+                ssid_len = 32;
+
+            bool ssid_changed = !in_aplist || (ap->ssid_len != ssid_len) ||
+                                (memcmp((const void *)ap->ssid, ssid_ptr, ssid_len) != 0);
+
+            if (ssid_changed)
+            {
+                ap->ssid_len = ssid_len;
 
-            for (int j = 0; j < ap->ssid_len; j++)
-                ap->ssid[j] = ssid_ptr[j];
-            ap->ssid[ap->ssid_len] = '\0';
+                for (int j = 0; j < ap->ssid_len; j++)
+                    ap->ssid[j] = ssid_ptr[j];
+                ap->ssid[ap->ssid_len] = '\0';
+
+                wifi_ap_wfc_checked_mask &= ~BIT(chosen_slot);
+            }
+        }
 
-            // Check if this AP is saved int he WFC settings. Currently we
-            // identify APs based on their SSID because the WFC settings don't
-            // store the BSSID.
+        // Check if this AP is saved in the WFC settings. Currently we identify
+        // APs based on their SSID because the WFC settings don't store the
+        // BSSID.
+        if ((wifi_ap_wfc_checked_mask & BIT(chosen_slot)) == 0)
+        {
             if (Wifi_GetWfcAccessPointIndex((const void *)ap->ssid, ap->ssid_len) != -1)
-                ap->flags |= WFLAG_APDATA_CONFIG_IN_WFC;
+                wifi_ap_in_wfc_mask |= BIT(chosen_slot);
+            else
+                wifi_ap_in_wfc_mask &= ~BIT(chosen_slot);
+
+            wifi_ap_wfc_checked_mask |= BIT(chosen_slot);
         }
 
+        if (wifi_ap_in_wfc_mask & BIT(chosen_slot))
+            ap->flags |= WFLAG_APDATA_CONFIG_IN_WFC;
+
         ap->channel = channel;
 
         if (in_aplist)
@@ -191,11 +350,24 @@ void Wifi_AccessPointAdd(const void *bssid, const void *sa,
             WifiData->rssi = ap->rssi;
         }
 
+        WifiData->aplist_active_mask |= BIT(chosen_slot);
+
+        WifiData->aplist_generation++;
+
+        if (in_aplist)
+            wifi_ap_updated_mask |= BIT(chosen_slot);
+        else
+            Wifi_EventSendAP(WIFI_EVENT_AP_ADDED, ap);
+
+        Wifi_APTableAdd(chosen_slot);
+
         Spinlock_Release(WifiData->aplist[chosen_slot]);
     }
+
+    leaveCriticalSection(oldIME);
 }
 
-void Wifi_AccessPointTick(void)
+void Wifi_AccessPointTick(u32 ticks)
 {
     // The DSi iterates through all channels much faster than the DS, so let's
     // increase the timeout accordingly.
@@ -203,17 +375,324 @@ void Wifi_AccessPointTick(void)
     if (WifiData->reqFlags & WFLAG_REQ_DSI_MODE)
         timeout = WIFI_AP_TIMEOUT * 10;
 
-    // Update timeout counters of all APs.
-    for (int i = 0; i < WIFI_MAX_AP; i++)
+    int oldIME = enterCriticalSection();
+    WifiData->aplist_generation++;
+
+    // Update timeout counters of all active APs.
+    u32 mask = WifiData->aplist_active_mask;
+    while (mask != 0)
     {
-        if (WifiData->aplist[i].flags & WFLAG_APDATA_ACTIVE)
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        WifiData->aplist[i].timectr += ticks;
+
+        // If we haven't seen an AP for a long time, mark it as inactive by
+        // clearing the WFLAG_APDATA_ACTIVE flag
+        if (WifiData->aplist[i].timectr > timeout)
         {
-            WifiData->aplist[i].timectr++;
+            WifiData->aplist[i].flags = 0;
+            Wifi_AccessPointUnindex(i);
+        }
+    }
+
+    WifiData->aplist_generation++;
+
+    Wifi_APTableTick(ticks, timeout);
+
+    leaveCriticalSection(oldIME);
+}
+
+void Wifi_AccessPointSendEvents(void)
+{
+    int oldIME = enterCriticalSection();
+
+    u32 mask = wifi_ap_updated_mask & WifiData->aplist_active_mask;
+    wifi_ap_updated_mask = 0;
+
+    while (mask != 0)
+    {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        Wifi_EventSendAP(WIFI_EVENT_AP_UPDATED, &WifiData->aplist[i]);
+    }
 
-            // If we haven't seen an AP for a long time, mark it as inactive by
-            // clearing the WFLAG_APDATA_ACTIVE flag
-            if (WifiData->aplist[i].timectr > timeout)
-                WifiData->aplist[i].flags = 0;
+    leaveCriticalSection(oldIME);
+}
+
+// Table of APs provided by the application
+// ========================================
+
+// Incremented every time the timeout counters of the APs are updated
+static u16 wifi_aptable_tick;
+
+static unsigned int Wifi_APTableHash(const void *bssid)
+{
+    const u8 *mac = bssid;
+
+    return (mac[3] ^ (mac[4] << 1) ^ mac[5] ^ (mac[5] >> 5)) % WIFI_APTABLE_BUCKETS;
+}
+
+static void Wifi_APTableLruUnlink(volatile Wifi_ApTableIpc *t, u16 i)
+{
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    u16 prev = e[i].lru_prev;
+    u16 next = e[i].lru_next;
+
+    if (prev != WIFI_APTABLE_NONE)
+        e[prev].lru_next = next;
+    else
+        t->lru_head = next;
+
+    if (next != WIFI_APTABLE_NONE)
+        e[next].lru_prev = prev;
+    else
+        t->lru_tail = prev;
+}
+
+static void Wifi_APTableLruPushFront(volatile Wifi_ApTableIpc *t, u16 i)
+{
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    e[i].lru_prev = WIFI_APTABLE_NONE;
+    e[i].lru_next = t->lru_head;
+
+    if (t->lru_head != WIFI_APTABLE_NONE)
+        e[t->lru_head].lru_prev = i;
+    else
+        t->lru_tail = i;
+
+    t->lru_head = i;
+}
+
+static u16 Wifi_APTableFind(volatile Wifi_ApTableIpc *t, const void *bssid)
+{
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    u16 i = t->buckets[Wifi_APTableHash(bssid)];
+
+    while (i != WIFI_APTABLE_NONE)
+    {
+        if (memcmp(e[i].bssid, bssid, sizeof(e[i].bssid)) == 0)
+            break;
+
+        i = e[i].hash_next;
+    }
+
+    return i;
+}
+
+static void Wifi_APTableRemove(volatile Wifi_ApTableIpc *t, u16 i)
+{
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    // Remove it from its hash chain
+    volatile u16 *link = &(t->buckets[Wifi_APTableHash(e[i].bssid)]);
+    while (*link != WIFI_APTABLE_NONE)
+    {
+        if (*link == i)
+        {
+            *link = e[i].hash_next;
+            break;
         }
+        link = &(e[*link].hash_next);
+    }
+
+    Wifi_APTableLruUnlink(t, i);
+
+    e[i].flags = 0;
+    e[i].hash_next = t->free_head;
+    t->free_head = i;
+    t->num_used--;
+}
+
+// This must be called with interrupts disabled
+static void Wifi_APTableReset(void)
+{
+    volatile Wifi_ApTableIpc *t = &(WifiData->aptable);
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    for (int i = 0; i < WIFI_APTABLE_BUCKETS; i++)
+        t->buckets[i] = WIFI_APTABLE_NONE;
+
+    t->lru_head = WIFI_APTABLE_NONE;
+    t->lru_tail = WIFI_APTABLE_NONE;
+    t->num_used = 0;
+    t->free_head = WIFI_APTABLE_NONE;
+
+    for (int i = t->curNumEntries - 1; i >= 0; i--)
+    {
+        e[i].flags = 0;
+        e[i].hash_next = t->free_head;
+        t->free_head = i;
+    }
+}
+
+// Copies an entry of the AP list to the table. This must be called with
+// interrupts disabled.
+static void Wifi_APTableAdd(int index)
+{
+    volatile Wifi_ApTableIpc *t = &(WifiData->aptable);
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    if (e == NULL)
+        return;
+
+    volatile Wifi_AccessPoint *ap = &(WifiData->aplist[index]);
+
+    u16 i = Wifi_APTableFind(t, (const void *)ap->bssid);
+    if (i != WIFI_APTABLE_NONE)
+    {
+        Wifi_APTableLruUnlink(t, i);
     }
+    else
+    {
+        // Replace the least recently updated AP if the table is full
+        if (t->free_head == WIFI_APTABLE_NONE)
+            Wifi_APTableRemove(t, t->lru_tail);
+
+        i = t->free_head;
+        t->free_head = e[i].hash_next;
+        t->num_used++;
+
+        memcpy(e[i].bssid, (const void *)ap->bssid, sizeof(e[i].bssid));
+
+        volatile u16 *bucket = &(t->buckets[Wifi_APTableHash(e[i].bssid)]);
+        e[i].hash_next = *bucket;
+        *bucket = i;
+    }
+
+    Wifi_APTableLruPushFront(t, i);
+
+    memcpy(e[i].ssid, (const void *)ap->ssid, sizeof(e[i].ssid));
+    e[i].ssid_len = ap->ssid_len;
+    e[i].channel = ap->channel;
+    e[i].security_type = ap->security_type;
+    e[i].rssi = ap->rssi;
+    e[i].flags = ap->flags;
+    e[i].last_tick = wifi_aptable_tick;
+}
+
+// This must be called with interrupts disabled
+static void Wifi_APTableTick(u32 ticks, u32 timeout)
+{
+    volatile Wifi_ApTableIpc *t = &(WifiData->aptable);
+    Wifi_AccessPointCompact *e = t->curEntries;
+
+    wifi_aptable_tick += ticks;
+
+    if (e == NULL)
+        return;
+
+    // The least recently updated APs are at the end of the list
+    while (t->lru_tail != WIFI_APTABLE_NONE)
+    {
+        u16 i = t->lru_tail;
+
+        if ((u16)(wifi_aptable_tick - e[i].last_tick) <= timeout)
+            break;
+
+        Wifi_APTableRemove(t, i);
+    }
+}
+
+static bool Wifi_APTableFilter(const Wifi_AccessPointCompact *ap, u16 filter)
+{
+    if ((filter & WIFI_APTABLE_FILTER_OPEN) && (ap->security_type != AP_SECURITY_OPEN))
+        return false;
+
+    if ((filter & WIFI_APTABLE_FILTER_SECURE) && (ap->security_type == AP_SECURITY_OPEN))
+        return false;
+
+    if ((filter & WIFI_APTABLE_FILTER_WFC) && !(ap->flags & WFLAG_APDATA_CONFIG_IN_WFC))
+        return false;
+
+    if ((filter & WIFI_APTABLE_FILTER_NINTENDO) && !(ap->flags & WFLAG_APDATA_NINTENDO_TAG))
+        return false;
+
+    if ((filter & WIFI_APTABLE_FILTER_COMPATIBLE) && !(ap->flags & WFLAG_APDATA_COMPATIBLE))
+        return false;
+
+    return true;
+}
+
+// Copies the APs that pass the filter to the results buffer of the ARM9, sorted
+// from the strongest to the weakest signal. This must be called with interrupts
+// disabled.
+static void Wifi_APTableQuery(void)
+{
+    volatile Wifi_ApTableIpc *t = &(WifiData->aptable);
+    Wifi_AccessPointCompact *e = t->curEntries;
+    Wifi_AccessPointCompact *results = t->queryResults;
+
+    int max = t->queryMaxResults;
+    int count = 0;
+
+    for (u16 i = t->lru_head; i != WIFI_APTABLE_NONE; i = e[i].lru_next)
+    {
+        if (!Wifi_APTableFilter(&e[i], t->queryFilter))
+            continue;
+
+        // Insertion sort, only keeping the best "max" results
+        int pos = count;
+        while ((pos > 0) && (results[pos - 1].rssi < e[i].rssi))
+            pos--;
+
+        if (pos >= max)
+            continue;
+
+        int last = (count < max) ? count : max - 1;
+        for (int j = last; j > pos; j--)
+            results[j] = results[j - 1];
+
+        results[pos] = e[i];
+
+        if (count < max)
+            count++;
+    }
+
+    t->queryNumResults = count;
+}
+
+void Wifi_AccessPointTableUpdate(void)
+{
+    volatile Wifi_ApTableIpc *t = &(WifiData->aptable);
+
+    int oldIME = enterCriticalSection();
+
+    // The ARM9 sets the pointer to NULL before changing the number of entries,
+    // and it sets it to the new table afterwards.
+    if (t->curEntries != t->reqEntries)
+    {
+        t->curEntries = t->reqEntries;
+        t->curNumEntries = t->reqNumEntries;
+        if (t->curEntries == NULL)
+            t->curNumEntries = 0;
+
+        Wifi_APTableReset();
+
+        // Fill the new table with the APs that are currently known
+        u32 mask = WifiData->aplist_active_mask;
+        while (mask != 0)
+        {
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            Wifi_APTableAdd(i);
+        }
+    }
+
+    if (t->reqQueryId != t->curQueryId)
+    {
+        if (t->curEntries != NULL)
+            Wifi_APTableQuery();
+        else
+            t->queryNumResults = 0;
+
+        t->curQueryId = t->reqQueryId;
+    }
+
+    leaveCriticalSection(oldIME);
 }
@@ -13,6 +13,12 @@
 
 void Wifi_AccessPointClearAll(void);
 
+// Returns the RSSI of the AP with this BSSID, or INT_MIN if it isn't in the list
+int Wifi_AccessPointGetRssi(const void *bssid);
+
+// Must be called whenever the WFC settings are loaded
+void Wifi_AccessPointWfcReloaded(void);
+
 void Wifi_AccessPointAdd(const void *bssid, const void *sa,
                          const uint8_t *ssid_ptr, size_t ssid_len,
                          u32 channel, int rssi, Wifi_ApSecurityType sec_type,
@@ -20,6 +26,16 @@ void Wifi_AccessPointAdd(const void *bssid, const void *sa,
                          Wifi_ApCryptType pair_crypt_type, Wifi_ApAuthType auth_type,
                          bool compatible, Wifi_NintendoVendorInfo *nintendo_info);
 
-void Wifi_AccessPointTick(void);
+// Ages all the APs in the list and in the table of the application. The timeout
+// of the APs is measured in ticks, and the caller decides how many ticks have
+// passed since the last call.
+void Wifi_AccessPointTick(u32 ticks);
+
+// Sends events for all the APs that have been updated since the last call.
+void Wifi_AccessPointSendEvents(void);
+
+// Handles requests of the ARM9 related to the table of APs provided by the
+// application.
+void Wifi_AccessPointTableUpdate(void);
 
 #endif // DSWIFI_ARM7_ACCESS_POINT_H__
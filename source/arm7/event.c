@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#include <nds.h>
+
+#include "arm7/event.h"
+#include "arm7/ipc.h"
+#include "common/mac_addresses.h"
+
+// Set to true when an event is added to the queue, cleared when the ARM9 is
+// notified.
+static bool wifi_event_pending;
+
+static u8 wifi_event_last_mode = WIFIMODE_DISABLED;
+static Wifi_State wifi_event_last_state = WIFI_STATE_DISABLED;
+
+static void Wifi_EventPush(const Wifi_Event *event)
+{
+    volatile Wifi_EventQueueIpc *queue = &WifiData->events;
+
+    if (!queue->enabled)
+        return;
+
+    int oldIME = enterCriticalSection();
+
+    u8 write = queue->write;
+    u8 next = (write + 1) % WIFI_EVENT_QUEUE_SIZE;
+
+    if (next == queue->read)
+    {
+        // The queue is full. The ARM9 will notice that the counter has changed
+        // and it will report it.
+        queue->dropped++;
+    }
+    else
+    {
+        queue->list[write] = *event; // Struct copy
+        queue->write = next;
+        wifi_event_pending = true;
+    }
+
+    leaveCriticalSection(oldIME);
+}
+
+void Wifi_EventSend(Wifi_EventType type)
+{
+    Wifi_Event event = { 0 };
+
+    event.type = type;
+
+    Wifi_EventPush(&event);
+}
+
+void Wifi_EventSendAP(Wifi_EventType type, volatile const Wifi_AccessPoint *ap)
+{
+    Wifi_Event event = { 0 };
+
+    event.type = type;
+    event.channel = ap->channel;
+    event.rssi = ap->rssi;
+    Wifi_CopyMacAddr(event.bssid, ap->bssid);
+
+    Wifi_EventPush(&event);
+}
+
+static Wifi_State Wifi_EventGetState(void)
+{
+    switch (WifiData->curMode)
+    {
+        case WIFIMODE_DISABLED:
+        case WIFIMODE_INITIALIZING:
+            return WIFI_STATE_DISABLED;
+        case WIFIMODE_NORMAL:
+        case WIFIMODE_DISCONNECTING:
+            return WIFI_STATE_IDLE;
+        case WIFIMODE_SCAN:
+            return WIFI_STATE_SCANNING;
+        case WIFIMODE_CONNECTING:
+            // The authentication level is only tracked in NTR mode
+            if (WifiData->authlevel == WIFI_AUTHLEVEL_AUTHENTICATED)
+                return WIFI_STATE_ASSOCIATING;
+            return WIFI_STATE_AUTHENTICATING;
+        case WIFIMODE_CONNECTED:
+            return WIFI_STATE_CONNECTED;
+        case WIFIMODE_CANNOTCONNECT:
+            return WIFI_STATE_CANNOT_CONNECT;
+        case WIFIMODE_ACCESSPOINT:
+            return WIFI_STATE_HOST;
+        default:
+            return WIFI_STATE_IDLE;
+    }
+}
+
+void Wifi_EventUpdateState(void)
+{
+    u8 mode = WifiData->curMode;
+    Wifi_State state = Wifi_EventGetState();
+
+    if (state == wifi_event_last_state)
+    {
+        wifi_event_last_mode = mode;
+        return;
+    }
+
+    Wifi_Event event = { 0 };
+
+    // If the mode is the same, only the association process has changed
+    if (mode == wifi_event_last_mode)
+        event.type = WIFI_EVENT_ASSOC_CHANGED;
+    else
+        event.type = WIFI_EVENT_MODE_CHANGED;
+
+    event.state = state;
+
+    Wifi_EventPush(&event);
+
+    wifi_event_last_mode = mode;
+    wifi_event_last_state = state;
+}
+
+void Wifi_EventFlush(void)
+{
+    if (!wifi_event_pending)
+        return;
+
+    wifi_event_pending = false;
+
+    Wifi_CallSyncHandler();
+}
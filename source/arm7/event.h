@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#ifndef DSWIFI_ARM7_EVENT_H__
+#define DSWIFI_ARM7_EVENT_H__
+
+#include <nds/ndstypes.h>
+
+#include "common/wifi_shared.h"
+
+// Adds an event to the queue of events of the ARM9. The ARM9 is only notified
+// when Wifi_EventFlush() is called. They can be called from interrupt handlers.
+void Wifi_EventSend(Wifi_EventType type);
+void Wifi_EventSendAP(Wifi_EventType type, volatile const Wifi_AccessPoint *ap);
+
+// Sends events if the state of the ARM7 has changed since the last call.
+void Wifi_EventUpdateState(void);
+
+// Notifies the ARM9 if there are new events in the queue.
+void Wifi_EventFlush(void);
+
+#endif // DSWIFI_ARM7_EVENT_H__
@@ -10,11 +10,15 @@
 #include "arm7/ntr/registers.h"
 #include "common/common_ntr_defs.h"
 #include "common/ieee_defs.h"
+#include "common/spinlock.h"
 
 // Address to the channel inside the beacon frame saved in MAC RAM. Note that
 // this isn't required to be aligned to a halfword.
 static u16 beacon_channel_addr = 0;
 
+// Address to the Nintendo vendor information tag (after the tag ID and length)
+static u16 nintendo_information_addr = 0;
+
 // Address to the DSWifi information inside the Nintendo vendor information tag
 static u16 dswifi_information_addr = 0;
 
@@ -78,6 +82,7 @@ void Wifi_BeaconSetup(void)
                     (data[i + 2] == 0xBF) && (data[i + 3] == 0x00))
                 {
                     WLOG_PUTS("W: Nintendo info found\n");
+                    nintendo_information_addr = MAC_BEACON_START_OFFSET + i;
                     // Get pointer to the start of the extra data added by DSWifi
                     dswifi_information_addr = MAC_BEACON_START_OFFSET + i +
                             (sizeof(FieVendorNintendo) - sizeof(DSWifiExtraData));
@@ -141,6 +146,38 @@ int Wifi_GetBeaconAllowsConnections(void)
     return 0;
 }
 
+void Wifi_BeaconApplyPatch(void)
+{
+    if (WifiData->beaconPatch.dirty == 0)
+        return;
+
+    // Keep the changes until there is a beacon to apply them to
+    if (nintendo_information_addr == 0)
+        return;
+
+    if ((W_TXBUF_BEACON & TXBUF_BEACON_ENABLE) == 0)
+        return;
+
+    int oldIME = enterCriticalSection();
+    while (Spinlock_Acquire(WifiData->beaconPatch) != SPINLOCK_OK);
+
+    u64 dirty = WifiData->beaconPatch.dirty;
+    WifiData->beaconPatch.dirty = 0;
+
+    // Only the bytes that have changed are written. The hardware keeps sending
+    // the beacon from the same buffer.
+    while (dirty != 0)
+    {
+        int i = __builtin_ctzll(dirty);
+        dirty &= dirty - 1;
+
+        Wifi_MacWriteByte(nintendo_information_addr + i, WifiData->beaconPatch.data[i]);
+    }
+
+    Spinlock_Release(WifiData->beaconPatch);
+    leaveCriticalSection(oldIME);
+}
+
 void Wifi_SetBeaconPeriod(int beacon_period)
 {
     if (beacon_period < 0x10 || beacon_period > 0x3E7)
@@ -14,6 +14,9 @@ void Wifi_SetBeaconCurrentPlayers(int num);
 void Wifi_SetBeaconAllowsConnections(int allows);
 int Wifi_GetBeaconAllowsConnections(void);
 
+// Writes the changes requested by the ARM9 to the beacon saved in MAC RAM
+void Wifi_BeaconApplyPatch(void);
+
 void Wifi_SetBeaconPeriod(int beacon_period);
 
 #endif // DSWIFI_ARM7_NTR_BEACON_H__
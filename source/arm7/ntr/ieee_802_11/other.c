@@ -19,7 +19,7 @@ typedef struct {
     IEEE_DataFrameHeader ieee; // This is a data frame, not a management frame!
 } TxIeeeNullFrame;
 
-int Wifi_SendNullFrame(void)
+static int Wifi_SendNullFrameWithFlags(u16 flags)
 {
     TxIeeeNullFrame frame;
 
@@ -31,7 +31,7 @@ int Wifi_SendNullFrame(void)
     // "Functions of address fields in data frames"
     // With ToDS=1, FromDS=0: Addr1=BSSID, Addr2=SA, Addr3=DA
 
-    frame.ieee.frame_control = TYPE_NULL_FUNCTION | FC_TO_DS;
+    frame.ieee.frame_control = TYPE_NULL_FUNCTION | FC_TO_DS | flags;
     frame.ieee.duration = 0;
     Wifi_CopyMacAddr(frame.ieee.addr_1, WifiData->curAp.bssid);
     Wifi_CopyMacAddr(frame.ieee.addr_2, WifiData->MacAddr);
@@ -55,6 +55,18 @@ int Wifi_SendNullFrame(void)
     return Wifi_TxArm7QueueAdd((u16 *)&frame, sizeof(frame));
 }
 
+int Wifi_SendNullFrame(void)
+{
+    return Wifi_SendNullFrameWithFlags(0);
+}
+
+int Wifi_SendPowerSaveFrame(bool sleep)
+{
+    // The AP buffers the frames for this console while the power management
+    // bit is set, until it receives a frame with the bit cleared.
+    return Wifi_SendNullFrameWithFlags(sleep ? FC_PWR_MGT : 0);
+}
+
 #if 0 // TODO: This is unused
 int Wifi_SendPSPollFrame(void)
 {
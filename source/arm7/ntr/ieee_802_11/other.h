@@ -7,6 +7,9 @@
 #define DSWIFI_ARM7_NTR_IEEE_802_11_OTHER_H__
 
 int Wifi_SendNullFrame(void);
+// Sends a null frame that tells the AP if this console is going to sleep (so it
+// needs to buffer frames) or if it's awake again.
+int Wifi_SendPowerSaveFrame(bool sleep);
 int Wifi_SendPSPollFrame(void);
 
 #endif // DSWIFI_ARM7_NTR_IEEE_802_11_OTHER_H__
@@ -17,6 +17,46 @@
 #include "common/mac_addresses.h"
 #include "common/spinlock.h"
 
+// Mask of entries of WifiData->clients.list that aren't disconnected
+static u16 wifi_mp_used_mask;
+
+// Clients are hashed by the last two bytes of their MAC address. Each bucket is
+// a mask of the entries of WifiData->clients.list with that hash, so lookups
+// normally only need to compare one MAC address.
+#define WIFI_MP_MAC_BUCKETS 16
+
+static u16 wifi_mp_mac_buckets[WIFI_MP_MAC_BUCKETS];
+
+static unsigned int Wifi_MPHost_MacHash(const void *macaddr)
+{
+    const u8 *mac = macaddr;
+
+    return (mac[4] ^ mac[5] ^ (mac[5] >> 4)) % WIFI_MP_MAC_BUCKETS;
+}
+
+// This must be called with interrupts disabled
+static void Wifi_MPHost_ClientSlotAdd(int index, const void *macaddr)
+{
+    volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[index]);
+
+    client->state = WIFI_CLIENT_AUTHENTICATED;
+    Wifi_CopyMacAddr(client->macaddr, macaddr);
+
+    wifi_mp_used_mask |= BIT(index);
+    wifi_mp_mac_buckets[Wifi_MPHost_MacHash(macaddr)] |= BIT(index);
+}
+
+// This must be called with interrupts disabled
+static void Wifi_MPHost_ClientSlotRemove(int index)
+{
+    volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[index]);
+
+    client->state = WIFI_CLIENT_DISCONNECTED;
+
+    wifi_mp_used_mask &= ~BIT(index);
+    wifi_mp_mac_buckets[Wifi_MPHost_MacHash((const void *)client->macaddr)] &= ~BIT(index);
+}
+
 void Wifi_MPHost_ResetClients(void)
 {
     int oldIME = enterCriticalSection();
@@ -24,6 +64,9 @@ void Wifi_MPHost_ResetClients(void)
 
     memset((void *)WifiData->clients.list, 0, sizeof(WifiData->clients.list));
 
+    wifi_mp_used_mask = 0;
+    memset(wifi_mp_mac_buckets, 0, sizeof(wifi_mp_mac_buckets));
+
     WifiData->clients.num_connected = 0;
     WifiData->clients.aid_mask = BIT(0);
     Wifi_SetBeaconCurrentPlayers(WifiData->clients.num_connected + 1);
@@ -38,12 +81,14 @@ int Wifi_MPHost_ClientGetByMacAddr(void *macaddr)
 
     int index = -1;
 
-    for (int i = 0; i < WifiData->curMaxClients; i++)
+    u16 mask = wifi_mp_mac_buckets[Wifi_MPHost_MacHash(macaddr)];
+
+    while (mask != 0)
     {
-        volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[i]);
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
 
-        if (client->state == WIFI_CLIENT_DISCONNECTED)
-            continue;
+        volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[i]);
 
         if (Wifi_CmpMacAddr(macaddr, client->macaddr))
         {
@@ -110,19 +155,16 @@ int Wifi_MPHost_ClientAuthenticate(void *macaddr)
 
     // If the client isn't in the list, and we allow new clients, look for an
     // empty entry in the list.
-    for (int i = 0; i < WifiData->curMaxClients; i++)
+    u16 free_mask = ~wifi_mp_used_mask & (BIT(WifiData->curMaxClients) - 1);
+    if (free_mask != 0)
     {
-        volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[i]);
+        int i = __builtin_ffs(free_mask) - 1;
 
-        if (client->state == WIFI_CLIENT_DISCONNECTED)
-        {
-            client->state = WIFI_CLIENT_AUTHENTICATED;
-            Wifi_CopyMacAddr(client->macaddr, macaddr);
-            WifiData->clients.num_connected++;
-            Wifi_SetBeaconCurrentPlayers(WifiData->clients.num_connected + 1);
-            ret = i;
-            goto end;
-        }
+        Wifi_MPHost_ClientSlotAdd(i, macaddr);
+        WifiData->clients.num_connected++;
+        Wifi_SetBeaconCurrentPlayers(WifiData->clients.num_connected + 1);
+        ret = i;
+        goto end;
     }
 
     // The list is full, reject the connection
@@ -199,7 +241,7 @@ int Wifi_MPHost_ClientDisconnect(void *macaddr)
 
     // If the client was found, disconnect it
     volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[index]);
-    client->state = WIFI_CLIENT_DISCONNECTED;
+    Wifi_MPHost_ClientSlotRemove(index);
 
     WifiData->clients.aid_mask &= ~BIT(client->association_id);
 
@@ -234,7 +276,7 @@ void Wifi_MPHost_KickByAID(int association_id)
         // to handle all currently associated STAs" looks like a good excuse.
         Wifi_MPHost_SendDeauthentication((void *)client->macaddr,
                                          REASON_CANT_HANDLE_ALL_STATIONS);
-        client->state = WIFI_CLIENT_DISCONNECTED;
+        Wifi_MPHost_ClientSlotRemove(index);
 
         WifiData->clients.aid_mask &= ~BIT(association_id);
         WifiData->clients.num_connected--;
@@ -252,10 +294,14 @@ void Wifi_MPHost_KickNotAssociatedClients(void)
     int oldIME = enterCriticalSection();
     while (Spinlock_Acquire(WifiData->clients) != SPINLOCK_OK);
 
-    // If the client isn't in the list, and we allow new clients, look for an
-    // empty entry in the list.
-    for (int i = 0; i < WifiData->curMaxClients; i++)
+    // Only check the entries that are in use
+    u16 mask = wifi_mp_used_mask;
+
+    while (mask != 0)
     {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
         volatile Wifi_ConnectedClient *client = &(WifiData->clients.list[i]);
 
         // Authenticated but not associated clients need to be kicked out
@@ -263,7 +309,7 @@ void Wifi_MPHost_KickNotAssociatedClients(void)
         {
             Wifi_MPHost_SendDeauthentication((void *)client->macaddr,
                                              REASON_CANT_HANDLE_ALL_STATIONS);
-            client->state = WIFI_CLIENT_DISCONNECTED;
+            Wifi_MPHost_ClientSlotRemove(i);
 
             int aid = i + 1;
             WifiData->clients.aid_mask &= ~BIT(aid);
@@ -14,6 +14,7 @@
 #include "arm7/ntr/registers.h"
 #include "arm7/ntr/rf.h"
 #include "arm7/ntr/setup.h"
+#include "arm7/ntr/tx_queue.h"
 #include "common/common_ntr_defs.h"
 #include "common/random.h"
 
@@ -238,6 +239,9 @@ void Wifi_NTR_Start(void)
 
     Wifi_Stop();
 
+    // In case the ARM7 was stopped in the middle of a background scan
+    Wifi_TxArm9QueuePause(false);
+
     // Wifi_WakeUp();
 
     W_WEP_CNT     = WEP_CNT_ENABLE;
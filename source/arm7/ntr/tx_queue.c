@@ -13,12 +13,20 @@
 #include "common/ieee_defs.h"
 #include "common/random.h"
 
+// Queue of packets generated by the ARM7. Each entry starts with a halfword
+// with the size of the packet in bytes, followed by the packet data.
 static u16 wifi_tx_queue[1024];
-static u16 wifi_tx_queue_len = 0; // Length in halfwords
+static u16 wifi_tx_queue_read = 0; // Index of the first entry in halfwords
+static u16 wifi_tx_queue_write = 0; // Index of the end of the queue in halfwords
+
+#define WIFI_TX_QUEUE_HWORDS    (sizeof(wifi_tx_queue) / sizeof(wifi_tx_queue[0]))
 
 // Make sure that the biggest packet we can store fits in MAC_TXBUF_END_OFFSET
 static_assert(sizeof(wifi_tx_queue) < MAC_TXBUF_END_OFFSET);
 
+// While this is true, packets of the ARM9 are left in the ARM9 TX buffer
+static bool wifi_tx_arm9_paused = false;
+
 // Returns true if there is an active transfer.
 static bool Wifi_TxLoc3IsBusy(void)
 {
@@ -66,82 +74,103 @@ void Wifi_TxRaw(u16 *data, int datalen)
 
 void Wifi_TxArm7QueueFlush(void)
 {
-    Wifi_TxRaw(wifi_tx_queue, wifi_tx_queue_len);
-    wifi_tx_queue_len = 0;
+    u16 datalen = wifi_tx_queue[wifi_tx_queue_read];
+
+    Wifi_TxRaw(&wifi_tx_queue[wifi_tx_queue_read + 1], datalen);
+
+    wifi_tx_queue_read += 1 + ((datalen + 1) >> 1);
+
+    // If the queue is empty, start from the beginning of the buffer again
+    if (wifi_tx_queue_read == wifi_tx_queue_write)
+    {
+        wifi_tx_queue_read = 0;
+        wifi_tx_queue_write = 0;
+    }
 }
 
 bool Wifi_TxArm7QueueIsEmpty(void)
 {
-    if (wifi_tx_queue_len == 0)
+    if (wifi_tx_queue_read == wifi_tx_queue_write)
         return true;
 
     return false;
 }
 
-// Overwrite the current data in the queue with the newly provided data. If the
-// new buffer is too big it will return 0. If the data fits in the buffer, it
-// will return 1.
-static int Wifi_TxArm7QueueSetEnqueuedData(u16 *data, size_t datalen)
+// Append the provided data to the end of the queue. If there isn't enough space
+// in the buffer it will return 0. If the data fits in the buffer, it will
+// return 1.
+static int Wifi_TxArm7QueueAppend(u16 *data, size_t datalen)
 {
-    // Convert to halfords, rounding up
+    // Convert to halfords, rounding up, and add the size of the entry header
     size_t hwords = (datalen + 1) >> 1;
-    if (hwords > sizeof(wifi_tx_queue))
-        return 0;
+    size_t entry_hwords = 1 + hwords;
+
+    if (wifi_tx_queue_write + entry_hwords > WIFI_TX_QUEUE_HWORDS)
+    {
+        // Move the entries that haven't been sent yet to the start of the
+        // buffer to make space at the end.
+        if (wifi_tx_queue_read > 0)
+        {
+            size_t used = wifi_tx_queue_write - wifi_tx_queue_read;
+            memmove(&wifi_tx_queue[0], &wifi_tx_queue[wifi_tx_queue_read],
+                    used * sizeof(u16));
+            wifi_tx_queue_read = 0;
+            wifi_tx_queue_write = used;
+        }
+
+        if (wifi_tx_queue_write + entry_hwords > WIFI_TX_QUEUE_HWORDS)
+            return 0;
+    }
+
+    u16 *dst = &wifi_tx_queue[wifi_tx_queue_write];
 
+    *dst++ = datalen;
     for (size_t i = 0; i < hwords; i++)
-        wifi_tx_queue[i] = data[i];
+        *dst++ = data[i];
 
-    wifi_tx_queue_len = datalen;
+    wifi_tx_queue_write += entry_hwords;
     return 1;
 }
 
 int Wifi_TxArm7QueueAdd(u16 *data, int datalen)
 {
-    if (!Wifi_TxLoc3IsBusy())
-    {
-        // No active transfer. Check the queue to see if there is any data.
+    int ret = 1;
 
-        if (Wifi_TxArm7QueueIsEmpty())
-        {
-            // The queue is empty. Copy the data directly to the MAC without
-            // passing through the queue, and start a transfer.
-            Wifi_TxRaw(data, datalen);
-            return 1;
-        }
-        else
-        {
-            // The queue has data. Flush the enqueued data to the MAC, start a
-            // transfer, and enqueue the data just passed to Wifi_TxQueueAdd().
-            Wifi_TxArm7QueueFlush();
+    // This can be called from the update loop and from interrupt handlers, and
+    // the TX interrupt handler flushes the queue.
+    int oldIME = enterCriticalSection();
 
-            return Wifi_TxArm7QueueSetEnqueuedData(data, datalen);
-        }
+    if (!Wifi_TxLoc3IsBusy() && Wifi_TxArm7QueueIsEmpty())
+    {
+        // No active transfer and the queue is empty. Copy the data directly to
+        // the MAC without passing through the queue, and start a transfer.
+        Wifi_TxRaw(data, datalen);
     }
     else
     {
-        // There is an active transfer. Check the queue to see if there is any
-        // enqueued data.
+        // If there is no active transfer, flush the first enqueued packet to
+        // the MAC and start a transfer. Then, add the data just passed to
+        // Wifi_TxArm7QueueAdd() to the end of the queue. The rest of the
+        // packets will be sent from the TX interrupt handler.
+        if (!Wifi_TxLoc3IsBusy())
+            Wifi_TxArm7QueueFlush();
 
-        if (Wifi_TxArm7QueueIsEmpty())
+        ret = Wifi_TxArm7QueueAppend(data, datalen);
+        if (ret == 0)
         {
-            // The queue is empty, so we can enqueue the data just passed to
-            // Wifi_TxQueueAdd().
-            return Wifi_TxArm7QueueSetEnqueuedData(data, datalen);
-        }
-        else
-        {
-            // TODO: Append data to queue instead of simply failing. This ARM7
-            // queue is only used by authentication, association and NULL
-            // packets, so it's very unlikely. If it is full, the worst thing
-            // that can happen is that the authentication/association of a
-            // client fails (in multiplayer mode) or that the DS can't connect
-            // to an Internet AP (in internet mode). The library can recover
-            // from both errors.
+            // If it is full, the worst thing that can happen is that the
+            // authentication/association of a client fails (in multiplayer
+            // mode), that a probe request isn't sent or that the DS can't
+            // connect to an Internet AP (in internet mode). The library can
+            // recover from all of them.
             WLOG_PUTS("W: ARM7 TX queue full\n");
             WLOG_FLUSH();
-            return 0;
         }
     }
+
+    leaveCriticalSection(oldIME);
+
+    return ret;
 }
 
 // Copies data from the ARM9 TX buffer to MAC RAM and updates stats. It
@@ -453,8 +482,24 @@ void Wifi_TxAllQueueFlush(void)
     // If there is no active transfer and the ARM7 queue is empty, check if
     // there is pending data in the ARM9 TX circular buffer that the ARM9 wants
     // to send.
+    if (wifi_tx_arm9_paused)
+        return;
+
     if (Wifi_TxArm9QueueFlush())
         return;
 
     // Nothing more to do
 }
+
+void Wifi_TxArm9QueuePause(bool pause)
+{
+    wifi_tx_arm9_paused = pause;
+}
+
+bool Wifi_TxIsIdle(void)
+{
+    if (Wifi_TxLoc3IsBusy() || Wifi_TxCmdIsBusy())
+        return false;
+
+    return Wifi_TxArm7QueueIsEmpty();
+}
@@ -33,9 +33,9 @@ bool Wifi_TxArm7QueueIsEmpty(void);
 
 // Define data to be transferred, with a size specified in bytes. This function
 // will check if there is an active transfer already active. If so, it will try
-// to enqueue the data in a 1024 halfword buffer to be sent after the transfer
-// is finished. If it can't be enqueued, this function will return 0. On success
-// it returns 1.
+// to append the data to a 1024 halfword queue, which can hold several packets,
+// to be sent after the transfer is finished. If it can't be enqueued, this
+// function will return 0. On success it returns 1.
 //
 // TODO: The callers of this function don't allocate space in MAC RAM for the
 // FCS right now. This isn't a problem at the moment because we copy packets
@@ -55,6 +55,13 @@ int Wifi_TxArm9QueueFlush(void);
 // try with the ARM9 queue.
 void Wifi_TxAllQueueFlush(void);
 
+// Stops or resumes sending the packets of the ARM9 TX buffer. The packets of
+// the ARM7 queue are still sent while the ARM9 buffer is paused.
+void Wifi_TxArm9QueuePause(bool pause);
+
+// Returns true if there is no active transfer and the ARM7 queue is empty.
+bool Wifi_TxIsIdle(void);
+
 void Wifi_Intr_MultiplayCmdDone(void);
 
 #endif // DSWIFI_ARM7_NTR_TX_QUEUE_H__
@@ -3,13 +3,17 @@
 // Copyright (C) 2005-2006 Stephen Stair - sgstair@akkit.org - http://www.akkit.org
 // Copyright (C) 2025 Antonio Niño Díaz
 
+#include <limits.h>
+
 #include <nds.h>
 #include <dswifi7.h>
 #include <dswifi_common.h>
 
 #include "arm7/access_point.h"
 #include "arm7/debug.h"
+#include "arm7/event.h"
 #include "arm7/ipc.h"
+#include "arm7/reconnect.h"
 #include "arm7/setup.h"
 #include "arm7/wfc.h"
 #include "arm7/ntr/beacon.h"
@@ -128,6 +132,27 @@ static void Wifi_AssociationUpdate(void)
 
 // =====================================================================
 
+// States of the background scan used to look for other APs while connected
+typedef enum {
+    WIFI_ROAM_SCAN_IDLE,        // In the channel of the AP
+    WIFI_ROAM_SCAN_LEAVING,     // Waiting for pending frames to be sent
+    WIFI_ROAM_SCAN_OFF_CHANNEL, // Looking for APs in another channel
+} Wifi_RoamScanState;
+
+// Goes back to the channel of the AP after looking for other APs and resumes
+// sending the packets of the ARM9.
+static void Wifi_NTR_RoamScanReturn(void)
+{
+    WifiData->reqChannel = WifiData->curAp.channel;
+    Wifi_SetChannel(WifiData->curAp.channel);
+    Wifi_SetupFilterMode(WIFI_FILTERMODE_INTERNET);
+
+    // Ask the AP to deliver the frames it has buffered. The ARM7 queue is
+    // flushed before the ARM9 buffer, so this is sent before any ARM9 packet.
+    Wifi_SendPowerSaveFrame(false);
+    Wifi_TxArm9QueuePause(false);
+}
+
 void Wifi_NTR_Update(void)
 {
     if (WifiData == NULL)
@@ -138,8 +163,13 @@ void Wifi_NTR_Update(void)
 
     // Index of the current WiFi channel to be scanned.
     static size_t wifi_scan_index = 0;
-    // Index of the next WFC setting to be probed
-    static u8 wfc_probe_index = 0;
+    // True if the probe requests for the current channel have been sent
+    static bool wifi_scan_probes_sent = false;
+    // State of the search of other APs with the same SSID as the current AP
+    static Wifi_RoamScanState wifi_roam_scan_state = WIFI_ROAM_SCAN_IDLE;
+
+    if (WifiData->curMode != WIFIMODE_CONNECTED)
+        wifi_roam_scan_state = WIFI_ROAM_SCAN_IDLE;
 
     // This array defines the order in which channels are scanned. It makes
     // sense to start with the most common channels and try the others next.
@@ -159,6 +189,22 @@ void Wifi_NTR_Update(void)
     };
     const size_t scanlist_size = sizeof(scanlist) / sizeof(scanlist[0]);
 
+    // Milliseconds since the first update, used for the reconnection backoff.
+    // Each tick of W_US_COUNT1 is 65.536 ms.
+    static u32 wifi_time_ms = 0;
+    static u16 wifi_time_last_tick = 0;
+    static u32 wifi_time_us_rem = 0; // Microseconds not added to wifi_time_ms yet
+    {
+        u16 tick = W_US_COUNT1;
+        u16 elapsed = tick - wifi_time_last_tick;
+        wifi_time_last_tick = tick;
+
+        // Carry the remainder so that the truncation doesn't accumulate
+        u32 us = (u32)elapsed * 65536 + wifi_time_us_rem;
+        wifi_time_ms += us / 1000;
+        wifi_time_us_rem = us % 1000;
+    }
+
     Wifi_RandomAddEntropy(W_RANDOM);
     WifiData->stats[WSTAT_ARM7_UPDATES]++;
 
@@ -229,7 +275,7 @@ void Wifi_NTR_Update(void)
                 WifiData->curMode  = WIFIMODE_SCAN;
                 Wifi_SetupFilterMode(WIFI_FILTERMODE_SCAN);
                 wifi_scan_index = 0;
-                wfc_probe_index = 0;
+                wifi_scan_probes_sent = false;
                 break;
             }
 
@@ -292,72 +338,87 @@ void Wifi_NTR_Update(void)
         {
             Wifi_SetLedState(LED_BLINK_SLOW);
 
-            if ((WifiData->reqMode != WIFIMODE_SCAN) ||
-                (WifiData->curLibraryMode != WifiData->reqLibraryMode))
+            if (Wifi_ReconnectIsScanning())
+            {
+                // Scan started by the automatic reconnection. The ARM9 still
+                // wants to be connected, so reqMode is WIFIMODE_CONNECTED.
+                if ((WifiData->reqMode != WIFIMODE_CONNECTED) ||
+                    (WifiData->curLibraryMode != WifiData->reqLibraryMode))
+                {
+                    Wifi_ReconnectReset();
+                    Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
+                    WifiData->curMode = WIFIMODE_NORMAL;
+                    break;
+                }
+
+                int result = Wifi_ReconnectScanResult();
+                if (result == 1)
+                {
+                    // Connect to the AP that has been found
+                    Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
+                    WifiData->curMode = WIFIMODE_NORMAL;
+                    break;
+                }
+                else if (result == 0)
+                {
+                    Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
+                    WifiData->curMode = WIFIMODE_CANNOTCONNECT;
+                    break;
+                }
+            }
+            else if ((WifiData->reqMode != WIFIMODE_SCAN) ||
+                     (WifiData->curLibraryMode != WifiData->reqLibraryMode))
             {
                 Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
                 WifiData->curMode = WIFIMODE_NORMAL;
                 break;
             }
-            if ((W_US_COUNT1 - WifiData->counter7) > 1)
-            {
-                bool change_channel = false;
 
-                if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_CLIENT)
+            // In internet mode, send a probe request for each AP in the WFC
+            // settings as soon as we arrive to a new channel. They are queued
+            // in the ARM7 TX queue and sent back to back, so the replies to
+            // all of them can be received during the dwell time of the
+            // channel. In multiplayer mode we don't need to probe anything.
+            if ((WifiData->curLibraryMode != DSWIFI_MULTIPLAYER_CLIENT) && !wifi_scan_probes_sent)
+            {
+                for (int i = 0; i < WifiData->wfc_number_of_configs; i++)
                 {
-                    // In multiplayer mode we don't need to probe anything.
-                    change_channel = true;
+                    Wifi_SendProbeRequestPacket(true,
+                                                (const char *)WifiData->wfc[i].ssid,
+                                                WifiData->wfc[i].ssid_len);
                 }
-                else // if (WifiData->curLibraryMode == DSWIFI_INTERNET)
+
+                // Check if the user has requested to connect to an AP
+                // manually. If so, send a probe request. This is required if
+                // the developer wants to allow the player to manually type the
+                // SSID of a hidden network.
+                if (WifiData->curAp.ssid_len > 0)
                 {
-                    // First, see if there are more WFC AP settings to probe (or
-                    // if there are no configured APs at all).
-                    if (wfc_probe_index > WifiData->wfc_number_of_configs)
-                    {
-                        // If there are no more APs to probe, change the channel
-                        change_channel = true;
-                        wfc_probe_index = 0;
-                    }
-                    else if (wfc_probe_index == WifiData->wfc_number_of_configs)
-                    {
-                        // If we have finished the WFC settings, check if the
-                        // user has requested to connect to an AP manually. If
-                        // so, send a probe request. This is required if the
-                        // developer wants to allow the player to manually type
-                        // the SSID of a hidden network.
-                        if (WifiData->curAp.ssid_len > 0)
-                        {
-                            Wifi_SendProbeRequestPacket(true,
-                                            (const char *)WifiData->curAp.ssid,
-                                            WifiData->curAp.ssid_len);
-                        }
+                    Wifi_SendProbeRequestPacket(true,
+                                                (const char *)WifiData->curAp.ssid,
+                                                WifiData->curAp.ssid_len);
+                }
 
-                        wfc_probe_index++;
-                    }
-                    else
-                    {
-                        // If there are more APs to probe, send a probe request
-                        // and wait for the next scan update to receive a reply.
-                        Wifi_SendProbeRequestPacket(true,
-                                (const char *)WifiData->wfc[wfc_probe_index].ssid,
-                                WifiData->wfc[wfc_probe_index].ssid_len);
+                wifi_scan_probes_sent = true;
+            }
 
-                        wfc_probe_index++;
-                    }
-                }
+            if ((W_US_COUNT1 - WifiData->counter7) > 1)
+            {
+                // Request changing channel
+                WifiData->counter7   = W_US_COUNT1;
+                WifiData->reqChannel = scanlist[wifi_scan_index];
+                Wifi_SetChannel(WifiData->reqChannel);
 
-                if (change_channel)
-                {
-                    // Request changing channel
-                    WifiData->counter7   = W_US_COUNT1;
-                    WifiData->reqChannel = scanlist[wifi_scan_index];
-                    Wifi_SetChannel(WifiData->reqChannel);
+                Wifi_AccessPointTick(1);
 
-                    Wifi_AccessPointTick();
+                wifi_scan_probes_sent = false;
 
-                    wifi_scan_index++;
-                    if (wifi_scan_index == scanlist_size)
-                        wifi_scan_index = 0;
+                wifi_scan_index++;
+                if (wifi_scan_index == scanlist_size)
+                {
+                    wifi_scan_index = 0;
+                    Wifi_EventSend(WIFI_EVENT_SCAN_SWEEP_DONE);
+                    Wifi_ReconnectSweepDone();
                 }
             }
             break;
@@ -406,6 +467,16 @@ void Wifi_NTR_Update(void)
         {
             Wifi_SetLedState(LED_BLINK_FAST);
 
+            // Go back to the channel of the AP before leaving this mode
+            if ((wifi_roam_scan_state != WIFI_ROAM_SCAN_IDLE) &&
+                ((WifiData->curLibraryMode != WifiData->reqLibraryMode) ||
+                 (WifiData->reqMode != WIFIMODE_CONNECTED) ||
+                 Wifi_AssociationIsFailure()))
+            {
+                Wifi_NTR_RoamScanReturn();
+                wifi_roam_scan_state = WIFI_ROAM_SCAN_IDLE;
+            }
+
             if (WifiData->curLibraryMode != WifiData->reqLibraryMode)
             {
                 Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
@@ -414,7 +485,8 @@ void Wifi_NTR_Update(void)
             }
 
             wifi_keepalive_time++; // TODO: track time more accurately.
-            if (wifi_keepalive_time > WIFI_KEEPALIVE_COUNT)
+            if ((wifi_keepalive_time > WIFI_KEEPALIVE_COUNT) &&
+                (wifi_roam_scan_state == WIFI_ROAM_SCAN_IDLE))
             {
                 Wifi_NTR_KeepaliveCountReset();
                 Wifi_SendNullFrame();
@@ -445,6 +517,77 @@ void Wifi_NTR_Update(void)
                 WifiData->curMode = WIFIMODE_CANNOTCONNECT;
                 break;
             }
+
+            // Background scan requested by the ARM9 when the signal of the AP
+            // is weak. Every second, leave the channel of the AP for one scan
+            // period and send a probe request for its SSID in another channel.
+            // Beacons of other APs in the channel of the AP are received even
+            // without doing this.
+            //
+            // Before leaving, the packets of the ARM9 are kept in the ARM9 TX
+            // buffer and the AP is told to buffer the frames for this console
+            // so that nothing is lost while the ARM7 is in another channel.
+            if (wifi_roam_scan_state == WIFI_ROAM_SCAN_OFF_CHANNEL)
+            {
+                if ((W_US_COUNT1 - WifiData->counter7) > 1)
+                {
+                    WifiData->counter7 = W_US_COUNT1;
+                    Wifi_NTR_RoamScanReturn();
+                    wifi_roam_scan_state = WIFI_ROAM_SCAN_IDLE;
+                }
+            }
+            else if (wifi_roam_scan_state == WIFI_ROAM_SCAN_LEAVING)
+            {
+                // Wait until the power save frame and any frame that was being
+                // sent have left the hardware.
+                if (!Wifi_TxIsIdle())
+                    break;
+
+                WifiData->counter7 = W_US_COUNT1;
+
+                if (scanlist[wifi_scan_index] == WifiData->curAp.channel)
+                {
+                    wifi_scan_index++;
+                    if (wifi_scan_index == scanlist_size)
+                        wifi_scan_index = 0;
+                }
+
+                // Probe responses of other APs are only received in scan
+                // mode.
+                Wifi_SetupFilterMode(WIFI_FILTERMODE_SCAN);
+                WifiData->reqChannel = scanlist[wifi_scan_index];
+                Wifi_SetChannel(WifiData->reqChannel);
+                Wifi_SendProbeRequestPacket(true,
+                                            (const char *)WifiData->curAp.ssid,
+                                            WifiData->curAp.ssid_len);
+
+                Wifi_AccessPointTick(1);
+
+                wifi_scan_index++;
+                if (wifi_scan_index == scanlist_size)
+                    wifi_scan_index = 0;
+
+                wifi_roam_scan_state = WIFI_ROAM_SCAN_OFF_CHANNEL;
+            }
+            else if ((WifiData->reqFlags & WFLAG_REQ_ROAM_SCAN) &&
+                     (WifiData->curLibraryMode == DSWIFI_INTERNET))
+            {
+                if ((W_US_COUNT1 - WifiData->counter7) > 20) // 20 units is 1 sec aprox
+                {
+                    WifiData->counter7 = W_US_COUNT1;
+
+                    // Only leave the channel while the signal of the AP is
+                    // still weak. The ARM9 may take a while to clear the flag.
+                    int rssi = Wifi_AccessPointGetRssi((const void *)WifiData->curAp.bssid);
+                    if ((rssi == INT_MIN) || (rssi >= WifiData->roamRssiThreshold))
+                        break;
+
+                    Wifi_TxArm9QueuePause(true);
+                    Wifi_SendPowerSaveFrame(true);
+
+                    wifi_roam_scan_state = WIFI_ROAM_SCAN_LEAVING;
+                }
+            }
             break;
         }
         case WIFIMODE_CANNOTCONNECT:
@@ -465,6 +608,25 @@ void Wifi_NTR_Update(void)
                 WifiData->curMode = WIFIMODE_NORMAL;
                 break;
             }
+
+            Wifi_ReconnectAction action = Wifi_ReconnectUpdate(wifi_time_ms);
+            if (action == WIFI_RECONNECT_RETRY)
+            {
+                // The normal mode will connect to curAp again because reqMode
+                // is still WIFIMODE_CONNECTED.
+                Wifi_SetupFilterMode(WIFI_FILTERMODE_IDLE);
+                WifiData->curMode = WIFIMODE_NORMAL;
+            }
+            else if (action == WIFI_RECONNECT_RESCAN)
+            {
+                Wifi_AccessPointClearAll();
+
+                WifiData->counter7 = W_US_COUNT1; // timer hword 2 (each tick is 65.5ms)
+                WifiData->curMode  = WIFIMODE_SCAN;
+                Wifi_SetupFilterMode(WIFI_FILTERMODE_SCAN);
+                wifi_scan_index = 0;
+                wifi_scan_probes_sent = false;
+            }
             break;
         }
         case WIFIMODE_ACCESSPOINT:
@@ -499,6 +661,8 @@ void Wifi_NTR_Update(void)
                 }
             }
 
+            Wifi_BeaconApplyPatch();
+
             bool cur_allow = Wifi_GetBeaconAllowsConnections();
             bool req_allow = WifiData->reqFlags & WFLAG_REQ_ALLOWCLIENTS;
 
@@ -528,6 +692,8 @@ void Wifi_NTR_Update(void)
             break;
     }
 
+    Wifi_ReconnectUpdateState();
+
     // Only allow manual changes of the channel if scan mode isn't active
     // because scan mode changes the channel periodically anyway.
     if (WifiData->curMode != WIFIMODE_SCAN)
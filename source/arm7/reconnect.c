@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#include <string.h>
+
+#include <nds.h>
+
+#include "arm7/debug.h"
+#include "arm7/ipc.h"
+#include "arm7/reconnect.h"
+
+typedef enum {
+    WIFI_RECONNECT_STATE_IDLE       = 0, // Not waiting to reconnect
+    WIFI_RECONNECT_STATE_WAITING    = 1, // Waiting before the next attempt
+    WIFI_RECONNECT_STATE_SCANNING   = 2, // Looking for APs with the same SSID
+    WIFI_RECONNECT_STATE_GAVE_UP    = 3, // Too many attempts
+} WIFI_RECONNECT_STATE;
+
+static WIFI_RECONNECT_STATE wifi_reconnect_state = WIFI_RECONNECT_STATE_IDLE;
+
+// Number of attempts since the last successful connection
+static unsigned int wifi_reconnect_attempts;
+
+static u32 wifi_reconnect_wait_start;
+static u32 wifi_reconnect_delay;
+
+static bool wifi_reconnect_sweep_done;
+
+// Only connections that have succeeded at least once are restored. If the
+// first attempt fails, the ARM9 is informed right away.
+static bool wifi_reconnect_armed;
+
+void Wifi_ReconnectReset(void)
+{
+    wifi_reconnect_armed = false;
+
+    if ((wifi_reconnect_state == WIFI_RECONNECT_STATE_IDLE) &&
+        (wifi_reconnect_attempts == 0))
+        return;
+
+    wifi_reconnect_state = WIFI_RECONNECT_STATE_IDLE;
+    wifi_reconnect_attempts = 0;
+    wifi_reconnect_sweep_done = false;
+
+    WifiData->flags7 &= ~(WFLAG_ARM7_RECONNECTING | WFLAG_ARM7_RECONNECT_FAILED);
+}
+
+void Wifi_ReconnectUpdateState(void)
+{
+    if (WifiData->reqMode != WIFIMODE_CONNECTED)
+    {
+        Wifi_ReconnectReset();
+    }
+    else if (WifiData->curMode == WIFIMODE_CONNECTED)
+    {
+        // The backoff starts again the next time the connection is lost
+        Wifi_ReconnectReset();
+        wifi_reconnect_armed = true;
+    }
+}
+
+static u32 Wifi_ReconnectGetDelay(void)
+{
+    volatile Wifi_ReconnectIpc *cfg = &WifiData->reconnect;
+
+    u32 max_delay = cfg->max_delay_ms;
+    u32 delay = cfg->base_delay_ms;
+
+    // Double the delay after every failed attempt
+    for (unsigned int i = 0; i < wifi_reconnect_attempts; i++)
+    {
+        if (delay >= max_delay)
+            break;
+        delay <<= 1;
+    }
+
+    if (delay > max_delay)
+        delay = max_delay;
+
+    return delay;
+}
+
+Wifi_ReconnectAction Wifi_ReconnectUpdate(u32 now_ms)
+{
+    if (!wifi_reconnect_armed)
+        return WIFI_RECONNECT_NONE;
+
+    if (!(WifiData->reqFlags & WFLAG_REQ_AUTO_RECONNECT))
+        return WIFI_RECONNECT_NONE;
+
+    volatile Wifi_ReconnectIpc *cfg = &WifiData->reconnect;
+
+    switch (wifi_reconnect_state)
+    {
+        case WIFI_RECONNECT_STATE_IDLE:
+        {
+            // The last connection attempt has failed (or the connection has
+            // just been lost). Wait before trying again.
+            if ((cfg->max_attempts != 0) &&
+                (wifi_reconnect_attempts >= cfg->max_attempts))
+            {
+                WLOG_PUTS("W: Reconnect: Giving up\n");
+                WLOG_FLUSH();
+                wifi_reconnect_state = WIFI_RECONNECT_STATE_GAVE_UP;
+                WifiData->flags7 &= ~WFLAG_ARM7_RECONNECTING;
+                WifiData->flags7 |= WFLAG_ARM7_RECONNECT_FAILED;
+                return WIFI_RECONNECT_NONE;
+            }
+
+            wifi_reconnect_delay = Wifi_ReconnectGetDelay();
+            wifi_reconnect_wait_start = now_ms;
+            wifi_reconnect_state = WIFI_RECONNECT_STATE_WAITING;
+            WifiData->flags7 |= WFLAG_ARM7_RECONNECTING;
+
+            WLOG_PRINTF("W: Reconnect: Wait %u ms\n",
+                        (unsigned int)wifi_reconnect_delay);
+            WLOG_FLUSH();
+            return WIFI_RECONNECT_NONE;
+        }
+        case WIFI_RECONNECT_STATE_WAITING:
+        {
+            if ((now_ms - wifi_reconnect_wait_start) < wifi_reconnect_delay)
+                return WIFI_RECONNECT_NONE;
+
+            wifi_reconnect_attempts++;
+
+            // Retry with the same AP first, it's the fastest option if the
+            // signal has only been lost for a short time.
+            if (wifi_reconnect_attempts <= cfg->same_bssid_retries)
+            {
+                wifi_reconnect_state = WIFI_RECONNECT_STATE_IDLE;
+                return WIFI_RECONNECT_RETRY;
+            }
+
+            wifi_reconnect_sweep_done = false;
+            wifi_reconnect_state = WIFI_RECONNECT_STATE_SCANNING;
+            return WIFI_RECONNECT_RESCAN;
+        }
+        case WIFI_RECONNECT_STATE_SCANNING:
+        case WIFI_RECONNECT_STATE_GAVE_UP:
+            break;
+    }
+
+    return WIFI_RECONNECT_NONE;
+}
+
+bool Wifi_ReconnectIsScanning(void)
+{
+    return wifi_reconnect_state == WIFI_RECONNECT_STATE_SCANNING;
+}
+
+void Wifi_ReconnectSweepDone(void)
+{
+    WifiData->scan_sweep_count++;
+
+    if (wifi_reconnect_state == WIFI_RECONNECT_STATE_SCANNING)
+        wifi_reconnect_sweep_done = true;
+}
+
+int Wifi_ReconnectScanResult(void)
+{
+    if (!wifi_reconnect_sweep_done)
+        return -1;
+
+    wifi_reconnect_sweep_done = false;
+    wifi_reconnect_state = WIFI_RECONNECT_STATE_IDLE;
+
+    volatile Wifi_AccessPoint *cur = &WifiData->curAp;
+
+    // The list of APs is modified from the interrupt handler in DS mode
+    int oldIME = enterCriticalSection();
+
+    int best = -1;
+
+    u32 mask = WifiData->aplist_active_mask;
+    while (mask)
+    {
+        int i = __builtin_ctz(mask);
+        mask &= ~BIT(i);
+
+        volatile Wifi_AccessPoint *ap = &WifiData->aplist[i];
+
+        if (ap->ssid_len != cur->ssid_len)
+            continue;
+        if (memcmp((const void *)ap->ssid, (const void *)cur->ssid, ap->ssid_len) != 0)
+            continue;
+
+        if ((best == -1) || (ap->rssi > WifiData->aplist[best].rssi))
+            best = i;
+    }
+
+    if (best != -1)
+    {
+        // curApSecurity isn't modified. All APs with the same SSID are
+        // expected to use the same password.
+        memcpy((void *)cur, (const void *)&WifiData->aplist[best],
+               sizeof(Wifi_AccessPoint));
+    }
+
+    leaveCriticalSection(oldIME);
+
+    if (best == -1)
+    {
+        WLOG_PUTS("W: Reconnect: AP not found\n");
+        WLOG_FLUSH();
+        return 0;
+    }
+
+    WLOG_PRINTF("W: Reconnect: Channel %u\n", (unsigned int)cur->channel);
+    WLOG_FLUSH();
+    return 1;
+}
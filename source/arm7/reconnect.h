@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#ifndef DSWIFI_ARM7_RECONNECT_H__
+#define DSWIFI_ARM7_RECONNECT_H__
+
+#include <nds/ndstypes.h>
+
+typedef enum {
+    WIFI_RECONNECT_NONE     = 0, // Stay in WIFIMODE_CANNOTCONNECT
+    WIFI_RECONNECT_RETRY    = 1, // Connect again to the AP in curAp
+    WIFI_RECONNECT_RESCAN   = 2, // Scan all channels for the same SSID first
+} Wifi_ReconnectAction;
+
+// Called by the NTR and TWL state machines while they are in mode
+// WIFIMODE_CANNOTCONNECT. It returns what the state machine needs to do next.
+// "now_ms" is a free running millisecond counter used to measure the backoff.
+Wifi_ReconnectAction Wifi_ReconnectUpdate(u32 now_ms);
+
+// Stops any automatic reconnection in progress. It's called whenever the ARM9
+// no longer wants to be connected.
+void Wifi_ReconnectReset(void);
+
+// Must be called at the end of every update of the NTR and TWL state machines.
+// It resets the backoff while the ARM7 is connected to an AP, and it stops the
+// reconnection if the ARM9 no longer wants to be connected.
+void Wifi_ReconnectUpdateState(void);
+
+// Returns true if the state machine is in scan mode because of a reconnection.
+bool Wifi_ReconnectIsScanning(void);
+
+// Called by the state machines whenever all channels have been scanned.
+void Wifi_ReconnectSweepDone(void);
+
+// Returns -1 while the reconnection scan is in progress. When it ends, it
+// returns 1 if an AP with the same SSID has been found (its information is
+// copied to curAp), or 0 if not.
+int Wifi_ReconnectScanResult(void);
+
+#endif // DSWIFI_ARM7_RECONNECT_H__
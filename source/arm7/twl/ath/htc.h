@@ -19,4 +19,17 @@
 void htc_handle_pkt(u16 pkt_cmd, u8 *pkt_data, u32 len, u32 ack_len);
 void htc_send_pkt(u16 htc_type, u8 ack_type, const void *data, u16 len);
 
+// Credits aren't tracked until the target sends HTC_MSG_READY
+void htc_credits_reset(void);
+// Takes the credits needed to send a packet of the specified size (including
+// the MBOX header) to an endpoint. If there aren't enough credits it returns
+// false, unless force is true.
+bool htc_credits_take(u8 endpoint, u32 len, bool force);
+// Returns true if the target should be asked to report credits
+bool htc_credits_low(u8 endpoint);
+// Handles a credit report from the trailer of a RX packet
+void htc_credits_report(u8 endpoint, u32 credits);
+// Restores all credits if the target hasn't reported any for a while
+bool htc_credits_tick(void);
+
 #endif // DSWIFI_ARM7_TWL_ATH_HTC_H__
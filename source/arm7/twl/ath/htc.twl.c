@@ -9,9 +9,141 @@
 #include "arm7/twl/ath/mbox.h"
 #include "arm7/twl/ath/wmi.h"
 #include "arm7/twl/card.h"
+#include "arm7/twl/utils.h"
 
 static u8 htc_buffer[0x80];
 
+// HTC credits
+// -----------
+//
+// The target has a pool of buffers for packets sent by the host. The host
+// splits them between the endpoints when the target sends HTC_MSG_READY. Every
+// packet uses one credit per credit_size bytes from its endpoint, and the
+// target returns them in credit reports when the packets have been processed.
+// The control endpoint (0) is only used during the handshake and it isn't
+// tracked.
+//
+// Some firmware versions don't send credit reports at all. Credits are only
+// taken after the target has sent the first report, so packets never wait for a
+// timeout if reports aren't going to arrive.
+
+#define HTC_MAX_ENDPOINTS       (8)
+
+// Credits given to the WMI endpoint. The rest go to the data endpoint.
+#define HTC_WMI_MAX_CREDITS     (4)
+
+// If no credits are reported for this long while some are in use, the target
+// is assumed to have processed all the packets that were sent.
+#define HTC_CREDIT_TIMEOUT_MS   (200)
+
+static bool htc_credits_enabled = false;
+static bool htc_credits_reported = false; // The target sends credit reports
+static u32 htc_credit_size;
+static s32 htc_credits[HTC_MAX_ENDPOINTS];
+static s32 htc_credits_initial[HTC_MAX_ENDPOINTS];
+static u32 htc_credit_time_ms;
+
+void htc_credits_reset(void)
+{
+    htc_credits_enabled = false;
+    htc_credits_reported = false;
+}
+
+static void htc_credits_init(u32 count, u32 size)
+{
+    WLOG_PRINTF("T: HTC credits: %u x %u B\n", (unsigned int)count,
+                (unsigned int)size);
+    WLOG_FLUSH();
+
+    if ((count < 2) || (size == 0))
+    {
+        htc_credits_enabled = false;
+        return;
+    }
+
+    memset(htc_credits_initial, 0, sizeof(htc_credits_initial));
+
+    s32 wmi_credits = count / 4;
+    if (wmi_credits < 1)
+        wmi_credits = 1;
+    if (wmi_credits > HTC_WMI_MAX_CREDITS)
+        wmi_credits = HTC_WMI_MAX_CREDITS;
+
+    htc_credits_initial[MBOXPKT_WMI] = wmi_credits;
+    htc_credits_initial[MBOXPKT_DATA] = count - wmi_credits;
+
+    memcpy(htc_credits, htc_credits_initial, sizeof(htc_credits));
+
+    htc_credit_size = size;
+    htc_credit_time_ms = wifi_card_get_time_ms();
+    htc_credits_enabled = true;
+}
+
+bool htc_credits_take(u8 endpoint, u32 len, bool force)
+{
+    if (!htc_credits_enabled || !htc_credits_reported)
+        return true;
+
+    if ((endpoint == 0) || (endpoint >= HTC_MAX_ENDPOINTS))
+        return true;
+
+    s32 needed = (len + htc_credit_size - 1) / htc_credit_size;
+
+    if (!force && (htc_credits[endpoint] < needed))
+        return false;
+
+    // Start counting the timeout when the credits start being used
+    if (htc_credits[endpoint] == htc_credits_initial[endpoint])
+        htc_credit_time_ms = wifi_card_get_time_ms();
+
+    htc_credits[endpoint] -= needed;
+
+    return true;
+}
+
+bool htc_credits_low(u8 endpoint)
+{
+    if (!htc_credits_enabled || (endpoint >= HTC_MAX_ENDPOINTS))
+        return false;
+
+    return htc_credits[endpoint] <= (htc_credits_initial[endpoint] / 2);
+}
+
+void htc_credits_report(u8 endpoint, u32 credits)
+{
+    if (!htc_credits_enabled || (endpoint >= HTC_MAX_ENDPOINTS))
+        return;
+
+    htc_credits_reported = true;
+
+    htc_credits[endpoint] += credits;
+    if (htc_credits[endpoint] > htc_credits_initial[endpoint])
+        htc_credits[endpoint] = htc_credits_initial[endpoint];
+
+    htc_credit_time_ms = wifi_card_get_time_ms();
+}
+
+bool htc_credits_tick(void)
+{
+    if (!htc_credits_enabled || !htc_credits_reported)
+        return false;
+
+    if (wifi_card_get_time_ms() - htc_credit_time_ms < HTC_CREDIT_TIMEOUT_MS)
+        return false;
+
+    if (memcmp(htc_credits, htc_credits_initial, sizeof(htc_credits)) == 0)
+        return false;
+
+    WLOG_PRINTF("T: HTC credit timeout (%d %d)\n",
+                (int)htc_credits[MBOXPKT_WMI], (int)htc_credits[MBOXPKT_DATA]);
+    WLOG_FLUSH();
+
+    memcpy(htc_credits, htc_credits_initial, sizeof(htc_credits));
+    htc_credit_time_ms = wifi_card_get_time_ms();
+
+    return true;
+}
+
 // WMI handshakes
 
 void htc_handle_pkt(u16 pkt_cmd, u8 *pkt_data, u32 len, u32 ack_len)
@@ -28,6 +160,10 @@ void htc_handle_pkt(u16 pkt_cmd, u8 *pkt_data, u32 len, u32 ack_len)
                         (unsigned int)ack_len);
             WLOG_FLUSH();
 
+            // Credit count and credit size
+            if (len >= 4)
+                htc_credits_init(getle16(&pkt_data[0]), getle16(&pkt_data[2]));
+
             const u8 wmi_handshake_1[6] = { 0x0, 0x1, 0x0, 0, 0, 0 };
             const u8 wmi_handshake_2[6] = { 0x1, 0x1, 0x5, 0, 0, 0 };
             const u8 wmi_handshake_3[6] = { 0x2, 0x1, 0x5, 0, 0, 0 };
@@ -57,10 +193,10 @@ void htc_handle_pkt(u16 pkt_cmd, u8 *pkt_data, u32 len, u32 ack_len)
             // WLOG_FLUSH();
             break;
         case HTC_MSG_UNK_0201:
-            // WLOG_PUTS("T: HTC_ACK\n");
-            // WLOG_FLUSH();
-            break;
         case HTC_MSG_UNK_0401:
+            // Packets without payload that only have a trailer with a credit
+            // report for one or two endpoints. The trailer has already been
+            // handled by wifi_card_mbox0_readpkt().
             break;
         default:
             WLOG_PRINTF("T: HTC ID 0x%x (%u B) 0x%x\n", (unsigned int)pkt_cmd,
@@ -13,7 +13,9 @@
 
 #include "arm7/access_point.h"
 #include "arm7/debug.h"
+#include "arm7/event.h"
 #include "arm7/ipc.h"
+#include "arm7/reconnect.h"
 #include "arm7/twl/ath/wmi.h"
 #include "arm7/twl/ath/mbox.h"
 #include "arm7/twl/ieee/wpa.h"
@@ -27,9 +29,14 @@
 
 #define IEEE_AUTH_PSK       (0x000FAC02)
 
+#define WMI_MAX_CHANNELS    (32)
+
+// Default dwell times used when scanning
+#define WMI_SCAN_ACTIVE_DWELL_MS    (20)
+#define WMI_SCAN_PASSIVE_DWELL_MS   (50)
+
 static u8 device_num_channels = 0;
-static u8 device_cur_channel_idx = 0;
-static u16 channel_freqs[32];
+static u16 channel_freqs[WMI_MAX_CHANNELS];
 
 u16 wmi_idk = 0;
 static bool wmi_bIsReady;
@@ -37,6 +44,9 @@ static bool wmi_bIsReady;
 // Set to true between WMI_START_SCAN_CMD and WMI_SCAN_COMPLETE_EVENT
 static bool wmi_is_scanning;
 
+// Set to true after the first scan of all channels has been started
+static bool wmi_scan_sweep_started;
+
 static bool ap_connected;
 static bool ap_connecting;
 
@@ -117,12 +127,17 @@ static void wmi_handle_get_channel_list(u8 *pkt_data, u32 len)
     WLOG_PRINTF("T: GET_CHANNEL_LIST_RESP (%u entries)\n", num_entries);
     WLOG_FLUSH();
 
-    device_num_channels = num_entries;
-
-    if (num_entries > 32)
-        num_entries = 32;
+    if (num_entries > WMI_MAX_CHANNELS)
+        num_entries = WMI_MAX_CHANNELS;
 
-    memcpy(channel_freqs, channel_entries, num_entries * sizeof(u16));
+    // Skip invalid entries so that the list can be passed to the firmware
+    device_num_channels = 0;
+    for (int i = 0; i < num_entries; i++)
+    {
+        u16 mhz = getle16((const u8 *)&channel_entries[i]);
+        if (mhz != 0)
+            channel_freqs[device_num_channels++] = mhz;
+    }
 
     // for (int i = 0; i < num_entries; i++)
     //     WLOG_PRINTF("T: %d: 0x%x\n", i, (unsigned int)channel_entries[i]);
@@ -144,6 +159,9 @@ static void wmi_handle_scan_complete(u8* pkt_data, u32 len)
     WLOG_FLUSH();
 #endif
     wmi_is_scanning = false;
+
+    // Start the next sweep without waiting for the next timer tick
+    wifi_card_request_update();
 }
 
 static int wifi_mhz_to_channel(unsigned int mhz)
@@ -343,6 +361,7 @@ void wmi_handle_pkt(u16 pkt_cmd, u8* pkt_data, u32 len, u32 ack_len)
             wmi_dbgoff();
 
             wmi_bIsReady = true;
+            wifi_card_request_update();
 
             break;
         }
@@ -382,6 +401,7 @@ void wmi_handle_pkt(u16 pkt_cmd, u8* pkt_data, u32 len, u32 ack_len)
 
             ap_connected = true;
             ap_connecting = false;
+            wifi_card_request_update();
 
             if ((WifiData->curAp.security_type == AP_SECURITY_OPEN) ||
                 (WifiData->curAp.security_type == AP_SECURITY_WEP))
@@ -403,6 +423,7 @@ void wmi_handle_pkt(u16 pkt_cmd, u8* pkt_data, u32 len, u32 ack_len)
 
             ap_connected = false;
             ap_connecting = false;
+            wifi_card_request_update();
 
             break;
         }
@@ -466,22 +487,32 @@ static void wmi_set_bss_filter(u8 filter, u32 ieMask)
                  (u8 *)&wmi_bss_filter, sizeof(wmi_bss_filter));
 }
 
-void wmi_set_channel_params(u16 mhz)
+static void wmi_set_channel_list(const u16 *mhz, u8 num_channels)
 {
-    const struct __attribute__((packed))
+    struct __attribute__((packed))
     {
         u8 reserved;
         u8 scanparam; // 1 to enable scanning
         u8 phyMode;
         u8 numChannels;
-        u16 channelList;
+        u16 channelList[WMI_MAX_CHANNELS];
     }
     wmi_params =
     {
-        0, 0, 3 /* 11AG 3, 11G 2 */, 1, mhz
+        0, 0, 3 /* 11AG 3, 11G 2 */, num_channels, { 0 }
     };
 
-    wmi_send_pkt(WMI_SET_CHANNEL_PARAMS_CMD, MBOXPKT_REQACK, &wmi_params, sizeof(wmi_params));
+    memcpy(wmi_params.channelList, mhz, num_channels * sizeof(u16));
+
+    size_t size = sizeof(wmi_params) - sizeof(wmi_params.channelList)
+                + num_channels * sizeof(u16);
+
+    wmi_send_pkt(WMI_SET_CHANNEL_PARAMS_CMD, MBOXPKT_REQACK, &wmi_params, size);
+}
+
+void wmi_set_channel_params(u16 mhz)
+{
+    wmi_set_channel_list(&mhz, 1);
 }
 
 static void wmi_set_scan_params(u8 flags, u16 maxact_chdwell_time,
@@ -509,9 +540,11 @@ static void wmi_set_scan_params(u8 flags, u16 maxact_chdwell_time,
     wmi_send_pkt(WMI_SET_SCAN_PARAMS_CMD, MBOXPKT_REQACK, &wmi_params, sizeof(wmi_params));
 }
 
-void wmi_start_scan(void)
+// Scans the channels in the list in one pass. WMI_SCAN_COMPLETE_EVENT is sent
+// after the last one.
+void wmi_start_scan(const u16 *mhz, u8 num_channels)
 {
-    const struct __attribute__((packed))
+    struct __attribute__((packed))
     {
         u32 forceFgScan;
         u32 isLegacy; // Legacy Cisco AP
@@ -519,16 +552,21 @@ void wmi_start_scan(void)
         u32 forceScanInterval;
         u8 scanType;
         u8 numChannels;
-        u16 channelList;
+        u16 channelList[WMI_MAX_CHANNELS];
     }
     wmi_params =
     {
-        0, 0, 20, 0, 0, 0, 0
+        0, 0, 20, 0, 0, num_channels, { 0 }
     };
 
+    memcpy(wmi_params.channelList, mhz, num_channels * sizeof(u16));
+
+    size_t size = sizeof(wmi_params) - sizeof(wmi_params.channelList)
+                + num_channels * sizeof(u16);
+
     wmi_is_scanning = true;
 
-    wmi_send_pkt(WMI_START_SCAN_CMD, MBOXPKT_REQACK, &wmi_params, sizeof(wmi_params));
+    wmi_send_pkt(WMI_START_SCAN_CMD, MBOXPKT_REQACK, &wmi_params, size);
 }
 
 void wmi_connect_cmd(void)
@@ -803,7 +841,7 @@ void wmi_scan_mode_start(void)
     WLOG_PUTS("T: Scan mode init\n");
     WLOG_FLUSH();
 
-    device_cur_channel_idx = 0;
+    wmi_scan_sweep_started = false;
 
     int lock = enterCriticalSection();
 
@@ -841,28 +879,40 @@ void wmi_scan_mode_tick(void)
     if (!device_num_channels)
         return;
 
-    if (!wmi_is_scanning)
+    if (wmi_is_scanning)
+        return;
+
+    if (wmi_scan_sweep_started)
     {
-        Wifi_AccessPointTick();
+        // The timeout of the APs counts channels, so age them by the number
+        // of channels that have been scanned.
+        Wifi_AccessPointTick(device_num_channels);
 
-        u16 mhz = channel_freqs[device_cur_channel_idx];
+        Wifi_EventSend(WIFI_EVENT_SCAN_SWEEP_DONE);
+        Wifi_ReconnectSweepDone();
+    }
+
+    u16 active_dwell_ms = WifiData->scan.active_dwell_ms;
+    if (active_dwell_ms == 0)
+        active_dwell_ms = WMI_SCAN_ACTIVE_DWELL_MS;
 
-        // WLOG_PRINTF("Scanning channel %u (%u)\n", device_cur_channel_idx, mhz);
-        // WLOG_FLUSH();
+    u16 passive_dwell_ms = WifiData->scan.passive_dwell_ms;
+    if (passive_dwell_ms == 0)
+        passive_dwell_ms = WMI_SCAN_PASSIVE_DWELL_MS;
 
-        device_cur_channel_idx++;
-        if (device_cur_channel_idx >= device_num_channels)
-            device_cur_channel_idx = 0;
+    // Let the firmware scan all channels in one pass. APs are added to the
+    // list as WMI_BSS_INFO_EVENT messages arrive.
+    int lock = enterCriticalSection();
 
-        if (!mhz)
-            return;
+    wmi_set_channel_list(channel_freqs, device_num_channels);
+    wmi_set_scan_params(1, active_dwell_ms, passive_dwell_ms, 0);
+    wmi_set_bss_filter(1, 0);
 
-        wmi_set_channel_params(mhz);
-        wmi_set_scan_params(1, 20, 50, 0);
-        wmi_set_bss_filter(1,0);
+    wmi_start_scan(channel_freqs, device_num_channels);
 
-        wmi_start_scan();
-    }
+    leaveCriticalSection(lock);
+
+    wmi_scan_sweep_started = true;
 }
 
 void wmi_connect(void)
@@ -962,6 +1012,9 @@ static void wmi_post_handshake(const u8 *tk, const gtk_keyinfo *gtk_info, const
     u8 tmp8 = 1;
     wmi_send_pkt(WMI_SYNCHRONIZE_CMD, MBOXPKT_REQACK, &tmp8, sizeof(tmp8)); // 0x0?
 
+    // The synchronize command must reach the target before the data packets
+    wifi_card_wmi_flush();
+
     u16 dummy = 0x0200;
     data_send_pkt((u8*)&dummy, sizeof(dummy));
     data_send_pkt((u8*)&dummy, sizeof(dummy));
@@ -1173,7 +1226,7 @@ static void data_send_wpa_gtkrenew(const u8 *dst_bssid, const u8 *src_bssid, u64
 // Send a raw Ethernet ARP+SNAP
 void data_send_link(void *ip_data, u32 ip_data_len)
 {
-    data_send_pkt_idk(ip_data, ip_data_len);
+    (void)data_send_pkt_idk(ip_data, ip_data_len);
 }
 
 void data_handle_auth(u8 *pkt_data, u32 len, const u8* dev_bssid, const u8 *ap_bssid_)
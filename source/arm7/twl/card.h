@@ -60,9 +60,19 @@ u32 wifi_card_read_intern_word(u32 addr);
 void wifi_card_write_intern_word(u32 addr, u32 data);
 
 void wifi_card_mbox0_send_packet(u8 type, u8 ack_type, const u8* data, u16 len, u16 idk);
+// Packets sent between these two calls are written to the mailbox back to back
+// and the mailbox status is only checked once at the end. They must be called
+// from inside a critical section.
+void wifi_card_mbox0_batch_begin(void);
+void wifi_card_mbox0_batch_end(void);
 u16 wifi_card_mbox0_readpkt(void);
 
-void data_send_pkt_idk(const u8 *pkt_data, u32 len);
+// Sends all the WMI commands that are waiting for the target to acknowledge
+// previous commands. Used when a data packet needs to be sent after them.
+void wifi_card_wmi_flush(void);
+
+// Returns false if the target doesn't have space for the packet right now
+bool data_send_pkt_idk(const u8 *pkt_data, u32 len);
 void data_send_pkt(const u8 *pkt_data, u32 len);
 void data_send_test(const u8* dst_bssid, const u8* src_bssid, u16 idk);
 
@@ -71,6 +81,10 @@ u32 wifi_card_host_interest_addr(void);
 void wifi_card_init(void);
 void wifi_card_deinit(void);
 bool wifi_card_initted(void);
+// Milliseconds since the card was initialized
+u32 wifi_card_get_time_ms(void);
+// Run Wifi_TWL_Update() at the end of the current card IRQ
+void wifi_card_request_update(void);
 
 int wifi_card_device_init(void);
 
@@ -13,9 +13,11 @@
 #include <nds/arm7/serial.h>
 
 #include "arm7/debug.h"
+#include "arm7/ipc.h"
 #include "arm7/twl/card.h"
 #include "arm7/twl/ndma.h"
 #include "arm7/twl/rx_queue.h"
+#include "arm7/twl/tx_queue.h"
 #include "arm7/twl/utils.h"
 #include "arm7/twl/update.h"
 #include "arm7/twl/ath/wmi.h"
@@ -39,13 +41,25 @@ static int wifi_card_wlan_init(void);
 #define AR6002_HOST_INTEREST_ADDRESS (0x00500400)
 #define AR601x_HOST_INTEREST_ADDRESS (0x00520000)
 
-#define SDIO_TICK_INTERVAL_MS (1)
+// Interval of the housekeeping timer. TX is flushed when the ARM9 sends a
+// WIFI_SYNC message and when the card raises an IRQ, and WMI events that change
+// the state of the connection run the state machine from the card IRQ, so this
+// timer only needs to run at a low rate.
+#define SDIO_TICK_INTERVAL_MS (50)
 #define MBOX_TMPBUF_SIZE (0x600)
 #define DATA_BUF_LEN (0x600)
 
+// Number of MBOX frames that can be queued for asynchronous transmission. While
+// the NDMA sends one frame the CPU can prepare the next one.
+#define MBOX_TX_SLOTS (2)
+
+// Number of MBOX RX buffers. While one packet is handled the next one can be
+// read to the other buffer.
+#define MBOX_RX_SLOTS (2)
+
 // TODO: Allocate from wifi_card_init()?
-static u8 mbox_out_buffer[MBOX_TMPBUF_SIZE] ALIGN(16);
-static u8 mbox_buffer[MBOX_TMPBUF_SIZE] ALIGN(16);
+static u8 mbox_out_buffer[MBOX_TX_SLOTS][MBOX_TMPBUF_SIZE] ALIGN(16);
+static u8 mbox_buffer[MBOX_RX_SLOTS][MBOX_TMPBUF_SIZE] ALIGN(16);
 
 // Uncomment to send all data bytewise, helpful for debugging.
 //#define SDIO_NO_BLOCKRW // MelonDS needs this uncommented... hangs on wifi_ndma_wait after write
@@ -56,6 +70,22 @@ static u8 mbox_buffer[MBOX_TMPBUF_SIZE] ALIGN(16);
 #define SDIO_FORCE_NO_BLOCKRW 0
 #endif
 
+// Uncomment to always pad MBOX packets to a whole number of blocks instead of
+// sending the last partial block with a byte mode CMD53.
+//#define SDIO_NO_BYTEMODE_TAIL
+
+// Block size used for MBOX transfers
+#define MBOX_BLOCK_SIZE (0x80)
+
+// Cost model of a CMD53 transfer, in SD clock cycles. It's used to decide if
+// the tail of a packet is sent with a byte mode CMD53 or padded to a full
+// block. The fixed cost is the 48-bit command and response plus the time spent
+// setting up the controller and the DMA. Every block of data on the 4-bit bus
+// costs 2 cycles per byte plus the start bit, CRC16, end bit and CRC status.
+#define CMD53_FIXED_COST        (256)
+#define CMD53_BLOCK_FIXED_COST  (26)
+#define CMD53_BYTE_COST         (2)
+
 
 #define WRITE_FOUT_1  0x72
 #define READ_FOUT_1   0x73
@@ -73,6 +103,17 @@ static u32 device_eeprom_version;
 
 static bool wifi_card_bInitted = false;
 
+// Set when the SDIO interface of the card has been set up. The card isn't
+// powered down by wifi_card_deinit(), so it doesn't need to be set up again
+// when WiFi is restarted.
+static bool wifi_card_sdio_ready = false;
+
+// Milliseconds counted by the timer that calls Wifi_TWL_Update()
+static u32 wifi_card_time_ms = 0;
+
+// Set by the WMI event handlers when the state machine needs to run
+static volatile bool wifi_card_update_requested = false;
+
 static u32 __attribute((aligned(16))) wifi_card_alignedbuf_small[4];
 
 // CMD52 - IO_RW_DIRECT (read/write single register).
@@ -120,7 +161,6 @@ static const wifi_sdio_command cmd53_write =
     .secure = true,
 };
 
-#if 0
 static const wifi_sdio_command cmd53_write_single =
 {
     .cmd = 53,
@@ -133,7 +173,6 @@ static const wifi_sdio_command cmd53_write_single =
     .data_length = wifi_sdio_single_block,
     .secure = true,
 };
-#endif
 
 // Device info
 
@@ -156,6 +195,9 @@ static const char *wifi_card_get_chip_str(void)
 
 // SDIO basics
 
+static void wifi_card_sdio_drain(void);
+static void wifi_card_mbox0_prefetch_finish(void);
+
 static int wifi_card_write_func_byte(u8 func, u32 addr, u8 val)
 {
     // Read register 0x02 (function enable) hibyte until it's ready
@@ -169,6 +211,8 @@ static int wifi_card_write_func_byte(u8 func, u32 addr, u8 val)
 
 static int wifi_card_read_func1_32bit(u32 addr, void* buf, u32 len)
 {
+    wifi_card_sdio_drain();
+
     //wifi_sdio_stop();
 
     wlan_ctx.tmio.buffer = buf;
@@ -194,8 +238,12 @@ static int wifi_card_read_func1_32bit(u32 addr, void* buf, u32 len)
     return 0;
 }
 
-static int wifi_card_read_func1_block(u32 addr, void* buf, u32 len)
+// Starts a block mode read with NDMA and returns without waiting for it to end.
+// Call wifi_card_read_func1_block_end() to wait for it.
+static void wifi_card_read_func1_block_start(u32 addr, void* buf, u32 len)
 {
+    wifi_card_sdio_drain();
+
     wifi_ndma_wait();
     wifi_sdio_stop();
 
@@ -206,7 +254,10 @@ static int wifi_card_read_func1_block(u32 addr, void* buf, u32 len)
     u8 funcnum = 1;
     wifi_card_send_command_alt(cmd53_read,
             (funcnum << 28) | (1 << 27) | (1 << 26) | (addr & 0x1FFFF) << 9 | (blkcnt));
+}
 
+static int wifi_card_read_func1_block_end(void)
+{
     wifi_sdio_stop();
     wifi_ndma_wait();
 
@@ -216,8 +267,19 @@ static int wifi_card_read_func1_block(u32 addr, void* buf, u32 len)
     return 0;
 }
 
-static int wifi_card_write_func1_block(u32 addr, void* buf, u32 len)
+static int wifi_card_read_func1_block(u32 addr, void* buf, u32 len)
+{
+    wifi_card_read_func1_block_start(addr, buf, len);
+
+    return wifi_card_read_func1_block_end();
+}
+
+// Starts a block mode write with NDMA and returns without waiting for it to end.
+// Call wifi_card_write_func1_block_end() when the DMA isn't busy anymore.
+static void wifi_card_write_func1_block_start(u32 addr, void* buf, u32 len)
 {
+    wifi_card_sdio_drain();
+
     wifi_ndma_wait();
 
     wifi_sdio_stop();
@@ -230,7 +292,10 @@ static int wifi_card_write_func1_block(u32 addr, void* buf, u32 len)
     wifi_card_send_command_alt(cmd53_write,
             BIT(31) /* write flag */ | (funcnum << 28) | (1 << 27) | (1 << 26) |
             ((addr & 0x1FFFF) << 9) | (blkcnt));
+}
 
+static int wifi_card_write_func1_block_end(void)
+{
     if (!wifi_ndma_wait())
     {
         WLOG_PUTS("T: NDMA t/o, fallbck to nrml wr\n");
@@ -245,6 +310,44 @@ static int wifi_card_write_func1_block(u32 addr, void* buf, u32 len)
     return 0;
 }
 
+static int wifi_card_write_func1_block(u32 addr, void* buf, u32 len)
+{
+    wifi_card_write_func1_block_start(addr, buf, len);
+
+    return wifi_card_write_func1_block_end();
+}
+
+// Byte mode write. The size must be a multiple of 4 (the data FIFO is written
+// in words) and it can't be bigger than 512 bytes.
+static int wifi_card_write_func1_bytes(u32 addr, void* buf, u32 len)
+{
+    wifi_card_sdio_drain();
+
+    wifi_ndma_wait();
+
+    wifi_sdio_stop();
+
+    wlan_ctx.tmio.buffer = buf;
+    wlan_ctx.tmio.size = len;
+
+    u32 old_blocksize = wlan_ctx.tmio.block_size;
+    wlan_ctx.tmio.block_size = len;
+    u16 bytecnt = len & 0x1FF; // 0 means 512 bytes
+    u8 funcnum = 1;
+    wifi_card_send_command_alt(cmd53_write_single,
+            BIT(31) /* write flag */ | (funcnum << 28) | (1 << 26) |
+            ((addr & 0x1FFFF) << 9) | (bytecnt));
+
+    wifi_sdio_stop();
+
+    wlan_ctx.tmio.block_size = old_blocksize;
+
+    if (wlan_ctx.tmio.status & 4)
+        return -1;
+
+    return 0;
+}
+
 u8 wifi_card_read_func_byte(u8 func, u32 addr)
 {
     // Read register 0x02 (function enable) hibyte until it's ready
@@ -492,16 +595,223 @@ static bool wifi_card_read_mbox0_u32_timeout(u32* retv, u32 timeout_max)
     return true;
 }
 
+// When a TX batch is active the mailbox status is only read once, at the end of
+// the batch, instead of after every packet. Batches can be nested.
+static int wifi_card_tx_batch_depth = 0;
+
+// Number of frames sent since the last time the mailbox status was checked
+static u32 wifi_card_tx_unchecked = 0;
+
+static void wifi_card_mbox0_check_tx_overflow(void)
+{
+    u32 intval = wifi_card_read_func1_u32(F1_HOST_INT_STATUS);
+    if (intval & 0x00010000) // tx overflow
+    {
+        WLOG_PRINTF("T: mbox full 0x%x 0x%x\n",
+                    (unsigned int)wifi_card_read_func1_u32(F1_HOST_INT_STATUS),
+                    (unsigned int)wifi_card_read_func1_u8(F1_RX_LOOKAHEAD_VALID));
+        WLOG_FLUSH();
+    }
+}
+
+static u32 wifi_card_cmd53_cost(u32 blocks, u32 block_size)
+{
+    return CMD53_FIXED_COST
+           + blocks * (CMD53_BLOCK_FIXED_COST + block_size * CMD53_BYTE_COST);
+}
+
+// Returns the number of bytes at the end of a packet of the specified size
+// that should be sent with a byte mode CMD53, or 0 if the whole packet should
+// be padded to a full number of blocks and sent with block mode CMD53.
+static u32 wifi_card_mbox0_plan_tail(u32 len)
+{
+#ifdef SDIO_NO_BYTEMODE_TAIL
+    (void)len;
+    return 0;
+#else
+    u32 blocks = len / MBOX_BLOCK_SIZE;
+    u32 tail = round_up(len % MBOX_BLOCK_SIZE, 4);
+
+    if (tail == 0 || tail == MBOX_BLOCK_SIZE)
+        return 0;
+
+    u32 cost_padded = wifi_card_cmd53_cost(blocks + 1, MBOX_BLOCK_SIZE);
+
+    u32 cost_split = wifi_card_cmd53_cost(1, tail);
+    if (blocks > 0)
+        cost_split += wifi_card_cmd53_cost(blocks, MBOX_BLOCK_SIZE);
+
+    if (cost_split >= cost_padded)
+        return 0;
+
+    return tail;
+#endif
+}
+
+// Splits a packet in the part sent with block mode CMD53 (head) and the part
+// sent with byte mode CMD53 (tail). The end of the message is signaled by the
+// write that reaches the end of the mailbox address range, so the tail must be
+// sent last.
+static void wifi_card_mbox0_plan(u32 len, u32 *head, u32 *tail)
+{
+    *tail = wifi_card_mbox0_plan_tail(len);
+
+    if (*tail == 0)
+        *head = round_up(len, MBOX_BLOCK_SIZE);
+    else
+        *head = len - (len % MBOX_BLOCK_SIZE);
+}
+
+static void wifi_card_mbox0_sent(u32 len, u32 head, u32 tail)
+{
+    WifiData->stats[WSTAT_TXMBOXBYTES] += head + tail;
+    WifiData->stats[WSTAT_TXMBOXPADSAVED] += round_up(len, MBOX_BLOCK_SIZE) - (head + tail);
+
+    wifi_card_tx_unchecked++;
+}
+
+// Asynchronous TX
+// ---------------
+//
+// Frames are built in one of the slots of mbox_out_buffer and queued. The head
+// of the frame is sent with NDMA, and the CPU doesn't wait for it to end. The
+// NDMA IRQ finishes the transfer (it sends the tail, if any) and starts the
+// next frame in the queue. Any other access to the SDIO bus waits until the
+// queue is empty by calling wifi_card_sdio_drain().
+//
+// All of this must be done with interrupts disabled.
+
+typedef struct {
+    u32 len;  // Size of the frame without padding
+    u32 head; // Bytes sent with a block mode CMD53 (NDMA)
+    u32 tail; // Bytes sent with a byte mode CMD53 after the NDMA transfer
+} wifi_card_tx_request;
+
+static wifi_card_tx_request wifi_card_tx_queue[MBOX_TX_SLOTS];
+static u32 wifi_card_tx_first = 0; // Oldest request in the queue
+static u32 wifi_card_tx_count = 0; // Number of requests in the queue
+static bool wifi_card_tx_in_flight = false; // The oldest request is using NDMA
+
+static void wifi_card_tx_check_idle(void)
+{
+    if (wifi_card_tx_batch_depth > 0 || wifi_card_tx_count > 0)
+        return;
+
+    if (wifi_card_tx_unchecked == 0)
+        return;
+
+    wifi_card_tx_unchecked = 0;
+    wifi_card_mbox0_check_tx_overflow();
+}
+
+// Starts the oldest request in the queue. Requests that don't need NDMA are
+// finished right away.
+static void wifi_card_tx_kick(void)
+{
+    while (wifi_card_tx_count > 0 && !wifi_card_tx_in_flight)
+    {
+        wifi_card_tx_request *req = &wifi_card_tx_queue[wifi_card_tx_first];
+        u8 *data = mbox_out_buffer[wifi_card_tx_first];
+
+        if (req->head > 0)
+        {
+            wifi_ndma_set_irq(true);
+            wifi_card_write_func1_block_start(0x4000 - req->head - req->tail,
+                                              data, req->head);
+            wifi_ndma_set_irq(false);
+
+            wifi_card_tx_in_flight = true;
+            return;
+        }
+
+        wifi_card_write_func1_bytes(0x4000 - req->tail, data, req->tail);
+        wifi_card_mbox0_sent(req->len, req->head, req->tail);
+
+        wifi_card_tx_first = (wifi_card_tx_first + 1) % MBOX_TX_SLOTS;
+        wifi_card_tx_count--;
+    }
+
+    wifi_card_tx_check_idle();
+}
+
+// Finishes the request that is using NDMA and starts the next one. The NDMA
+// transfer must have ended.
+static void wifi_card_tx_complete(void)
+{
+    wifi_card_tx_request *req = &wifi_card_tx_queue[wifi_card_tx_first];
+    u8 *data = mbox_out_buffer[wifi_card_tx_first];
+
+    wifi_card_tx_in_flight = false;
+
+    wifi_card_write_func1_block_end();
+
+    if (req->tail > 0)
+        wifi_card_write_func1_bytes(0x4000 - req->tail, data + req->head, req->tail);
+
+    wifi_card_mbox0_sent(req->len, req->head, req->tail);
+
+    wifi_card_tx_first = (wifi_card_tx_first + 1) % MBOX_TX_SLOTS;
+    wifi_card_tx_count--;
+
+    wifi_card_tx_kick();
+}
+
+static void wifi_card_tx_wait_one(void)
+{
+    // wifi_card_write_func1_block_end() waits for the NDMA to end and handles
+    // timeouts by switching to bytewise transfers.
+    if (wifi_card_tx_in_flight)
+        wifi_card_tx_complete();
+}
+
+static void wifi_card_sdio_drain(void)
+{
+    wifi_card_mbox0_prefetch_finish();
+
+    if (!wifi_card_tx_in_flight)
+        return;
+
+    int lock = enterCriticalSection();
+
+    while (wifi_card_tx_in_flight)
+        wifi_card_tx_wait_one();
+
+    leaveCriticalSection(lock);
+}
+
+static void wifi_card_ndma_irq(void)
+{
+    int lock = enterCriticalSection();
+
+    // The IRQ may have been handled already by wifi_card_sdio_drain(). Also,
+    // ignore it if the transfer that is in progress hasn't finished.
+    if (wifi_card_tx_in_flight && !ndmaBusy(WIFI_NDMA_CHAN))
+        wifi_card_tx_complete();
+
+    leaveCriticalSection(lock);
+}
+
+// Returns the buffer where the next frame has to be built. If all buffers are
+// in use it waits until the oldest frame has been sent.
+static u8 *wifi_card_mbox0_tx_buffer(void)
+{
+    while (wifi_card_tx_count == MBOX_TX_SLOTS)
+        wifi_card_tx_wait_one();
+
+    return mbox_out_buffer[(wifi_card_tx_first + wifi_card_tx_count) % MBOX_TX_SLOTS];
+}
+
 // TODO: Move this to block transfers.
 // This could get tricky since we'd be unable to failsafe on TX overflows.
 // Maybe it would be better to make a DMA330 driver specifically
 // for this? Or just ignore overflows/find a good way to manage them.
 static void wifi_card_mbox0_sendbytes(const u8 *data, u32 len)
 {
-    u16 send_addr = 0x4000 - len;
-
     if (wlan_ctx.is_melonds || SDIO_FORCE_NO_BLOCKRW)
     {
+        len = round_up(len, MBOX_BLOCK_SIZE);
+        u16 send_addr = 0x4000 - len;
+
         for (u32 i = 0; i < len; i++)
         {
             wifi_card_write_func1_u8(send_addr, data[i]);
@@ -510,49 +820,98 @@ static void wifi_card_mbox0_sendbytes(const u8 *data, u32 len)
             if (send_addr >= 0x4000)
                 send_addr = 0x3F80;
         }
+
+        wifi_card_mbox0_sent(len, len, 0);
     }
     else
-        wifi_card_write_func1_block(send_addr, (void*)data, len);
-    u32 intval = wifi_card_read_func1_u32(F1_HOST_INT_STATUS);
-    if (intval & 0x00010000) // tx overflow
     {
-        WLOG_PRINTF("T: mbox full 0x%x 0x%x\n",
-                    (unsigned int)wifi_card_read_func1_u32(F1_HOST_INT_STATUS),
-                    (unsigned int)wifi_card_read_func1_u8(F1_RX_LOOKAHEAD_VALID));
-        WLOG_FLUSH();
+        u32 head, tail;
+        wifi_card_mbox0_plan(len, &head, &tail);
+
+        if (head > 0)
+            wifi_card_write_func1_block(0x4000 - head - tail, (void*)data, head);
+
+        if (tail > 0)
+            wifi_card_write_func1_bytes(0x4000 - tail, (void*)(data + head), tail);
+
+        wifi_card_mbox0_sent(len, head, tail);
     }
 
+    wifi_card_tx_check_idle();
+
     //wifi_card_bmi_wait_count4();
 }
 
+// Sends the frame built in the buffer returned by wifi_card_mbox0_tx_buffer().
+// It doesn't wait for the transfer to end.
+static void wifi_card_mbox0_queue(u32 len)
+{
+    u32 slot = (wifi_card_tx_first + wifi_card_tx_count) % MBOX_TX_SLOTS;
+
+    if (wlan_ctx.is_melonds || SDIO_FORCE_NO_BLOCKRW)
+    {
+        wifi_card_mbox0_sendbytes(mbox_out_buffer[slot], len);
+        return;
+    }
+
+    wifi_card_tx_request *req = &wifi_card_tx_queue[slot];
+
+    req->len = len;
+    wifi_card_mbox0_plan(len, &req->head, &req->tail);
+
+    wifi_card_tx_count++;
+
+    wifi_card_tx_kick();
+}
+
+void wifi_card_mbox0_batch_begin(void)
+{
+    wifi_card_tx_batch_depth++;
+}
+
+void wifi_card_mbox0_batch_end(void)
+{
+    wifi_card_tx_batch_depth--;
+
+    // If there are frames in the queue this is done after the last one is sent
+    wifi_card_tx_check_idle();
+}
+
 void wifi_card_mbox0_send_packet(u8 type, u8 ack_type, const u8* data, u16 len, u16 idk)
 {
-    //memset(mbox_out_buffer, 0x0, round_up(len, 0x80));
+    int lock = enterCriticalSection();
 
-    mbox_out_buffer[0] = type;
-    mbox_out_buffer[1] = ack_type;
-    *(u16*)&mbox_out_buffer[2] = len;
-    *(u16*)&mbox_out_buffer[4] = idk;
+    u8 *out = wifi_card_mbox0_tx_buffer();
+
+    //memset(out, 0x0, round_up(len, 0x80));
+
+    out[0] = type;
+    out[1] = ack_type;
+    *(u16*)&out[2] = len;
+    *(u16*)&out[4] = idk;
 
     // Truncate to mbox_out_buffer size
     if (len > (MBOX_TMPBUF_SIZE - 0x6))
         len = (MBOX_TMPBUF_SIZE - 0x6);
 
     if (data)
-        memcpy(&mbox_out_buffer[6], data, len);
+        memcpy(&out[6], data, len);
 
     len = len + 6;
 
-    // Round to 0x80, block size
-    // TODO can this size be reduced?
-    len = round_up(len, 0x80);
+    // The size is rounded up to the block size (or to a word for short tails)
+    // by wifi_card_mbox0_queue().
+
+    //hexdump(out, 8);
 
-    //hexdump(mbox_out_buffer, 8);
+    wifi_card_mbox0_queue(len); // len
 
-    wifi_card_mbox0_sendbytes(mbox_out_buffer, len); // len
+    leaveCriticalSection(lock);
 }
 
-static void data_handle_pkt(u8 *pkt_data, u32 len)
+// If ring_idx isn't -1 the packet has been read straight to the RX queue of the
+// ARM9 and it only needs to be committed.
+static void data_handle_pkt(u8 *pkt_data, u32 len, int ring_idx)
 {
     struct __attribute__((packed)) {
         s16 rssi;
@@ -595,7 +954,11 @@ static void data_handle_pkt(u8 *pkt_data, u32 len)
         WLOG_FLUSH();
 #endif
 
-        if (Wifi_TWL_RxAddPacketToQueue(pkt_data, len) != 0)
+        if (ring_idx != -1)
+        {
+            Wifi_TWL_RxCommitPacket(ring_idx, len);
+        }
+        else if (Wifi_TWL_RxAddPacketToQueue(pkt_data, len) != 0)
         {
             WLOG_PUTS("T: RX queue full\n");
             WLOG_FLUSH();
@@ -603,103 +966,471 @@ static void data_handle_pkt(u8 *pkt_data, u32 len)
     }
 }
 
+// Ask the target for a credit report when the data endpoint is running out of
+// credits, so that they are returned as soon as possible.
+static u8 data_ack_type(void)
+{
+    return htc_credits_low(MBOXPKT_DATA) ? MBOXPKT_REQACK : MBOXPKT_NOACK;
+}
+
 void data_send_pkt(const u8 *pkt_data, u32 len)
 {
     int lock = enterCriticalSection();
+    // Packets generated by the ARM7 can't wait, so they are sent even if there
+    // aren't enough credits.
+    htc_credits_take(MBOXPKT_DATA, len + 6, true);
     // 0x2008 causes broadcast packets?
-    wifi_card_mbox0_send_packet(0x02, MBOXPKT_NOACK, pkt_data, len, 0);
+    wifi_card_mbox0_send_packet(0x02, data_ack_type(), pkt_data, len, 0);
     leaveCriticalSection(lock);
 }
 
-void data_send_pkt_idk(const u8 *pkt_data, u32 len)
+bool data_send_pkt_idk(const u8 *pkt_data, u32 len)
 {
     int lock = enterCriticalSection();
+
+    if (!htc_credits_take(MBOXPKT_DATA, len + 6, false))
+    {
+        leaveCriticalSection(lock);
+        return false;
+    }
+
     // 0x2008 causes broadcast packets? and might be faster?
-    wifi_card_mbox0_send_packet(0x02, MBOXPKT_NOACK, pkt_data, len, 0x2008);
+    wifi_card_mbox0_send_packet(0x02, data_ack_type(), pkt_data, len, 0x2008);
     leaveCriticalSection(lock);
+
+    return true;
 }
 
 extern u16 wmi_idk;
 
-void wmi_send_pkt(u16 wmi_type, u8 ack_type, const void *data, u16 len)
+// WMI command queue
+// -----------------
+//
+// Every WMI command uses HTC credits of the WMI endpoint until the target has
+// processed it. Commands are only sent if there are credits available, the rest
+// wait in the queue. When credits arrive all the commands that fit are sent
+// back to back in one TX batch.
+//
+// All of this must be done with interrupts disabled.
+
+#define WMI_CMD_QUEUE_LEN       (16)
+
+// Largest command that fits in one MBOX block with the MBOX and WMI headers.
+// Bigger commands aren't queued.
+#define WMI_CMD_MAX_SIZE        (MBOX_BLOCK_SIZE - 8)
+
+typedef struct {
+    u16 wmi_type;
+    u16 idk;
+    u8 ack_type;
+    u16 len;
+    u8 data[WMI_CMD_MAX_SIZE];
+} wifi_card_wmi_cmd;
+
+static wifi_card_wmi_cmd wifi_card_wmi_queue[WMI_CMD_QUEUE_LEN];
+static u32 wifi_card_wmi_first = 0; // Oldest command in the queue
+static u32 wifi_card_wmi_count = 0; // Number of commands in the queue
+
+static void wifi_card_wmi_send_now(u16 wmi_type, u8 ack_type, u16 idk,
+                                   const void *data, u16 len)
 {
-    int lock = enterCriticalSection();
-    // memset(mbox_out_buffer, 0, round_up(len, 0x80));
-    memset(mbox_out_buffer, 0, 0x8);
+    u8 *out = wifi_card_mbox0_tx_buffer();
 
-    mbox_out_buffer[0] = MBOXPKT_WMI;
-    mbox_out_buffer[1] = ack_type;
-    *(u16*)&mbox_out_buffer[2] = len + sizeof(u16);
-    *(u16*)&mbox_out_buffer[4] = wmi_idk;
+    // memset(out, 0, round_up(len, 0x80));
+    memset(out, 0, 0x8);
 
-    *(u16*)&mbox_out_buffer[6 + 0] = wmi_type;
+    out[0] = MBOXPKT_WMI;
+    out[1] = ack_type;
+    *(u16*)&out[2] = len + sizeof(u16);
+    *(u16*)&out[4] = idk;
+    *(u16*)&out[6 + 0] = wmi_type;
 
     // Truncate to mbox_out_buffer size
     // TODO: Crash here?
     if (len > (MBOX_TMPBUF_SIZE - 0x8))
         len = (MBOX_TMPBUF_SIZE - 0x8);
 
-    if (data)
-        memcpy(&mbox_out_buffer[6 + 2], data, len);
+    if (data)
+        memcpy(&out[6 + 2], data, len);
+
+    len = len + 8;
+
+    // The size is rounded up to the block size (or to a word for short tails)
+    // by wifi_card_mbox0_queue().
+
+    //hexdump(out, 20);
+
+    wifi_card_mbox0_queue(len);
+}
+
+// Sends the commands in the queue. If force is false it stops when there aren't
+// enough credits for the next command.
+static void wifi_card_wmi_flush_queue(bool force)
+{
+    if (wifi_card_wmi_count == 0)
+        return;
+
+    wifi_card_mbox0_batch_begin();
+
+    while (wifi_card_wmi_count > 0)
+    {
+        wifi_card_wmi_cmd *cmd = &wifi_card_wmi_queue[wifi_card_wmi_first];
+
+        if (!htc_credits_take(MBOXPKT_WMI, cmd->len + 8, force))
+            break;
+
+        wifi_card_wmi_send_now(cmd->wmi_type, cmd->ack_type, cmd->idk,
+                               cmd->data, cmd->len);
+
+        wifi_card_wmi_first = (wifi_card_wmi_first + 1) % WMI_CMD_QUEUE_LEN;
+        wifi_card_wmi_count--;
+    }
+
+    wifi_card_mbox0_batch_end();
+}
+
+void wifi_card_wmi_flush(void)
+{
+    int lock = enterCriticalSection();
+    wifi_card_wmi_flush_queue(true);
+    leaveCriticalSection(lock);
+}
+
+// Handles the credit reports in the trailer of a RX packet
+static void wifi_card_credit_report(const u8 *report, u32 len)
+{
+    int lock = enterCriticalSection();
+
+    for (u32 i = 0; i + 1 < len; i += 2)
+        htc_credits_report(report[i], report[i + 1]);
+
+    wifi_card_wmi_flush_queue(false);
+
+    leaveCriticalSection(lock);
+}
+
+static void wifi_card_credit_tick(void)
+{
+    int lock = enterCriticalSection();
+
+    if (htc_credits_tick())
+        wifi_card_wmi_flush_queue(false);
+
+    leaveCriticalSection(lock);
+}
+
+static void wifi_card_wmi_reset(void)
+{
+    wifi_card_wmi_first = 0;
+    wifi_card_wmi_count = 0;
+
+    htc_credits_reset();
+}
+
+void wmi_send_pkt(u16 wmi_type, u8 ack_type, const void *data, u16 len)
+{
+    int lock = enterCriticalSection();
+
+    if ((len > WMI_CMD_MAX_SIZE) || (wifi_card_wmi_count == WMI_CMD_QUEUE_LEN))
+    {
+        if (wifi_card_wmi_count == WMI_CMD_QUEUE_LEN)
+        {
+            WLOG_PUTS("T: WMI queue full\n");
+            WLOG_FLUSH();
+        }
+
+        // Keep the order of the commands
+        wifi_card_wmi_flush_queue(true);
+        htc_credits_take(MBOXPKT_WMI, len + 8, true);
+        wifi_card_wmi_send_now(wmi_type, ack_type, wmi_idk, data, len);
+    }
+    else
+    {
+        u32 slot = (wifi_card_wmi_first + wifi_card_wmi_count) % WMI_CMD_QUEUE_LEN;
+        wifi_card_wmi_cmd *cmd = &wifi_card_wmi_queue[slot];
+
+        cmd->wmi_type = wmi_type;
+        cmd->idk = wmi_idk;
+        cmd->ack_type = ack_type;
+        cmd->len = len;
+        if (data)
+            memcpy(cmd->data, data, len);
+        else
+            memset(cmd->data, 0, len);
+
+        wifi_card_wmi_count++;
+
+        wifi_card_wmi_flush_queue(false);
+    }
+
+    leaveCriticalSection(lock);
+}
+
+
+static bool mbox_has_lookahead = false;
+static u32 mbox_lookahead = 0;
+
+// RX buffer used by the packet that is being read
+static u32 mbox_rx_slot = 0;
+
+// Number of active calls to wifi_card_mbox0_readpkt(). Packet handlers may
+// read packets themselves, and prefetching is only done from the outermost
+// call so that the buffer of a packet that is being handled isn't overwritten.
+static int mbox_rx_depth = 0;
+
+// Prefetched packet. The header comes from the lookahead of the previous
+// packet, and the NDMA transfer may still be active.
+static bool mbox_rx_prefetched = false;
+static bool mbox_rx_prefetch_active = false;
+static bool mbox_rx_prefetch_failed = false;
+static u32 mbox_rx_prefetch_header = 0;
+static u8 *mbox_rx_prefetch_buffer = NULL;
+static int mbox_rx_prefetch_ring_idx = -1;
+
+static bool wifi_card_mbox0_is_data_pkt(u32 header)
+{
+    u8 pkt_type = header & 0xFF;
+
+    // One of my routers sends 0x04 for some reason
+    return pkt_type == 2 || pkt_type == 3 || pkt_type == 4 || pkt_type == 5;
+}
+
+// Data packets are read straight to the RX queue of the ARM9, which saves one
+// copy. This returns the index of the space reserved in the RX queue, or -1 if
+// the packet has to be read to a MBOX buffer.
+static int wifi_card_mbox0_rx_reserve(u32 header, u32 full_len)
+{
+    if (!wifi_card_mbox0_is_data_pkt(header))
+        return -1;
+
+    if (wlan_ctx.is_melonds || SDIO_FORCE_NO_BLOCKRW)
+        return -1;
+
+    return Wifi_TWL_RxReservePacket(full_len);
+}
+
+static u16 wifi_card_mbox0_readbytes(u8 *read_buffer, u32 sz_buf, u32 len_read)
+{
+#ifdef SDIO_NO_BLOCKRW
+    // Read out all data that we can
+    //int end_cnt = 0;
+    u16 actual_len = 0;
+    while (1) // Read until we see the EOM bit thrice
+    {
+        while (!(wifi_card_read_func1_u8(F1_HOST_INT_STATUS) & 1)); // We don't have data...
+
+        u8 val = wifi_card_read_func1_u8(0xFF); // (0x1000 - full_len)+actual_len
+
+        if (actual_len < sz_buf)
+            read_buffer[actual_len] = val;
+
+        actual_len++;
+
+        if (actual_len >= read_len)
+            break;
+
+        // We've reached the last few bytes of the packet
+        /*
+        if (wifi_card_read_func1_u8(F1_MBOX_FRAME) & 0x10)
+            end_cnt++;
+
+        if (end_cnt > 3)
+            break;
+        */
+    }
+#else
+    (void)sz_buf;
+    u16 actual_len = len_read;
+    u16 send_addr = 0x4000 - len_read;
+    wifi_card_read_func1_block(send_addr, read_buffer, len_read);
+#endif
+
+    return actual_len;
+}
+
+// Waits until the NDMA transfer of the prefetched packet ends. The packet stays
+// in its buffer until wifi_card_mbox0_readpkt() handles it.
+static void wifi_card_mbox0_prefetch_finish(void)
+{
+    if (!mbox_rx_prefetch_active)
+        return;
+
+    mbox_rx_prefetch_active = false;
+    mbox_rx_prefetch_failed = wifi_card_read_func1_block_end() != 0;
+}
+
+// Starts reading the packet described by a lookahead header into the RX buffer
+// that isn't being used. Returns false if the packet can't be prefetched.
+static bool wifi_card_mbox0_prefetch_start(u32 header)
+{
+#ifdef SDIO_NO_BLOCKRW
+    (void)header;
+    return false;
+#else
+    if (wlan_ctx.is_melonds || mbox_rx_depth > 1)
+        return false;
+
+    u16 len = header >> 16;
+    u16 full_len = round_up(len + 6, 0x80);
+
+    u8 *read_buffer;
+    int ring_idx = wifi_card_mbox0_rx_reserve(header, full_len);
+    if (ring_idx != -1)
+    {
+        read_buffer = Wifi_TWL_RxReservedBuffer(ring_idx);
+    }
+    else
+    {
+        if (full_len > MBOX_TMPBUF_SIZE)
+            return false;
+
+        mbox_rx_slot = (mbox_rx_slot + 1) % MBOX_RX_SLOTS;
+        read_buffer = mbox_buffer[mbox_rx_slot];
+    }
+
+    wifi_card_read_func1_block_start(0x4000 - full_len, read_buffer, full_len);
+
+    mbox_rx_prefetch_buffer = read_buffer;
+    mbox_rx_prefetch_ring_idx = ring_idx;
+    mbox_rx_prefetch_header = header;
+    mbox_rx_prefetched = true;
+    mbox_rx_prefetch_active = true;
+
+    return true;
+#endif
+}
+
+// Handles a packet that has been read to read_buffer. If the packet includes
+// the lookahead of the next packet the read of the next packet is started
+// before handling this one. If ring_idx isn't -1 the packet has been read
+// straight to the RX queue of the ARM9.
+static u16 wifi_card_mbox0_handle_pkt(u32 header, u8 *read_buffer, int ring_idx)
+{
+    u8 pkt_type = header & 0xFF;
+    u8 ack_present = (header >> 8) & 0xFF;
+    u16 len = header >> 16;
+
+    u8 ack_len = read_buffer[4];
+    if (!ack_present)
+    {
+        // ack_len can be set to 0xFF sometimes when an ack is not present, resulting in erroneous data...!
+        ack_len = 0;
+    }
+    u16 len_pkt = len - ack_len;
+    u16 pkt_cmd = *(u16*)&read_buffer[6];
+    u8* pkt_data = &read_buffer[8];
+    u8* ack_data = &read_buffer[6 + len_pkt];
+
+    // We can avoid costly CMD52s by using the ack block's lookahead
+    mbox_has_lookahead = false;
+    const u8 *credit_report = NULL;
+    u32 credit_report_len = 0;
+    u16 ack_idx = 0;
+    while (ack_idx < ack_len)
+    {
+        u8 type = ack_data[ack_idx++];
+        u8 len_ = ack_data[ack_idx++];
+
+        // if (type == 1 || type == 2)
+        // {
+        //     WLOG_PRINTF("%x %x", type, len_);
+        //     WLOG_FLUSH();
+        // }
+
+        // Credit report item: pairs of endpoint and number of credits
+        if (type == 1 && !credit_report)
+        {
+            credit_report = &ack_data[ack_idx];
+            credit_report_len = len_;
+        }
+
+        // Lookahead item
+        if (type == 2 && len_ == 6 && !mbox_has_lookahead)
+        {
+            if (ack_data[ack_idx] == 0xAA && ack_data[ack_idx+5] == 0x55)
+            {
+                mbox_has_lookahead = true;
+                mbox_lookahead = getle32(&ack_data[ack_idx+1]);
+
+                //hexdump(&ack_data[ack_idx], 6);
+            }
+        }
+        ack_idx += len_;
+    }
 
-    len = len + 8;
+    // Send the WMI commands that were waiting for credits before the next
+    // packet is prefetched, so that the transfers don't have to wait for it.
+    // Data packets waiting in the ARM9 TX queue are sent at the end of the
+    // card IRQ.
+    if (credit_report)
+        wifi_card_credit_report(credit_report, credit_report_len);
+
+    // Data packets are added to the RX queue before prefetching the next
+    // packet, which may need to reserve space in the RX queue.
+    bool is_data = wifi_card_mbox0_is_data_pkt(header);
+    if (is_data)
+        data_handle_pkt(pkt_data - 2, len_pkt, ring_idx);
+
+    // The lookahead means that the next packet is already waiting in the
+    // mailbox. Read it while this one is handled.
+    if (mbox_has_lookahead)
+    {
+        if (wifi_card_mbox0_prefetch_start(mbox_lookahead))
+            mbox_has_lookahead = false;
+    }
 
-    // Round to 0x80, block size
-    // TODO can this size be reduced?
-    len = round_up(len, 0x80);
+    if (pkt_type == MBOXPKT_HTC)
+    {
+        htc_handle_pkt(pkt_cmd, pkt_data, len_pkt - 2, ack_len);
+    }
+    else if (pkt_type == MBOXPKT_WMI)
+    {
+        wmi_handle_pkt(pkt_cmd, pkt_data, len_pkt - 2, ack_len);
+    }
+    else if (!is_data)
+    {
+        WLOG_PRINTF("T: UNK %x %x %x %x %x %x %x %x\n", read_buffer[0], read_buffer[1],
+                    read_buffer[2], read_buffer[3], read_buffer[4], read_buffer[5],
+                    read_buffer[6], read_buffer[7]);
+        WLOG_PRINTF("T: UNK %x %x %x %x %x %x %x %x\n", read_buffer[8 + 0], read_buffer[8 + 1],
+                    read_buffer[8 + 2], read_buffer[8 + 3], read_buffer[8 + 4], read_buffer[8 + 5],
+                    read_buffer[8 + 6], read_buffer[8 + 7]);
+        WLOG_FLUSH();
+    }
 
-    //hexdump(mbox_out_buffer, 20);
+    if (ack_present != MBOXPKT_RETACK)
+    {
+        // WLOG_PRINTF("T: %x %x %x\n", pkt_type, ack_present, len);
+        // WLOG_PRINTF("T: %x %x %x %x %x %x %x %x\n", read_buffer[0], read_buffer[1], read_buffer[2],
+        //             read_buffer[3], read_buffer[4], read_buffer[5], read_buffer[6],
+        //             read_buffer[7]);
+        // WLOG_PRINTF("T: %x %x %x %x %x %x %x %x\n", read_buffer[8 + 0], read_buffer[8 + 1],
+        //             read_buffer[8 + 2], read_buffer[8 + 3], read_buffer[8 + 4],
+        //             read_buffer[8 + 5], read_buffer[8 + 6], read_buffer[8 + 7]);
+        // WLOG_FLUSH();
+    }
 
-    wifi_card_mbox0_sendbytes(mbox_out_buffer, len);
-    leaveCriticalSection(lock);
+    return len;
 }
 
-
-static bool mbox_has_lookahead = false;
-static u32 mbox_lookahead = 0;
-
-static u16 wifi_card_mbox0_readbytes(u8 *read_buffer, u32 sz_buf, u32 len_read)
+static u16 wifi_card_mbox0_readpkt_nested(void)
 {
-#ifdef SDIO_NO_BLOCKRW
-    // Read out all data that we can
-    //int end_cnt = 0;
-    u16 actual_len = 0;
-    while (1) // Read until we see the EOM bit thrice
+    if (mbox_rx_prefetched)
     {
-        while (!(wifi_card_read_func1_u8(F1_HOST_INT_STATUS) & 1)); // We don't have data...
-
-        u8 val = wifi_card_read_func1_u8(0xFF); // (0x1000 - full_len)+actual_len
-
-        if (actual_len < sz_buf)
-            read_buffer[actual_len] = val;
-
-        actual_len++;
-
-        if (actual_len >= read_len)
-            break;
+        // The previous packet had a lookahead and the read of this packet was
+        // started while the previous packet was being handled.
+        wifi_card_mbox0_prefetch_finish();
+        mbox_rx_prefetched = false;
 
-        // We've reached the last few bytes of the packet
-        /*
-        if (wifi_card_read_func1_u8(F1_MBOX_FRAME) & 0x10)
-            end_cnt++;
+        if (mbox_rx_prefetch_failed)
+            return 0;
 
-        if (end_cnt > 3)
-            break;
-        */
+        return wifi_card_mbox0_handle_pkt(mbox_rx_prefetch_header,
+                                          mbox_rx_prefetch_buffer,
+                                          mbox_rx_prefetch_ring_idx);
     }
-#else
-    (void)sz_buf;
-    u16 actual_len = len_read;
-    u16 send_addr = 0x4000 - len_read;
-    wifi_card_read_func1_block(send_addr, read_buffer, len_read);
-#endif
-
-    return actual_len;
-}
 
-u16 wifi_card_mbox0_readpkt(void)
-{
-    //memset(mbox_buffer, 0, MBOX_TMPBUF_SIZE);
+    //memset(mbox_buffer[mbox_rx_slot], 0, MBOX_TMPBUF_SIZE);
 
     // Try and wait for mailbox data to arrive
     int timeout = 100;
@@ -726,10 +1457,6 @@ u16 wifi_card_mbox0_readpkt(void)
         header = wifi_card_read_func1_u32(F1_RX_LOOKAHEAD0); // read lookahead
     }
 
-    u8 *read_buffer = mbox_buffer;
-
-    u8 pkt_type = header & 0xFF;
-    u8 ack_present = (header >> 8) & 0xFF;
     u16 len = header >> 16;
     u16 full_len = round_up(len + 6, 0x80);
 
@@ -751,7 +1478,17 @@ u16 wifi_card_mbox0_readpkt(void)
         return 0;
     }
 
-    u16 actual_len = wifi_card_mbox0_readbytes(read_buffer, MBOX_TMPBUF_SIZE, full_len);
+    u8 *read_buffer = mbox_buffer[mbox_rx_slot];
+    u32 sz_buf = MBOX_TMPBUF_SIZE;
+
+    int ring_idx = wifi_card_mbox0_rx_reserve(header, full_len);
+    if (ring_idx != -1)
+    {
+        read_buffer = Wifi_TWL_RxReservedBuffer(ring_idx);
+        sz_buf = full_len;
+    }
+
+    u16 actual_len = wifi_card_mbox0_readbytes(read_buffer, sz_buf, full_len);
 
     if (!actual_len)
         return 0;
@@ -768,81 +1505,16 @@ u16 wifi_card_mbox0_readpkt(void)
     wifi_ndma_wait();
 #endif
 
-    u8 ack_len = read_buffer[4];
-    if (!ack_present)
-    {
-        // ack_len can be set to 0xFF sometimes when an ack is not present, resulting in erroneous data...!
-        ack_len = 0;
-    }
-    u16 len_pkt = len - ack_len;
-    u16 pkt_cmd = *(u16*)&read_buffer[6];
-    u8* pkt_data = &read_buffer[8];
-    u8* ack_data = &read_buffer[6 + len_pkt];
-
-    if (pkt_type == MBOXPKT_HTC)
-    {
-        htc_handle_pkt(pkt_cmd, pkt_data, len_pkt - 2, ack_len);
-    }
-    else if (pkt_type == MBOXPKT_WMI)
-    {
-        wmi_handle_pkt(pkt_cmd, pkt_data, len_pkt - 2, ack_len);
-    }
-    else if (pkt_type == 2 || pkt_type == 3 || pkt_type == 4 || pkt_type == 5) // one of my routers sends 0x04 for some reason
-    {
-        data_handle_pkt(pkt_data - 2, len_pkt);
-    }
-    else
-    {
-        WLOG_PRINTF("T: UNK %x %x %x %x %x %x %x %x\n", read_buffer[0], read_buffer[1],
-                    read_buffer[2], read_buffer[3], read_buffer[4], read_buffer[5],
-                    read_buffer[6], read_buffer[7]);
-        WLOG_PRINTF("T: UNK %x %x %x %x %x %x %x %x\n", read_buffer[8 + 0], read_buffer[8 + 1],
-                    read_buffer[8 + 2], read_buffer[8 + 3], read_buffer[8 + 4], read_buffer[8 + 5],
-                    read_buffer[8 + 6], read_buffer[8 + 7]);
-        WLOG_FLUSH();
-    }
-
-    // We can avoid costly CMD52s by using the ack block's lookahead
-    mbox_has_lookahead = false;
-    u16 ack_idx = 0;
-    while (ack_idx < ack_len)
-    {
-        u8 type = ack_data[ack_idx++];
-        u8 len_ = ack_data[ack_idx++];
-
-        // if (type == 1 || type == 2)
-        // {
-        //     WLOG_PRINTF("%x %x", type, len_);
-        //     WLOG_FLUSH();
-        // }
-
-        // Lookahead item
-        if (type == 2 && len_ == 6 && !mbox_has_lookahead)
-        {
-            if (ack_data[ack_idx] == 0xAA && ack_data[ack_idx+5] == 0x55)
-            {
-                mbox_has_lookahead = true;
-                mbox_lookahead = getle32(&ack_data[ack_idx+1]);
-
-                //hexdump(&ack_data[ack_idx], 6);
-            }
-        }
-        ack_idx += len_;
-    }
+    return wifi_card_mbox0_handle_pkt(header, read_buffer, ring_idx);
+}
 
-    if (ack_present != MBOXPKT_RETACK)
-    {
-        // WLOG_PRINTF("T: %x %x %x %x\n", pkt_type, ack_present, len, actual_len);
-        // WLOG_PRINTF("T: %x %x %x %x %x %x %x %x\n", read_buffer[0], read_buffer[1], read_buffer[2],
-        //             read_buffer[3], read_buffer[4], read_buffer[5], read_buffer[6],
-        //             read_buffer[7]);
-        // WLOG_PRINTF("T: %x %x %x %x %x %x %x %x\n", read_buffer[8 + 0], read_buffer[8 + 1],
-        //             read_buffer[8 + 2], read_buffer[8 + 3], read_buffer[8 + 4],
-        //             read_buffer[8 + 5], read_buffer[8 + 6], read_buffer[8 + 7]);
-        // WLOG_FLUSH();
-    }
+u16 wifi_card_mbox0_readpkt(void)
+{
+    mbox_rx_depth++;
+    u16 ret = wifi_card_mbox0_readpkt_nested();
+    mbox_rx_depth--;
 
-    return len;
+    return ret;
 }
 
 //
@@ -1051,6 +1723,8 @@ static int wifi_card_init_bmi(void)
 
 void wifi_card_send_command(wifi_sdio_command cmd, u32 args)
 {
+    wifi_card_sdio_drain();
+
     wlan_ctx.tmio.buffer = NULL;
     wifi_sdio_send_command(&wlan_ctx.tmio, cmd, args);
 }
@@ -1089,19 +1763,114 @@ static void wifi_card_process_pkts(void)
     while (wifi_card_mbox0_readpkt());
 }
 
+void wifi_card_request_update(void)
+{
+    wifi_card_update_requested = true;
+}
+
 static void wifi_card_irq(void)
 {
     Wifi_RandomAddEntropy(REG_VCOUNT);
 
     wifi_card_process_pkts();
 
-    //wmi_tick(); // TODO
+    if (wifi_card_update_requested)
+    {
+        // Wifi_TWL_Update() also flushes the TX queue
+        wifi_card_update_requested = false;
+        Wifi_TWL_Update();
+    }
+    else
+    {
+        Wifi_TWL_TxArm9QueueFlush();
+    }
+}
+
+// Timeouts of the steps of the initialization of the card
+#define INIT_SDIO_TIMEOUT_MS        (100)
+#define INIT_RESET_TIMEOUT_MS       (20)
+#define INIT_FW_READY_TIMEOUT_MS    (2000)
+
+// The housekeeping timer isn't running during the initialization of the card,
+// so it's used as a free-running counter to measure time. It overflows every 2
+// seconds, so wifi_card_init_time_ms() needs to be called more often than that.
+#define INIT_TIMER_FREQ (BUS_CLOCK >> 10)
+
+static u16 wifi_card_init_timer_last;
+static u32 wifi_card_init_timer_ticks;
+static u32 wifi_card_init_phase_start_ms;
+
+static u32 wifi_card_init_time_ms(void)
+{
+    u16 now = TIMER_DATA(LIBNDS_DEFAULT_TIMER_WIFI);
+
+    wifi_card_init_timer_ticks += (u16)(now - wifi_card_init_timer_last);
+    wifi_card_init_timer_last = now;
+
+    return ((u64)wifi_card_init_timer_ticks * 1000) / INIT_TIMER_FREQ;
+}
+
+static void wifi_card_init_timer_start(void)
+{
+    timerStart(LIBNDS_DEFAULT_TIMER_WIFI, ClockDivider_1024, 0, NULL);
+
+    wifi_card_init_timer_last = TIMER_DATA(LIBNDS_DEFAULT_TIMER_WIFI);
+    wifi_card_init_timer_ticks = 0;
+    wifi_card_init_phase_start_ms = 0;
+}
+
+// Prints the time spent since the end of the previous phase
+static void wifi_card_init_phase_end(const char *name)
+{
+    u32 now = wifi_card_init_time_ms();
+
+    WLOG_PRINTF("T: %s: %u ms\n", name,
+                (unsigned int)(now - wifi_card_init_phase_start_ms));
+    WLOG_FLUSH();
+
+    wifi_card_init_phase_start_ms = now;
+}
+
+// Waits until the card reports that function 1 is ready. Returns false on
+// timeout.
+static bool wifi_card_wait_func1_ready(void)
+{
+    u32 start = wifi_card_init_time_ms();
+
+    while (wifi_card_init_time_ms() - start < INIT_SDIO_TIMEOUT_MS)
+    {
+        // Register 0x03 (I/O Ready) of the CCCR
+        if (wifi_card_read_func0_u8(0x3) == 0x02)
+            return true;
+    }
+
+    return false;
+}
+
+// Reads register 0x00 (Revision) of the CCCR until it succeeds. Returns false
+// on timeout.
+static bool wifi_card_wait_revision(u32 timeout_ms)
+{
+    wifi_card_ctx *ctx = &wlan_ctx;
+    u32 start = wifi_card_init_time_ms();
+
+    while (1)
+    {
+        wifi_card_read_func0_u8(0x00);
+        if (!(ctx->tmio.status & 4))
+            return true;
+
+        if (wifi_card_init_time_ms() - start >= timeout_ms)
+            return false;
+    }
 }
 
 static int wifi_card_wlan_init_bmi(void)
 {
     wifi_card_ctx *ctx = &wlan_ctx;
 
+    wifi_card_init_timer_start();
+
     ctx->tmio.port = 0;
     ctx->tmio.address = ctx->tmio.port;
 
@@ -1109,9 +1878,14 @@ static int wifi_card_wlan_init_bmi(void)
     ctx->tmio.break_early = false;
     ctx->tmio.block_size = 128;
 
+    // If WiFi is being restarted the card is already powered on and set up.
+    bool warm_start = wifi_card_sdio_ready;
+    wifi_card_sdio_ready = false;
+
     // Select TWL WiFi mode
     gpioSetWifiMode(GPIO_WIFI_MODE_TWL);
-    swiDelay(5 * 134056); // 5 milliseconds. TODO: Is this delay required?
+    if (!warm_start)
+        swiDelay(5 * 134056); // 5 milliseconds. TODO: Is this delay required?
 
     u8 command[2];
     command[0] = WRITE_FOUT_1;
@@ -1126,19 +1900,40 @@ static int wifi_card_wlan_init_bmi(void)
 
     ctx->tmio.bus_width = 4;
     wifi_card_switch_device();
-    ioDelay(0xF000);
 
-    // Read register 0x00 (Revision) as a test
-    wifi_card_read_func0_u8(0x00);
-    if (ctx->tmio.status & 4)
+    // Read register 0x00 (Revision) as a test. After a warm start the card
+    // answers as soon as it's ready, so poll it instead of waiting for a fixed
+    // time. After a cold start a single read is enough to decide whether to
+    // fall back to a 1-bit bus, and retrying it would only slow down the init.
+    bool revision_ok;
+    if (warm_start)
+    {
+        revision_ok = wifi_card_wait_revision(INIT_SDIO_TIMEOUT_MS);
+    }
+    else
+    {
+        ioDelay(0xF000);
+        wifi_card_read_func0_u8(0x00);
+        revision_ok = !(ctx->tmio.status & 4);
+    }
+
+    if (!revision_ok)
     {
         ctx->tmio.bus_width = 1;
         wifi_card_switch_device();
         WLOG_PUTS("T: Can't read revision. Assuming 1bit bus\n");
         WLOG_FLUSH();
+
+        // The card isn't in the state it was left in
+        warm_start = false;
     }
 
-    //if (is_firstboot)
+    if (warm_start)
+    {
+        WLOG_PUTS("T: Warm start, SDIO already set up\n");
+        WLOG_FLUSH();
+    }
+    else
     {
         WLOG_PUTS("T: Resetting SDIO...\n");
         WLOG_FLUSH();
@@ -1220,7 +2015,11 @@ skip_opcond:
         //wifi_card_write_func0_u8(0x6, 0x0);
         wifi_card_write_func0_u8(0x2, 0x0); // adding delay after this one wipes the loaded firmware??
         wifi_card_write_func0_u8(0x2, 0x2);
-        ioDelay(0xF000);
+        if (!wifi_card_wait_func1_ready())
+        {
+            WLOG_PUTS("T: Func1 not ready after reset\n");
+            WLOG_FLUSH();
+        }
 
         // Read register 0x07 (Bus Interface Control) of the CCCR.
         wifi_card_send_command(cmd52, 0x07 << 9);
@@ -1266,12 +2065,11 @@ skip_opcond:
             return -1;
     }
 
-    // Required?
-    ioDelay(0xF000);
-
     //WLOG_PUTS("I: read func0 again\n"); WLOG_FLUSH();
 
     // Read register 0x00 (Revision)
+    if (!wifi_card_wait_revision(INIT_SDIO_TIMEOUT_MS))
+        return -1;
     u8 revision = wifi_card_read_func0_u8(0x00);
     (void)revision;
     if (ctx->tmio.status & 4)
@@ -1285,13 +2083,18 @@ skip_opcond:
     // if (ctx->tmio.status & 4)
     //     return -1;
 
-    while (true)
+    if (!wifi_card_wait_func1_ready())
     {
-        // Read register 0x02 (function enable) hibyte until it's ready
-        if (wifi_card_read_func0_u8(0x3) == 0x02)
-            break;
+        WLOG_PUTS("T: Func1 not ready\n");
+        WLOG_FLUSH();
+        return -1;
     }
 
+    // The SDIO interface won't need to be set up again
+    wifi_card_sdio_ready = true;
+
+    wifi_card_init_phase_end("SDIO setup");
+
     //WLOG_PRINTF("Int status: %x %x",
     //            (unsigned int)wifi_card_read_func1_u32(F1_HOST_INT_STATUS),
     //            (unsigned int)wifi_card_read_func1_u8(F1_RX_LOOKAHEAD_VALID));
@@ -1317,6 +2120,8 @@ skip_opcond:
     if (device_chip_id == CHIP_ID_AR6002)
         device_host_interest_addr = AR6002_HOST_INTEREST_ADDRESS;
 
+    // The firmware is loaded to RAM by the system during boot and it stays
+    // there when the card is reset, so it doesn't need to be uploaded again.
     unsigned int is_uploaded = wifi_card_read_intern_word(device_host_interest_addr + 0x58);
     if (!is_uploaded)
     {
@@ -1326,15 +2131,25 @@ skip_opcond:
 
     // Reset into bootloader
     wifi_card_write_intern_word(0x4000, 0x00000100);
-    ioDelay(0x10000);
 
-    // RESET_CAUSE, expecting 0x02
-    unsigned int reset_cause = wifi_card_read_intern_word(0x40C0);
-    if (reset_cause != 2)
+    // RESET_CAUSE, expecting 0x02. Wait until the bootloader reports it.
+    unsigned int reset_cause;
+    u32 reset_start = wifi_card_init_time_ms();
+    while (1)
     {
-        WLOG_PRINTF("T: Reset cause: 0x%x\n", reset_cause);
+        reset_cause = wifi_card_read_intern_word(0x40C0);
+        if (reset_cause == 2)
+            break;
+
+        if (wifi_card_init_time_ms() - reset_start >= INIT_RESET_TIMEOUT_MS)
+        {
+            WLOG_PRINTF("T: Reset cause: 0x%x\n", reset_cause);
+            break;
+        }
     }
 
+    wifi_card_init_phase_end("Reset");
+
     // FIFOs are weird after reset?
     //wifi_card_bmi_wait_count4();
 
@@ -1345,6 +2160,8 @@ skip_opcond:
 
     if (bmi_ver == 0xFFFFFFFF) // timeout happened
     {
+        // Set up the SDIO interface from scratch next time
+        wifi_card_sdio_ready = false;
         return -1;
     }
 
@@ -1362,6 +2179,8 @@ skip_opcond:
     wifi_card_bmi_write_register(0x004028, 0x5); // WLAN_CLOCK_CONTROL
     wifi_card_bmi_write_register(0x004020, 0x0);
 
+    wifi_card_init_phase_end("BMI setup");
+
 #if 0
     // All the part's addresses
     u32 parta_dst = 0x524C00;
@@ -1415,6 +2234,16 @@ skip_opcond:
     return 0;
 }
 
+static void wifi_card_timer_handler(void)
+{
+    wifi_card_time_ms += SDIO_TICK_INTERVAL_MS;
+
+    wifi_card_credit_tick();
+
+    wifi_card_update_requested = false;
+    Wifi_TWL_Update();
+}
+
 static int wifi_card_wlan_init_bmifinish(void)
 {
     // BMI finish
@@ -1443,34 +2272,47 @@ static int wifi_card_wlan_init_bmifinish(void)
     WLOG_FLUSH();
     wifi_card_bmi_start_firmware();
 
+    u32 launch_start = wifi_card_init_time_ms();
     while (1)
     {
         u32 is_ready = wifi_card_read_intern_word(device_host_interest_addr + 0x58);
         if (is_ready == 1)
             break;
 
-        ioDelay(0x1000);
+        if (wifi_card_init_time_ms() - launch_start >= INIT_FW_READY_TIMEOUT_MS)
+        {
+            WLOG_PUTS("T: FW launch timed out\n");
+            WLOG_FLUSH();
+            wifi_card_sdio_ready = false;
+            return -1;
+        }
     }
 
+    wifi_card_init_phase_end("FW launch");
+
     device_eeprom_addr = wifi_card_read_intern_word(device_host_interest_addr + 0x54);
     device_eeprom_version = wifi_card_read_intern_word(device_eeprom_addr + 0x10); // version, 609C0202
 
     WLOG_PRINTF("T: FW %x ready.\nT: Handshaking...\n", (unsigned int)device_eeprom_version);
     WLOG_FLUSH();
 
+    wifi_card_wmi_reset();
+
     wifi_card_bInitted = true;
 
     // Enable IRQs
     irqSetAUX(IRQ_WIFI_SDIO_CARDIRQ, wifi_card_irq);
     irqEnableAUX(IRQ_WIFI_SDIO_CARDIRQ);
+    irqSet(WIFI_NDMA_IRQ, wifi_card_ndma_irq);
+    irqEnable(WIFI_NDMA_IRQ);
     wifi_sdio_enable_cardirq(true); // MelonDS seems to have trouble with IRQs? Comment out for MelonDS.
 
     wifi_card_write_func1_u32(F1_INT_STATUS_ENABLE, 0x010300D1); // INT_STATUS_ENABLE (or 0x1?)
     wifi_card_write_func0_u8(0x4, 0x3); // CCCR irq_enable, master+func1
 
-    // 100ms timer
+    // Low rate housekeeping timer
     timerStart(LIBNDS_DEFAULT_TIMER_WIFI, ClockDivider_1024,
-               TIMER_FREQ_1024(1000 / SDIO_TICK_INTERVAL_MS), Wifi_TWL_Update);
+               TIMER_FREQ_1024(1000 / SDIO_TICK_INTERVAL_MS), wifi_card_timer_handler);
 
     WLOG_PUTS("T: Waiting for WMI...\n");
     WLOG_FLUSH();
@@ -1491,9 +2333,18 @@ static int wifi_card_wlan_init(void)
 
 void wifi_card_deinit(void)
 {
+    wifi_card_sdio_drain();
+
+    // Discard any packet that has been prefetched
+    mbox_rx_prefetched = false;
+    mbox_has_lookahead = false;
+
+    wifi_card_wmi_reset();
+
     wifi_sdio_enable_cardirq(false);
 
     irqDisableAUX(IRQ_WIFI_SDIO_CARDIRQ);
+    irqDisable(WIFI_NDMA_IRQ);
     timerStop(LIBNDS_DEFAULT_TIMER_WIFI);
 
     if (wifi_card_bInitted)
@@ -1513,6 +2364,11 @@ bool wifi_card_initted(void)
     return wifi_card_bInitted && wmi_is_ready();
 }
 
+u32 wifi_card_get_time_ms(void)
+{
+    return wifi_card_time_ms;
+}
+
 u32 wifi_card_host_interest_addr(void)
 {
     return device_host_interest_addr;
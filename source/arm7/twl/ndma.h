@@ -9,8 +9,13 @@
 
 #define WIFI_NDMA_CHAN (3)
 
+// The IRQs of the NDMA channels are bits 28 to 31 of IE/IF
+#define WIFI_NDMA_IRQ BIT(28 + WIFI_NDMA_CHAN)
+
 void wifi_ndma_init(void);
 bool wifi_ndma_wait(void);
+// Request an IRQ at the end of the transfers started after calling this
+void wifi_ndma_set_irq(bool enable);
 void wifi_ndma_read(void *dst, u32 len);
 void wifi_ndma_write(const void *src, u32 len);
 
@@ -6,10 +6,16 @@
 #include "arm7/twl/ndma.h"
 #include "arm7/twl/sdio.h"
 
+#define WIFI_NDMA_CR_IRQ_ENABLE BIT(30)
+
+static u32 wifi_ndma_irq_flag = 0;
+
 void wifi_ndma_init(void)
 {
     REG_NDMA_CR(WIFI_NDMA_CHAN) = 0;
 
+    wifi_ndma_irq_flag = 0;
+
     REG_NDMA_GCR = NDMA_GCR_FIXED_METHOD;
 }
 
@@ -24,6 +30,11 @@ bool wifi_ndma_wait(void)
     return false;
 }
 
+void wifi_ndma_set_irq(bool enable)
+{
+    wifi_ndma_irq_flag = enable ? WIFI_NDMA_CR_IRQ_ENABLE : 0;
+}
+
 void wifi_ndma_read(void *dst, u32 len)
 {
     REG_NDMA_SRC(WIFI_NDMA_CHAN) = (u32)(REG_SDIO_BASE + WIFI_SDIO_OFFS_DATA32_FIFO);
@@ -39,7 +50,8 @@ void wifi_ndma_read(void *dst, u32 len)
                                 | NDMA_BLOCK_SCALER(0x80 / 4)
                                 | NDMA_START_TWL_WIFI
                                 | NDMA_SRC_FIX
-                                | NDMA_DST_INC;
+                                | NDMA_DST_INC
+                                | wifi_ndma_irq_flag;
 }
 
 void wifi_ndma_write(const void *src, u32 len)
@@ -59,5 +71,6 @@ void wifi_ndma_write(const void *src, u32 len)
                                 | NDMA_BLOCK_SCALER(0x80 / 4)
                                 | NDMA_START_TWL_WIFI
                                 | NDMA_SRC_INC
-                                | NDMA_DST_FIX;
+                                | NDMA_DST_FIX
+                                | wifi_ndma_irq_flag;
 }
@@ -9,4 +9,16 @@
 
 int Wifi_TWL_RxAddPacketToQueue(const void *src, size_t size);
 
+// Reserves space for a packet of up to "max_size" bytes (including the MBOX
+// header) that will be written to the RX buffer by DMA. It returns the index
+// of the packet in the RX buffer, or -1 if there isn't enough space. The data
+// has to be written at Wifi_TWL_RxReservedBuffer(). Only one packet can be
+// reserved at a time, and no other packet can be added until it's committed.
+int Wifi_TWL_RxReservePacket(size_t max_size);
+void *Wifi_TWL_RxReservedBuffer(int idx);
+
+// Makes a reserved packet visible to the ARM9. "size" doesn't include the MBOX
+// header. Reserved packets that aren't committed are simply dropped.
+void Wifi_TWL_RxCommitPacket(int idx, size_t size);
+
 #endif // DSWIFI_ARM7_TWL_RX_QUEUE_H__
@@ -62,3 +62,62 @@ int Wifi_TWL_RxAddPacketToQueue(const void *src, size_t size)
 
     return 0;
 }
+
+int Wifi_TWL_RxReservePacket(size_t max_size)
+{
+    // Size tag, packet and the size tag of the next packet
+    size_t total_size = sizeof(u32) + round_up_32(max_size) + sizeof(u32);
+
+    int oldIME = enterCriticalSection();
+
+    int alloc_idx = Wifi_RxBufferAllocBuffer(total_size);
+    if (alloc_idx == -1)
+    {
+        leaveCriticalSection(oldIME);
+        return -1;
+    }
+
+    // The size tag at this index is 0, so the ARM9 will stop reading here until
+    // the packet is committed. If it isn't committed, the next packet will be
+    // written at the same index.
+    WifiData->rxbufWrite = alloc_idx;
+
+    leaveCriticalSection(oldIME);
+
+    return alloc_idx;
+}
+
+void *Wifi_TWL_RxReservedBuffer(int idx)
+{
+    u8 *rxbufData = (u8 *)WifiData->rxbufData;
+
+    return rxbufData + idx + sizeof(u32);
+}
+
+void Wifi_TWL_RxCommitPacket(int idx, size_t size)
+{
+    u8 *rxbufData = (u8 *)WifiData->rxbufData;
+
+    int oldIME = enterCriticalSection();
+
+    u32 write_idx = idx + sizeof(u32) + WIFI_RXBUF_MBOX_HDR_SIZE + size;
+
+    // Mark the next block as empty, but don't move pointer so that the size of
+    // the next block is written here eventually.
+    write_idx = round_up_32(write_idx);
+    write_u32(rxbufData + write_idx, 0);
+
+    assert(write_idx <= (WIFI_RXBUFFER_SIZE - sizeof(u32)));
+
+    WifiData->rxbufWrite = write_idx;
+
+    // Now that the packet is finished, write real size of data
+    write_u32(rxbufData + idx, size | WIFI_RXBUF_FLAG_MBOX_HDR);
+
+    leaveCriticalSection(oldIME);
+
+    WifiData->stats[WSTAT_RXQUEUEDPACKETS]++;
+    WifiData->stats[WSTAT_RXQUEUEDBYTES] += size;
+
+    Wifi_CallSyncHandler();
+}
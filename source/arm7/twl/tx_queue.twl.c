@@ -16,6 +16,10 @@ void Wifi_TWL_TxArm9QueueFlush(void)
 
     assert((read_idx & 3) == 0);
 
+    // Send all pending packets in one go, checking the mailbox status only once
+    // at the end.
+    wifi_card_mbox0_batch_begin();
+
     while (1)
     {
         // Read packet size
@@ -34,8 +38,13 @@ void Wifi_TWL_TxArm9QueueFlush(void)
         }
         read_idx += sizeof(uint32_t);
 
-        // Read packet data
-        data_send_pkt_idk(txbufData + read_idx, size);
+        // Read packet data. If the target doesn't have space for it, leave it
+        // in the queue until it returns some HTC credits.
+        if (!data_send_pkt_idk(txbufData + read_idx, size))
+        {
+            WifiData->stats[WSTAT_TXCREDITSTALLS]++;
+            break;
+        }
         read_idx += round_up_32(size);
 
         assert(read_idx <= (WIFI_TXBUFFER_SIZE - sizeof(u32)));
@@ -47,5 +56,7 @@ void Wifi_TWL_TxArm9QueueFlush(void)
         WifiData->stats[WSTAT_TXDATABYTES] += size;
     }
 
+    wifi_card_mbox0_batch_end();
+
     leaveCriticalSection(oldIME);
 }
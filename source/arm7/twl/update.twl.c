@@ -11,6 +11,7 @@
 #include "arm7/access_point.h"
 #include "arm7/debug.h"
 #include "arm7/ipc.h"
+#include "arm7/reconnect.h"
 #include "arm7/wfc.h"
 #include "arm7/twl/card.h"
 #include "arm7/twl/setup.h"
@@ -100,7 +101,31 @@ void Wifi_TWL_Update(void)
         }
         case WIFIMODE_SCAN:
         {
-            if (WifiData->reqMode != WIFIMODE_SCAN)
+            if (Wifi_ReconnectIsScanning())
+            {
+                // Scan started by the automatic reconnection. The ARM9 still
+                // wants to be connected, so reqMode is WIFIMODE_CONNECTED.
+                if (WifiData->reqMode != WIFIMODE_CONNECTED)
+                {
+                    Wifi_ReconnectReset();
+                    WifiData->curMode = WIFIMODE_NORMAL;
+                    break;
+                }
+
+                int result = Wifi_ReconnectScanResult();
+                if (result == 1)
+                {
+                    // Connect to the AP that has been found
+                    WifiData->curMode = WIFIMODE_NORMAL;
+                    break;
+                }
+                else if (result == 0)
+                {
+                    WifiData->curMode = WIFIMODE_CANNOTCONNECT;
+                    break;
+                }
+            }
+            else if (WifiData->reqMode != WIFIMODE_SCAN)
             {
                 WifiData->curMode = WIFIMODE_NORMAL;
                 break;
@@ -144,8 +169,8 @@ void Wifi_TWL_Update(void)
             if (WifiData->reqMode == WIFIMODE_CONNECTED)
             {
                 // If the ARM9 has asked us to stay connected, but we're
-                // disconnected, that's an error.
-                // TODO: Retry to connect?
+                // disconnected, that's an error. If automatic reconnection is
+                // enabled, the error mode will try to connect again.
                 if (!wmi_is_ap_connected())
                 {
                     wmi_disconnect_cmd();
@@ -189,6 +214,21 @@ void Wifi_TWL_Update(void)
                 WLOG_FLUSH();
                 break;
             }
+
+            Wifi_ReconnectAction action = Wifi_ReconnectUpdate(wifi_card_get_time_ms());
+            if (action == WIFI_RECONNECT_RETRY)
+            {
+                // The normal mode will connect to curAp again because reqMode
+                // is still WIFIMODE_CONNECTED.
+                WifiData->curMode = WIFIMODE_NORMAL;
+            }
+            else if (action == WIFI_RECONNECT_RESCAN)
+            {
+                Wifi_AccessPointClearAll();
+
+                wmi_scan_mode_start();
+                WifiData->curMode = WIFIMODE_SCAN;
+            }
             break;
         }
         case WIFIMODE_ACCESSPOINT:
@@ -196,6 +236,8 @@ void Wifi_TWL_Update(void)
             break;
     }
 
+    Wifi_ReconnectUpdateState();
+
     // TODO: Check if there are RX packets left to send to the ARM9?
 
     // Check if we need to transfer anything
@@ -5,7 +5,9 @@
 #include <nds.h>
 #include <dswifi_common.h>
 
+#include "arm7/access_point.h"
 #include "arm7/debug.h"
+#include "arm7/event.h"
 #include "arm7/ipc.h"
 #include "arm7/ntr/update.h"
 #include "arm7/twl/update.h"
@@ -15,8 +17,14 @@ void Wifi_Update(void)
     if (WifiData == NULL)
         return;
 
+    Wifi_AccessPointTableUpdate();
+
     if (WifiData->reqFlags & WFLAG_REQ_DSI_MODE)
         Wifi_TWL_Update();
     else
         Wifi_NTR_Update();
+
+    Wifi_AccessPointSendEvents();
+    Wifi_EventUpdateState();
+    Wifi_EventFlush();
 }
@@ -7,6 +7,7 @@
 
 #include <nds.h>
 
+#include "arm7/access_point.h"
 #include "arm7/debug.h"
 #include "arm7/ipc.h"
 #include "arm7/wfc.h"
@@ -120,6 +121,8 @@ void Wifi_NTR_GetWfcSettings(void)
     }
 
     WifiData->wfc_number_of_configs = c;
+
+    Wifi_AccessPointWfcReloaded();
 }
 
 TWL_CODE void Wifi_TWL_GetWfcSettings(bool allow_wpa)
@@ -228,6 +231,8 @@ TWL_CODE void Wifi_TWL_GetWfcSettings(bool allow_wpa)
     }
 
     WifiData->wfc_number_of_configs = c;
+
+    Wifi_AccessPointWfcReloaded();
 }
 
 int Wifi_GetWfcAccessPointIndex(const void *ssid, size_t ssid_len)
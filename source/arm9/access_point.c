@@ -4,10 +4,12 @@
 // Copyright (C) 2025 Antonio Niño Díaz
 
 #include <netinet/in.h>
+#include <time.h>
 
 #include <nds.h>
 #include <dswifi9.h>
 
+#include "arm9/access_point.h"
 #include "arm9/ipc.h"
 #include "arm9/lwip/lwip_nds.h"
 #include "arm9/wifi_arm9.h"
@@ -21,12 +23,25 @@ typedef enum {
     WIFI_CONNECT_DHCPING        = 2,
     WIFI_CONNECT_DONE           = 3,
     WIFI_CONNECT_SEARCHING_WFC  = 4,
+    WIFI_CONNECT_FAST_WAIT      = 5, // Waiting for the ARM7 to be idle
+    WIFI_CONNECT_FAST           = 6, // Connecting to the last AP without a scan
 } WIFI_CONNECT_STATE;
 
 static WIFI_CONNECT_STATE wifi_connect_state = WIFI_CONNECT_SEARCHING;
 
 static Wifi_AccessPoint wifi_connect_point;
 
+// True if the current connection attempt uses the WFC settings
+static bool wifi_connect_from_wfc;
+
+// Last successful connection. The CRC is only calculated when it's returned to
+// the user.
+static Wifi_LastConnection wifi_last_connection;
+static bool wifi_last_connection_valid;
+
+// Connection used by the fast path of Wifi_ConnectLastAP()
+static Wifi_LastConnection wifi_fast_connection;
+
 const char *ASSOCSTATUS_STRINGS[] = {
     [ASSOCSTATUS_DISCONNECTED]   = "Disconnected",
     [ASSOCSTATUS_SEARCHING]      = "Searching",
@@ -37,52 +52,69 @@ const char *ASSOCSTATUS_STRINGS[] = {
     [ASSOCSTATUS_CANNOTCONNECT]  = "Can't connect",
 };
 
+// Buffer used to search the list of APs without holding the ARM7 back
+static Wifi_AccessPoint wifi_ap_snapshot[WIFI_MAX_AP];
+
 int Wifi_GetNumAP(void)
 {
-    int c = 0;
-    for (int i = 0; i < WIFI_MAX_AP; i++)
-    {
-        if (WifiData->aplist[i].flags & WFLAG_APDATA_ACTIVE)
-            c++;
-    }
-    return c;
+    return __builtin_popcount(WifiData->aplist_active_mask);
 }
 
-int Wifi_GetAPData(int apnum, Wifi_AccessPoint *apdata)
+int Wifi_GetAPList(Wifi_AccessPoint *list, int max_aps)
 {
-    if ((apnum < 0) || (apdata == NULL))
+    if ((list == NULL) || (max_aps < 0))
         return WIFI_RETURN_PARAMERROR;
 
-    int found_index = -1;
-
-    int count = 0;
-    for (int i = 0; i < WIFI_MAX_AP; i++)
+    while (1)
     {
-        if ((WifiData->aplist[i].flags & WFLAG_APDATA_ACTIVE) == 0)
+        u32 generation = WifiData->aplist_generation;
+
+        // The ARM7 is modifying the list right now
+        if (generation & 1)
             continue;
 
-        if (count == apnum)
+        u32 mask = WifiData->aplist_active_mask;
+
+        int count = 0;
+        while ((mask != 0) && (count < max_aps))
         {
-            found_index = i;
-            break;
+            int i = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            list[count++] = WifiData->aplist[i]; // Struct copy
         }
 
-        count++;
+        // If the list hasn't changed while it was being copied, the copy is
+        // consistent.
+        if (WifiData->aplist_generation == generation)
+            return count;
     }
+}
+
+int Wifi_GetAPData(int apnum, Wifi_AccessPoint *apdata)
+{
+    if ((apnum < 0) || (apdata == NULL))
+        return WIFI_RETURN_PARAMERROR;
 
-    if (found_index != -1)
+    while (1)
     {
-        if (WifiData->aplist[found_index].flags & WFLAG_APDATA_ACTIVE)
-        {
-            while (Spinlock_Acquire(WifiData->aplist[found_index]) != SPINLOCK_OK)
-                ;
+        u32 generation = WifiData->aplist_generation;
 
-            *apdata = WifiData->aplist[found_index]; // Struct copy
+        if (generation & 1)
+            continue;
 
-            Spinlock_Release(WifiData->aplist[found_index]);
+        // Skip the first "apnum" active entries
+        u32 mask = WifiData->aplist_active_mask;
+        for (int i = 0; (i < apnum) && (mask != 0); i++)
+            mask &= mask - 1;
 
+        if (mask == 0)
+            break;
+
+        *apdata = WifiData->aplist[__builtin_ctz(mask)]; // Struct copy
+
+        if (WifiData->aplist_generation == generation)
             return WIFI_RETURN_OK;
-        }
     }
 
     memset(apdata, 0, sizeof(Wifi_AccessPoint));
@@ -90,17 +122,127 @@ int Wifi_GetAPData(int apnum, Wifi_AccessPoint *apdata)
     return WIFI_RETURN_ERROR;
 }
 
+// Number of frames to wait for the ARM7 to start using a new AP table
+#define WIFI_APTABLE_SYNC_FRAMES    60
+
+// Waits until the ARM7 is using the specified table. It returns false if the
+// ARM7 doesn't do it in WIFI_APTABLE_SYNC_FRAMES frames.
+static bool Wifi_APTableWaitSync(const Wifi_AccessPointCompact *table)
+{
+    for (int i = 0; i < WIFI_APTABLE_SYNC_FRAMES; i++)
+    {
+        if (WifiData->aptable.curEntries == table)
+            return true;
+
+        cothread_yield_irq(IRQ_VBLANK);
+    }
+
+    return WifiData->aptable.curEntries == table;
+}
+
+int Wifi_SetAPTable(Wifi_AccessPointCompact *table, int num_entries)
+{
+    if (table != NULL)
+    {
+        if ((num_entries <= 0) || (num_entries >= WIFI_APTABLE_NONE))
+            return -1;
+
+        if (((uintptr_t)table & 31) != 0)
+            return -1;
+    }
+
+    // The ARM7 can't switch tables if it isn't running
+    if ((WifiData->flags7 & WFLAG_ARM7_ACTIVE) == 0)
+        return -1;
+
+    // Stop using the previous table before changing the number of entries
+    WifiData->aptable.reqEntries = NULL;
+    Wifi_CallSyncHandler();
+
+    if (!Wifi_APTableWaitSync(NULL))
+        return -1;
+
+    if (table == NULL)
+        return 0;
+
+    // Make sure that there is nothing in the cache of the ARM9 that can be
+    // written back over the table.
+    DC_FlushRange(table, num_entries * sizeof(Wifi_AccessPointCompact));
+
+    WifiData->aptable.reqNumEntries = num_entries;
+    WifiData->aptable.reqEntries = table;
+    Wifi_CallSyncHandler();
+
+    if (!Wifi_APTableWaitSync(table))
+    {
+        // Don't let the ARM7 start using the table after returning an error
+        WifiData->aptable.reqEntries = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static Wifi_AccessPointCompact *wifi_aptable_query_results;
+static int wifi_aptable_query_max;
+
+int Wifi_QueryAPTable(u32 filter, Wifi_AccessPointCompact *results, int max_results)
+{
+    if ((results == NULL) || (max_results <= 0))
+        return -1;
+
+    if (max_results > UINT16_MAX)
+        max_results = UINT16_MAX;
+
+    if (((uintptr_t)results & 31) != 0)
+        return -1;
+
+    // Only one request can be active at a time
+    if (WifiData->aptable.reqQueryId != WifiData->aptable.curQueryId)
+        return -1;
+
+    DC_FlushRange(results, max_results * sizeof(Wifi_AccessPointCompact));
+
+    wifi_aptable_query_results = results;
+    wifi_aptable_query_max = max_results;
+
+    WifiData->aptable.queryResults = results;
+    WifiData->aptable.queryMaxResults = max_results;
+    WifiData->aptable.queryFilter = filter;
+    WifiData->aptable.reqQueryId++;
+
+    Wifi_CallSyncHandler();
+
+    return 0;
+}
+
+int Wifi_QueryAPTableResult(void)
+{
+    if (WifiData->aptable.reqQueryId != WifiData->aptable.curQueryId)
+        return -1;
+
+    // The ARM7 has written the results to main RAM, discard any stale copy in
+    // the cache of the ARM9.
+    if (wifi_aptable_query_results != NULL)
+    {
+        DC_InvalidateRange(wifi_aptable_query_results,
+                           wifi_aptable_query_max * sizeof(Wifi_AccessPointCompact));
+        wifi_aptable_query_results = NULL;
+    }
+
+    return WifiData->aptable.queryNumResults;
+}
+
 int Wifi_FindMatchingAP(int numaps, Wifi_AccessPoint *apdata, Wifi_AccessPoint *match_dest)
 {
     if (apdata == NULL)
         return -1;
 
-    int num_ap = Wifi_GetNumAP();
+    int num_ap = Wifi_GetAPList(wifi_ap_snapshot, WIFI_MAX_AP);
 
     for (int i = 0; i < num_ap; i++)
     {
-        Wifi_AccessPoint ap = { 0 };
-        Wifi_GetAPData(i, &ap);
+        const Wifi_AccessPoint *ap = &wifi_ap_snapshot[i];
 
         for (int j = 0; j < numaps; j++)
         {
@@ -113,7 +255,7 @@ int Wifi_FindMatchingAP(int numaps, Wifi_AccessPoint *apdata, Wifi_AccessPoint *
             {
                 // If there is a specified MAC address it must match the one
                 // that we have seen in beacon frames.
-                if (!Wifi_CmpMacAddr(apdata[j].bssid, ap.bssid))
+                if (!Wifi_CmpMacAddr(apdata[j].bssid, ap->bssid))
                     continue;
             }
             else
@@ -125,16 +267,16 @@ int Wifi_FindMatchingAP(int numaps, Wifi_AccessPoint *apdata, Wifi_AccessPoint *
                 if (apdata[j].ssid_len > 32)
                     continue;
 
-                if (apdata[j].ssid_len != ap.ssid_len)
+                if (apdata[j].ssid_len != ap->ssid_len)
                     continue;
 
-                if (memcmp(apdata[j].ssid, ap.ssid, ap.ssid_len) != 0)
+                if (memcmp(apdata[j].ssid, ap->ssid, ap->ssid_len) != 0)
                     continue;
             }
 
             // If there's a match, this is the right AP, ignore the rest.
             if (match_dest)
-                *match_dest = ap;
+                *match_dest = *ap;
 
             return j;
         }
@@ -147,29 +289,28 @@ int Wifi_FindMatchingAP(int numaps, Wifi_AccessPoint *apdata, Wifi_AccessPoint *
 // return value. It returns -1 on error.
 static int Wifi_FindMatchingAPFromWFC(Wifi_AccessPoint *match_dest)
 {
-    int num_ap = Wifi_GetNumAP();
+    int num_ap = Wifi_GetAPList(wifi_ap_snapshot, WIFI_MAX_AP);
 
     for (int i = 0; i < num_ap; i++)
     {
-        Wifi_AccessPoint ap = { 0 };
-        Wifi_GetAPData(i, &ap);
+        const Wifi_AccessPoint *ap = &wifi_ap_snapshot[i];
 
-        if (ap.ssid_len == 0)
+        if (ap->ssid_len == 0)
             continue;
 
         for (int j = 0; j < WifiData->wfc_number_of_configs; j++)
         {
-            if (ap.ssid_len != WifiData->wfc[j].ssid_len)
+            if (ap->ssid_len != WifiData->wfc[j].ssid_len)
                 continue;
 
-            if (memcmp(ap.ssid, (const char *)WifiData->wfc[j].ssid,
+            if (memcmp(ap->ssid, (const char *)WifiData->wfc[j].ssid,
                        WifiData->wfc[j].ssid_len) != 0)
                 continue;
 
             // If there's a match, this is the right AP, ignore the rest.
             if (match_dest)
             {
-                *match_dest = ap;
+                *match_dest = *ap;
                 return j;
             }
         }
@@ -198,6 +339,8 @@ int Wifi_ConnectSecureAP(Wifi_AccessPoint *apdata, const void *key, size_t key_l
 
     wifi_connect_state = WIFI_CONNECT_SEARCHING;
 
+    wifi_connect_from_wfc = false;
+
     // Save password and tell the ARM7 to ignore WFC settings
     memset((void *)&(WifiData->curApSecurity), 0, sizeof(WifiData->curApSecurity));
     WifiData->reqFlags &= ~WFLAG_REQ_LOAD_WFC_KEY;
@@ -229,6 +372,8 @@ int Wifi_ConnectWfcAP(Wifi_AccessPoint *apdata)
 
     wifi_connect_state = WIFI_CONNECT_SEARCHING;
 
+    wifi_connect_from_wfc = true;
+
     // Clear security settings and ask the ARM7 to fill them
     memset((void *)&(WifiData->curApSecurity), 0, sizeof(WifiData->curApSecurity));
     WifiData->reqFlags |= WFLAG_REQ_LOAD_WFC_KEY;
@@ -260,8 +405,12 @@ int Wifi_ConnectOpenAP(Wifi_AccessPoint *apdata)
     return Wifi_ConnectSecureAP(apdata, NULL, 0);
 }
 
+static void Wifi_RoamStop(void);
+
 int Wifi_DisconnectAP(void)
 {
+    Wifi_RoamStop();
+
     WifiData->reqMode = WIFIMODE_NORMAL;
     wifi_connect_state = WIFI_CONNECT_ERROR;
     return 0;
@@ -275,12 +424,147 @@ void Wifi_AutoConnect(void)
     if (WifiData->wfc_number_of_configs == 0)
     {
         wifi_connect_state = WIFI_CONNECT_ERROR;
+        return;
+    }
+
+    if (wifi_last_connection_valid && wifi_last_connection.from_wfc)
+    {
+        // Try the last AP we have connected to before scanning all channels
+        Wifi_LastConnection rec;
+        Wifi_GetLastConnection(&rec);
+        if (Wifi_ConnectLastAP(&rec) == 0)
+            return;
+    }
+
+    wifi_connect_from_wfc = true;
+    wifi_connect_state = WIFI_CONNECT_SEARCHING_WFC;
+    Wifi_ScanMode();
+}
+
+static u16 Wifi_LastConnectionCRC(const Wifi_LastConnection *rec)
+{
+    const u8 *start = (const u8 *)&rec->ap;
+    const u8 *end = (const u8 *)rec + sizeof(Wifi_LastConnection);
+
+    return swiCRC16(0xFFFF, (void *)start, end - start);
+}
+
+// Called when the connection process has finished successfully.
+static void Wifi_SaveLastConnection(void)
+{
+    Wifi_LastConnection *rec = &wifi_last_connection;
+
+    memset(rec, 0, sizeof(Wifi_LastConnection));
+
+    rec->ap = WifiData->curAp; // Struct copy
+    rec->ap.rssi = 0;
+    rec->ap.timectr = 0;
+    rec->ap.spinlock = 0;
+
+    // The ARM7 has loaded the password from the WFC settings if needed, and it
+    // has calculated the PMK if the AP uses WPA.
+    rec->key_len = WifiData->curApSecurity.pass_len;
+    memcpy(rec->key, (const void *)WifiData->curApSecurity.pass, sizeof(rec->key));
+    memcpy(rec->pmk, (const void *)WifiData->curApSecurity.pmk, sizeof(rec->pmk));
+
+    rec->from_wfc = wifi_connect_from_wfc ? 1 : 0;
+    rec->dhcp = 1;
+
+#ifdef DSWIFI_ENABLE_LWIP
+    if (wifi_lwip_enabled)
+    {
+        struct in_addr gateway, snmask, dns1, dns2;
+        struct in_addr ip = Wifi_GetIPInfo(&gateway, &snmask, &dns1, &dns2);
+
+        rec->dhcp = wifi_using_dhcp() ? 1 : 0;
+        rec->ip = ip.s_addr;
+        rec->gateway = gateway.s_addr;
+        rec->subnet_mask = snmask.s_addr;
+        rec->dns_primary = dns1.s_addr;
+        rec->dns_secondary = dns2.s_addr;
     }
+#endif
+
+    wifi_last_connection_valid = true;
+}
+
+int Wifi_GetLastConnection(Wifi_LastConnection *rec)
+{
+    if (rec == NULL)
+        return -1;
+
+    if (!wifi_last_connection_valid)
+        return -1;
+
+    *rec = wifi_last_connection; // Struct copy
+
+    rec->magic = WIFI_LAST_CONNECTION_MAGIC;
+    rec->version = WIFI_LAST_CONNECTION_VERSION;
+    rec->crc16 = Wifi_LastConnectionCRC(rec);
+
+    return 0;
+}
+
+int Wifi_ConnectLastAP(const Wifi_LastConnection *rec)
+{
+    if (rec == NULL)
+        return -1;
+
+    if ((rec->magic != WIFI_LAST_CONNECTION_MAGIC) ||
+        (rec->version != WIFI_LAST_CONNECTION_VERSION))
+        return -1;
+
+    if (rec->crc16 != Wifi_LastConnectionCRC(rec))
+        return -1;
+
+    if ((rec->ap.ssid_len > 32) || (rec->key_len > sizeof(rec->key)))
+        return -1;
+
+    // Channel 14 can only be used in DSi mode
+    int max_channel = (WifiData->reqFlags & WFLAG_REQ_DSI_MODE) ? 14 : 13;
+    if ((rec->ap.channel < 1) || (rec->ap.channel > max_channel))
+        return -1;
+
+    // The record is valid, so the previous connection is replaced from here
+    Wifi_DisconnectAP();
+
+    wifi_fast_connection = *rec; // Struct copy
+    wifi_connect_from_wfc = rec->from_wfc;
+
+    // In case the fast path fails, look for an AP with the same SSID, not
+    // necessarily the same BSSID.
+    memset(&wifi_connect_point, 0, sizeof(wifi_connect_point));
+    memcpy(wifi_connect_point.ssid, rec->ap.ssid, sizeof(wifi_connect_point.ssid));
+    wifi_connect_point.ssid_len = rec->ap.ssid_len;
+
+#ifdef DSWIFI_ENABLE_LWIP
+    if (rec->dhcp)
+        Wifi_SetIP(0, 0, 0, 0, 0);
     else
+        Wifi_SetIP(rec->ip, rec->gateway, rec->subnet_mask, rec->dns_primary,
+                   rec->dns_secondary);
+#endif
+
+    // The ARM7 needs to go back to idle mode before it can connect to an AP
+    wifi_connect_state = WIFI_CONNECT_FAST_WAIT;
+
+    return 0;
+}
+
+// Called if the ARM7 can't connect to the AP of the fast path
+static void Wifi_ConnectLastAPFallback(void)
+{
+    if (wifi_connect_from_wfc)
     {
         wifi_connect_state = WIFI_CONNECT_SEARCHING_WFC;
-        Wifi_ScanMode();
     }
+    else
+    {
+        // The security settings are still valid because the SSID is the same
+        wifi_connect_state = WIFI_CONNECT_SEARCHING;
+    }
+
+    Wifi_ScanMode();
 }
 
 int Wifi_AssocStatus(void)
@@ -309,6 +593,45 @@ int Wifi_AssocStatus(void)
             }
             return ASSOCSTATUS_SEARCHING;
         }
+        case WIFI_CONNECT_FAST_WAIT:
+        {
+            if ((WifiData->curMode != WIFIMODE_NORMAL) || !Wifi_LibraryModeReady())
+                return ASSOCSTATUS_SEARCHING;
+
+            const Wifi_LastConnection *rec = &wifi_fast_connection;
+
+            // Use the saved password and PMK, don't load them from the WFC
+            // settings. The ARM7 skips calculating the PMK if it's present.
+            memset((void *)&(WifiData->curApSecurity), 0, sizeof(WifiData->curApSecurity));
+            WifiData->reqFlags &= ~WFLAG_REQ_LOAD_WFC_KEY;
+
+            WifiData->curApSecurity.pass_len = rec->key_len;
+            memcpy((void *)WifiData->curApSecurity.pass, rec->key, rec->key_len);
+            memcpy((void *)WifiData->curApSecurity.pmk, rec->pmk, sizeof(rec->pmk));
+
+            WifiData->curAp = rec->ap; // Struct copy
+
+            // The ARM7 switches to the channel of the AP and starts the
+            // association right away.
+            WifiData->reqMode = WIFIMODE_CONNECTED;
+            wifi_connect_state = WIFI_CONNECT_FAST;
+            return ASSOCSTATUS_ASSOCIATING;
+        }
+        case WIFI_CONNECT_FAST:
+        {
+            switch (WifiData->curMode)
+            {
+                case WIFIMODE_CANNOTCONNECT:
+                    Wifi_ConnectLastAPFallback();
+                    return ASSOCSTATUS_SEARCHING;
+                case WIFIMODE_CONNECTED:
+                    // Continue like a regular connection (DHCP, etc)
+                    wifi_connect_state = WIFI_CONNECT_ASSOCIATING;
+                    return Wifi_AssocStatus();
+                default:
+                    return ASSOCSTATUS_ASSOCIATING;
+            }
+        }
         case WIFI_CONNECT_ASSOCIATING:
         {
             switch (WifiData->curMode)
@@ -343,6 +666,7 @@ int Wifi_AssocStatus(void)
                     }
 #endif
                     wifi_connect_state = WIFI_CONNECT_DONE;
+                    Wifi_SaveLastConnection();
                     return ASSOCSTATUS_ASSOCIATED;
                 case WIFIMODE_CANNOTCONNECT:
                     wifi_connect_state = WIFI_CONNECT_ERROR;
@@ -361,6 +685,8 @@ int Wifi_AssocStatus(void)
                 if (ipv4_ready || ipv6_ready)
                 {
                     wifi_connect_state = WIFI_CONNECT_DONE;
+                    wifi_dhcp_lease_save();
+                    Wifi_SaveLastConnection();
                     return ASSOCSTATUS_ASSOCIATED;
                 }
 
@@ -427,3 +753,297 @@ int Wifi_AssocStatus(void)
 
     return ASSOCSTATUS_CANNOTCONNECT;
 }
+
+// Automatic reconnection
+// =======================
+
+void Wifi_SetAutoReconnect(bool enable, unsigned int same_bssid_retries,
+                           unsigned int base_delay_ms, unsigned int max_delay_ms,
+                           unsigned int max_attempts)
+{
+    if (!enable)
+    {
+        WifiData->reqFlags &= ~WFLAG_REQ_AUTO_RECONNECT;
+        return;
+    }
+
+    if (base_delay_ms == 0)
+        base_delay_ms = 1;
+    if (base_delay_ms > UINT16_MAX)
+        base_delay_ms = UINT16_MAX;
+    if (max_delay_ms < base_delay_ms)
+        max_delay_ms = base_delay_ms;
+    if (max_delay_ms > UINT16_MAX)
+        max_delay_ms = UINT16_MAX;
+    if (same_bssid_retries > UINT8_MAX)
+        same_bssid_retries = UINT8_MAX;
+    if (max_attempts > UINT8_MAX)
+        max_attempts = UINT8_MAX;
+
+    WifiData->reconnect.base_delay_ms = base_delay_ms;
+    WifiData->reconnect.max_delay_ms = max_delay_ms;
+    WifiData->reconnect.same_bssid_retries = same_bssid_retries;
+    WifiData->reconnect.max_attempts = max_attempts;
+
+    WifiData->reqFlags |= WFLAG_REQ_AUTO_RECONNECT;
+}
+
+bool Wifi_AutoReconnectActive(void)
+{
+    if (!(WifiData->reqFlags & WFLAG_REQ_AUTO_RECONNECT))
+        return false;
+
+    if (WifiData->reqMode != WIFIMODE_CONNECTED)
+        return false;
+
+    // The ARM7 only restores connections that have been lost, not the ones
+    // that have never succeeded.
+    if (wifi_connect_state != WIFI_CONNECT_DONE)
+        return false;
+
+    if (WifiData->flags7 & WFLAG_ARM7_RECONNECT_FAILED)
+        return false;
+
+    return true;
+}
+
+// Roaming between APs with the same SSID
+// ======================================
+
+typedef enum {
+    WIFI_ROAM_IDLE          = 0, // Connected, or not connected at all
+    WIFI_ROAM_WAIT_IDLE     = 1, // Waiting for the ARM7 to leave the old AP
+    WIFI_ROAM_ASSOCIATING   = 2, // Connecting to the new AP
+    WIFI_ROAM_SCANNING      = 3, // The connection was lost, looking for APs
+} WIFI_ROAM_STATE;
+
+// Minimum difference of RSSI between the current AP and a new AP to switch to
+// the new AP. This prevents switching between two APs with a similar signal.
+#define WIFI_ROAM_RSSI_MARGIN       10
+
+// Time to look for APs after losing the connection before giving up
+#define WIFI_ROAM_SCAN_TIMEOUT_SEC  5
+
+static bool wifi_roam_enabled;
+static int wifi_roam_rssi_threshold;
+static WIFI_ROAM_STATE wifi_roam_state = WIFI_ROAM_IDLE;
+static time_t wifi_roam_scan_start;
+static bool wifi_roam_sweep_started;
+static u32 wifi_roam_sweep_count;
+static Wifi_AccessPoint wifi_roam_target;
+
+void Wifi_SetRoaming(bool enable, int rssi_threshold)
+{
+    wifi_roam_rssi_threshold = rssi_threshold;
+    wifi_roam_enabled = enable;
+
+    WifiData->roamRssiThreshold = rssi_threshold;
+
+    if (!enable)
+        WifiData->reqFlags &= ~WFLAG_REQ_ROAM_SCAN;
+}
+
+bool Wifi_RoamInProgress(void)
+{
+    return wifi_roam_state != WIFI_ROAM_IDLE;
+}
+
+static void Wifi_RoamStop(void)
+{
+    WifiData->reqFlags &= ~WFLAG_REQ_ROAM_SCAN;
+    wifi_roam_state = WIFI_ROAM_IDLE;
+}
+
+// Looks for the AP with the same SSID as the current AP with the best signal,
+// excluding the current AP. It returns its RSSI, or INT16_MIN if there isn't
+// any. The RSSI of the current AP is returned in "cur_rssi", or INT16_MIN if it
+// isn't in the list.
+static int Wifi_RoamFindBestAP(Wifi_AccessPoint *best, int *cur_rssi)
+{
+    volatile Wifi_AccessPoint *cur = &WifiData->curAp;
+
+    int best_rssi = INT16_MIN;
+    *cur_rssi = INT16_MIN;
+
+    // Read the list directly instead of copying it. The result is only a hint,
+    // it's fine if the ARM7 modifies an entry while it's being read.
+    u32 mask = WifiData->aplist_active_mask;
+    while (mask != 0)
+    {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        volatile Wifi_AccessPoint *ap = &WifiData->aplist[i];
+
+        if (ap->ssid_len != cur->ssid_len)
+            continue;
+
+        if (memcmp((const void *)ap->ssid, (const void *)cur->ssid, cur->ssid_len) != 0)
+            continue;
+
+        if (Wifi_CmpMacAddr(ap->bssid, cur->bssid))
+        {
+            *cur_rssi = ap->rssi;
+            continue;
+        }
+
+        if (ap->rssi > best_rssi)
+        {
+            best_rssi = ap->rssi;
+            *best = *(Wifi_AccessPoint *)ap; // Struct copy
+        }
+    }
+
+    return best_rssi;
+}
+
+// Asks the ARM7 to leave the current AP so that it can connect to the new one.
+// The security settings of the connection are kept because the SSID is the
+// same, including the PMK calculated by the ARM7.
+static void Wifi_RoamStart(const Wifi_AccessPoint *target)
+{
+    wifi_roam_target = *target; // Struct copy
+    wifi_roam_target.rssi = 0;
+    wifi_roam_target.timectr = 0;
+    wifi_roam_target.spinlock = 0;
+
+    WifiData->reqFlags &= ~(WFLAG_REQ_ROAM_SCAN | WFLAG_REQ_LOAD_WFC_KEY);
+    WifiData->reqMode = WIFIMODE_NORMAL;
+
+    wifi_roam_state = WIFI_ROAM_WAIT_IDLE;
+}
+
+static void Wifi_RoamFail(void)
+{
+    Wifi_RoamStop();
+
+    WifiData->reqMode = WIFIMODE_NORMAL;
+    wifi_connect_state = WIFI_CONNECT_ERROR;
+}
+
+void Wifi_RoamUpdate(void)
+{
+    if (!wifi_roam_enabled)
+        return;
+
+    if (WifiData->curLibraryMode != DSWIFI_INTERNET)
+        return;
+
+    switch (wifi_roam_state)
+    {
+        case WIFI_ROAM_IDLE:
+        {
+            if (wifi_connect_state != WIFI_CONNECT_DONE)
+                return;
+
+            // Let the ARM7 try to restore the connection first
+            if ((WifiData->curMode != WIFIMODE_CONNECTED) &&
+                Wifi_AutoReconnectActive())
+                return;
+
+            if (WifiData->curMode == WIFIMODE_CANNOTCONNECT)
+            {
+                // The connection has been lost. Look for any AP with the same
+                // SSID, including the old one.
+                wifi_roam_scan_start = time(NULL);
+                wifi_roam_sweep_started = false;
+                wifi_roam_state = WIFI_ROAM_SCANNING;
+                Wifi_ScanMode();
+                return;
+            }
+
+            if (WifiData->curMode != WIFIMODE_CONNECTED)
+                return;
+
+            Wifi_AccessPoint best;
+            int cur_rssi;
+            int best_rssi = Wifi_RoamFindBestAP(&best, &cur_rssi);
+
+            if ((cur_rssi == INT16_MIN) || (cur_rssi >= wifi_roam_rssi_threshold))
+            {
+                // The signal is good enough, stop looking for other APs
+                WifiData->reqFlags &= ~WFLAG_REQ_ROAM_SCAN;
+                return;
+            }
+
+            // The signal is weak, look for other APs in the background
+            WifiData->reqFlags |= WFLAG_REQ_ROAM_SCAN;
+
+            if ((best_rssi != INT16_MIN) && (best_rssi > cur_rssi + WIFI_ROAM_RSSI_MARGIN))
+                Wifi_RoamStart(&best);
+
+            return;
+        }
+        case WIFI_ROAM_SCANNING:
+        {
+            bool timeout = (time(NULL) - wifi_roam_scan_start) > WIFI_ROAM_SCAN_TIMEOUT_SEC;
+
+            // Wait until the ARM7 has cleared the list of APs and started
+            // scanning so that the old information isn't used.
+            if (WifiData->curMode != WIFIMODE_SCAN)
+            {
+                if (timeout)
+                    Wifi_RoamFail();
+                return;
+            }
+
+            if (!wifi_roam_sweep_started)
+            {
+                wifi_roam_sweep_count = WifiData->scan_sweep_count;
+                wifi_roam_sweep_started = true;
+            }
+
+            // Wait for all channels to be scanned once so that the best AP is
+            // chosen instead of the first one that is found.
+            if ((WifiData->scan_sweep_count == wifi_roam_sweep_count) && !timeout)
+                return;
+
+            Wifi_AccessPoint best;
+            int cur_rssi;
+            int best_rssi = Wifi_RoamFindBestAP(&best, &cur_rssi);
+
+            // Go back to the old AP unless another one is clearly better
+            if ((cur_rssi != INT16_MIN) &&
+                ((best_rssi == INT16_MIN) || (best_rssi <= cur_rssi + WIFI_ROAM_RSSI_MARGIN)))
+            {
+                best = WifiData->curAp; // Struct copy
+                best_rssi = cur_rssi;
+            }
+
+            if (best_rssi != INT16_MIN)
+            {
+                Wifi_RoamStart(&best);
+                return;
+            }
+
+            // Keep scanning until an AP is found or the time runs out
+            if (timeout)
+                Wifi_RoamFail();
+
+            return;
+        }
+        case WIFI_ROAM_WAIT_IDLE:
+        {
+            if (WifiData->curMode != WIFIMODE_NORMAL)
+                return;
+
+            WifiData->curAp = wifi_roam_target; // Struct copy
+            WifiData->reqMode = WIFIMODE_CONNECTED;
+            wifi_roam_state = WIFI_ROAM_ASSOCIATING;
+            return;
+        }
+        case WIFI_ROAM_ASSOCIATING:
+        {
+            if (WifiData->curMode == WIFIMODE_CONNECTED)
+            {
+                wifi_roam_state = WIFI_ROAM_IDLE;
+                Wifi_SaveLastConnection();
+            }
+            else if (WifiData->curMode == WIFIMODE_CANNOTCONNECT)
+            {
+                Wifi_RoamFail();
+            }
+            return;
+        }
+    }
+}
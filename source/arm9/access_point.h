@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#ifndef DSWIFI_ARM9_ACCESS_POINT_H__
+#define DSWIFI_ARM9_ACCESS_POINT_H__
+
+#include <stdbool.h>
+
+// Checks the signal of the current AP and switches to a different AP with the
+// same SSID if needed. It must be called regularly.
+void Wifi_RoamUpdate(void);
+
+// Returns true while the library is switching to a different AP. The network
+// interface must be kept up during the switch.
+bool Wifi_RoamInProgress(void);
+
+// Returns true if the ARM7 is going to try to restore the connection with the
+// AP if it's lost (or if it's already trying to do it). In that case lwIP only
+// needs to see the link going down, DHCP must be kept running.
+bool Wifi_AutoReconnectActive(void);
+
+#endif // DSWIFI_ARM9_ACCESS_POINT_H__
@@ -13,6 +13,7 @@
 
 #include "arm9/ipc.h"
 #include "arm9/lwip/lwip_nds.h"
+#include "arm9/ntr/beacon.h"
 #include "arm9/wifi_arm9.h"
 #include "common/common_ntr_defs.h"
 #include "common/ieee_defs.h"
@@ -89,6 +90,8 @@ static bool Wifi_InitIPC(unsigned int flags)
     for (u8 i = 0; i < PersonalData->nameLen; i++)
         WifiData->hostPlayerName[i] = PersonalData->name[i];
 
+    Wifi_EventInit();
+
     // Send the cached mirror to the ARM7 (the ARM7 doesn't have cache, so the
     // cached address in main RAM is enough).
     fifoSendAddress(FIFO_DSWIFI, WifiDataCached);
@@ -253,6 +256,17 @@ void Wifi_ScanMode(void)
     // Don't switch to scan mode when acting as a multiplayer host
 }
 
+void Wifi_SetScanDwellTime(unsigned int active_dwell_ms, unsigned int passive_dwell_ms)
+{
+    if (active_dwell_ms > UINT16_MAX)
+        active_dwell_ms = UINT16_MAX;
+    if (passive_dwell_ms > UINT16_MAX)
+        passive_dwell_ms = UINT16_MAX;
+
+    WifiData->scan.active_dwell_ms = active_dwell_ms;
+    WifiData->scan.passive_dwell_ms = passive_dwell_ms;
+}
+
 void Wifi_IdleMode(void)
 {
     WifiData->reqMode = WIFIMODE_NORMAL;
@@ -338,6 +352,15 @@ void Wifi_MultiplayerHostName(const void *buffer, u8 len)
     // as it is to the clients.
     WifiData->hostPlayerNameLen = len;
     memcpy((void *)WifiData->hostPlayerName, buffer, DSWIFI_BEACON_NAME_SIZE);
+
+    // If the beacon is already being sent, update it in place
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+    {
+        Wifi_BeaconPatchVendorData(offsetof(FieVendorNintendo, extra_data.name_len),
+                                   &len, 1);
+        Wifi_BeaconPatchVendorData(offsetof(FieVendorNintendo, extra_data.name),
+                                   buffer, DSWIFI_BEACON_NAME_SIZE);
+    }
 }
 
 void Wifi_MultiplayerKickClientByAID(int association_id)
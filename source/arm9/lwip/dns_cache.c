@@ -0,0 +1,660 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#ifdef DSWIFI_ENABLE_LWIP
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nds.h>
+#include <dswifi9.h>
+
+#include "arm9/lwip/lwip_nds.h"
+
+#include "lwip/dns.h"
+#include "lwip/raw.h"
+#include "lwip/tcpip.h"
+#include "lwip/udp.h"
+
+// This cache sits in front of the resolver of lwIP. Lookups go through
+// LWIP_HOOK_NETCONN_EXTERNAL_RESOLVE, which is used by lwip_gethostbyname() and
+// lwip_getaddrinfo(). lwIP doesn't give the TTL of the answers to the caller,
+// so the cache is filled by a raw PCB that looks at the DNS replies received
+// from the configured DNS servers before lwIP handles them. The PCB uses one of
+// the MEMP_NUM_RAW_PCB slots of lwIP.
+//
+// Only replies to queries that lwIP is expected to send are cached. When a
+// lookup misses the cache (or a name is prefetched) the name and the record
+// types that lwIP will ask for are recorded. A reply is only used if its
+// question matches one of them and it's sent to a port that has a UDP PCB
+// (lwIP uses a random source port for each query). Anyone can send a UDP packet
+// with source port 53, so this prevents other hosts from adding entries to the
+// cache.
+//
+// The cache is accessed from the thread of lwIP and from the threads that
+// resolve names. Cothreads are cooperative, and none of the functions below
+// yield, so no additional locking is needed.
+
+#define DNS_CACHE_NAME_LEN      64 // Longer names aren't cached
+#define DNS_CACHE_MAX_TTL       (24 * 60 * 60) // Seconds
+#define DNS_CACHE_MAX_PREFETCH  8
+#define DNS_CACHE_MAX_QUERIES   (2 * DNS_CACHE_MAX_PREFETCH)
+#define DNS_CACHE_QUERY_TIMEOUT_MS  (20 * 1000) // lwIP gives up before this
+
+#define DNS_PORT                53
+#define DNS_HEADER_SIZE         12
+#define DNS_FLAG_RESPONSE       0x8000
+#define DNS_RCODE_MASK          0x000F
+#define DNS_RCODE_NO_ERROR      0
+#define DNS_RCODE_NAME_ERROR    3
+#define DNS_TYPE_A              1
+#define DNS_TYPE_CNAME          5
+#define DNS_TYPE_AAAA           28
+#define DNS_CLASS_IN            1
+
+typedef struct {
+    char name[DNS_CACHE_NAME_LEN];
+    ip_addr_t addr;
+    u32 expire_ms; // Value of sys_now() when the entry expires
+    u16 type; // DNS_TYPE_A or DNS_TYPE_AAAA, 0 if the entry is empty
+    bool negative; // The name doesn't have any address of this type
+} dns_cache_entry;
+
+typedef struct {
+    char name[DNS_CACHE_NAME_LEN];
+    u32 start_ms; // Value of sys_now() when the lookup was started
+    u16 type; // DNS_TYPE_A or DNS_TYPE_AAAA, 0 if the entry is empty
+} dns_cache_query;
+
+static dns_cache_entry *dns_cache = NULL;
+static int dns_cache_size = 0;
+static u32 dns_cache_negative_ttl_ms = 0;
+
+static u32 dns_cache_hits = 0;
+static u32 dns_cache_misses = 0;
+
+static struct raw_pcb *dns_cache_pcb = NULL;
+
+static dns_cache_query dns_cache_queries[DNS_CACHE_MAX_QUERIES];
+
+static char *dns_prefetch_names[DNS_CACHE_MAX_PREFETCH];
+static int dns_prefetch_count = 0;
+static bool dns_prefetch_done = false;
+
+static bool dns_cache_is_expired(const dns_cache_entry *entry, u32 now)
+{
+    return (s32)(now - entry->expire_ms) >= 0;
+}
+
+static dns_cache_entry *dns_cache_find(const char *name, u16 type)
+{
+    u32 now = sys_now();
+
+    for (int i = 0; i < dns_cache_size; i++)
+    {
+        dns_cache_entry *entry = &dns_cache[i];
+
+        if (entry->type != type)
+            continue;
+
+        if (dns_cache_is_expired(entry, now))
+        {
+            entry->type = 0;
+            continue;
+        }
+
+        if (strcasecmp(entry->name, name) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void dns_cache_store(const char *name, u16 type, const ip_addr_t *addr,
+                            u32 ttl_ms)
+{
+    if ((dns_cache == NULL) || (ttl_ms == 0))
+        return;
+
+    if (strlen(name) >= DNS_CACHE_NAME_LEN)
+        return;
+
+    u32 now = sys_now();
+
+    // Reuse the entry of this name if it exists. If not, use an empty entry or
+    // the one that expires first.
+    dns_cache_entry *entry = dns_cache_find(name, type);
+    if (entry == NULL)
+    {
+        for (int i = 0; i < dns_cache_size; i++)
+        {
+            dns_cache_entry *e = &dns_cache[i];
+
+            if ((e->type == 0) || dns_cache_is_expired(e, now))
+            {
+                entry = e;
+                break;
+            }
+
+            if ((entry == NULL) || ((s32)(e->expire_ms - entry->expire_ms) < 0))
+                entry = e;
+        }
+    }
+
+    strcpy(entry->name, name);
+    entry->type = type;
+    entry->expire_ms = now + ttl_ms;
+
+    if (addr == NULL)
+    {
+        entry->negative = true;
+        ip_addr_set_zero(&entry->addr);
+    }
+    else
+    {
+        entry->negative = false;
+        ip_addr_copy(entry->addr, *addr);
+    }
+}
+
+// Records a lookup that lwIP is going to do. If all slots are used, the oldest
+// lookup is replaced.
+static void dns_cache_add_query(const char *name, u16 type)
+{
+    size_t len = strlen(name);
+    if (len >= DNS_CACHE_NAME_LEN)
+        return;
+
+    u32 now = sys_now();
+
+    dns_cache_query *query = NULL;
+
+    for (int i = 0; i < DNS_CACHE_MAX_QUERIES; i++)
+    {
+        dns_cache_query *q = &dns_cache_queries[i];
+
+        // Replace the oldest lookup if there are no free slots
+        if ((q->type == 0) || ((now - q->start_ms) >= DNS_CACHE_QUERY_TIMEOUT_MS))
+        {
+            query = q;
+            break;
+        }
+
+        if ((query == NULL) || ((s32)(q->start_ms - query->start_ms) < 0))
+            query = q;
+    }
+
+    // Names in replies are compared in lowercase
+    for (size_t i = 0; i <= len; i++)
+        query->name[i] = tolower((unsigned char)name[i]);
+
+    query->start_ms = now;
+    query->type = type;
+}
+
+// Looks for the lookup that a reply answers and removes it from the list.
+// Returns false if lwIP hasn't asked for this name and type.
+static bool dns_cache_take_query(const char *name, u16 type)
+{
+    u32 now = sys_now();
+
+    for (int i = 0; i < DNS_CACHE_MAX_QUERIES; i++)
+    {
+        dns_cache_query *q = &dns_cache_queries[i];
+
+        if (q->type == 0)
+            continue;
+
+        if ((now - q->start_ms) >= DNS_CACHE_QUERY_TIMEOUT_MS)
+        {
+            q->type = 0;
+            continue;
+        }
+
+        if ((q->type != type) || (strcmp(q->name, name) != 0))
+            continue;
+
+        q->type = 0;
+        return true;
+    }
+
+    return false;
+}
+
+// Returns the record types that lwIP asks for with this address type, in the
+// order in which it asks for them.
+static void dns_cache_get_types(u8_t addrtype, u16 *first, u16 *second)
+{
+    switch (addrtype)
+    {
+        case LWIP_DNS_ADDRTYPE_IPV4:
+            *first = *second = DNS_TYPE_A;
+            break;
+        case LWIP_DNS_ADDRTYPE_IPV6:
+            *first = *second = DNS_TYPE_AAAA;
+            break;
+        case LWIP_DNS_ADDRTYPE_IPV4_IPV6:
+            *first = DNS_TYPE_A;
+            *second = DNS_TYPE_AAAA;
+            break;
+        case LWIP_DNS_ADDRTYPE_IPV6_IPV4:
+        default:
+            *first = DNS_TYPE_AAAA;
+            *second = DNS_TYPE_A;
+            break;
+    }
+}
+
+static void dns_cache_add_lookup(const char *name, u8_t addrtype)
+{
+    u16 first, second;
+    dns_cache_get_types(addrtype, &first, &second);
+
+    dns_cache_add_query(name, first);
+    if (second != first)
+        dns_cache_add_query(name, second);
+}
+
+// Returns 1 if the cache has an answer for this name. In that case "err" is set
+// to ERR_OK and "addr" is filled, or "err" is set to ERR_VAL if the name is
+// known not to exist. Returns 0 if lwIP needs to resolve the name.
+int dswifi_dns_cache_resolve(const char *name, ip_addr_t *addr, u8_t addrtype,
+                             err_t *err)
+{
+    if (dns_cache == NULL)
+        return 0;
+
+    // Numeric addresses are handled by lwIP without any network access
+    ip_addr_t numeric;
+    if (ipaddr_aton(name, &numeric))
+        return 0;
+
+    u16 first, second;
+    dns_cache_get_types(addrtype, &first, &second);
+
+    dns_cache_entry *e1 = dns_cache_find(name, first);
+    dns_cache_entry *e2 = (second == first) ? e1 : dns_cache_find(name, second);
+
+    dns_cache_entry *found = NULL;
+    if ((e1 != NULL) && !e1->negative)
+        found = e1;
+    else if ((e1 != NULL) && (e2 != NULL) && !e2->negative)
+        found = e2;
+
+    if (found != NULL)
+    {
+        ip_addr_copy(*addr, found->addr);
+        *err = ERR_OK;
+        dns_cache_hits++;
+        return 1;
+    }
+
+    // Only report a failure if all the requested types are known to fail
+    if ((e1 != NULL) && e1->negative && (e2 != NULL) && e2->negative)
+    {
+        *err = ERR_VAL;
+        dns_cache_hits++;
+        return 1;
+    }
+
+    // lwIP is going to send the queries now, accept the replies to them
+    dns_cache_add_lookup(name, addrtype);
+
+    dns_cache_misses++;
+    return 0;
+}
+
+// DNS reply parser
+// ================
+
+// Returns the offset right after the name, or -1 on error.
+static int dns_skip_name(const u8 *msg, int len, int offset)
+{
+    while (offset < len)
+    {
+        u8 label_len = msg[offset];
+
+        if (label_len == 0)
+            return offset + 1;
+
+        // Compressed name. The pointer is always the end of the name.
+        if ((label_len & 0xC0) == 0xC0)
+            return offset + 2;
+
+        offset += label_len + 1;
+    }
+
+    return -1;
+}
+
+// Reads the name of the question, which is never compressed. Returns the offset
+// right after the name, or -1 on error.
+static int dns_read_name(const u8 *msg, int len, int offset, char *name,
+                         size_t name_size)
+{
+    size_t out = 0;
+
+    while (offset < len)
+    {
+        u8 label_len = msg[offset++];
+
+        if (label_len == 0)
+        {
+            if (out == 0)
+                return -1;
+            name[out - 1] = '\0'; // Replace the last dot
+            return offset;
+        }
+
+        if ((label_len & 0xC0) != 0)
+            return -1;
+
+        if ((offset + label_len > len) || (out + label_len + 1 > name_size))
+            return -1;
+
+        for (int i = 0; i < label_len; i++)
+            name[out++] = tolower(msg[offset++]);
+        name[out++] = '.';
+    }
+
+    return -1;
+}
+
+static bool dns_is_server(const ip_addr_t *addr)
+{
+    for (int i = 0; i < DNS_MAX_SERVERS; i++)
+    {
+        if (ip_addr_eq(addr, dns_getserver(i)))
+            return true;
+    }
+
+    return false;
+}
+
+// Reads the question of a DNS message. Returns the offset right after the
+// question, or -1 if the message doesn't have exactly one question.
+static int dns_read_question(const u8 *msg, int len, char *name, size_t name_size,
+                             u16 *type)
+{
+    if (len < DNS_HEADER_SIZE)
+        return -1;
+
+    u16 qdcount = (msg[4] << 8) | msg[5];
+    if (qdcount != 1)
+        return -1;
+
+    int offset = dns_read_name(msg, len, DNS_HEADER_SIZE, name, name_size);
+    if ((offset < 0) || (offset + 4 > len))
+        return -1;
+
+    *type = (msg[offset] << 8) | msg[offset + 1];
+
+    return offset + 4;
+}
+
+static void dns_cache_parse_reply(const u8 *msg, int len)
+{
+    if (len < DNS_HEADER_SIZE)
+        return;
+
+    u16 flags = (msg[2] << 8) | msg[3];
+    u16 ancount = (msg[6] << 8) | msg[7];
+
+    if ((flags & DNS_FLAG_RESPONSE) == 0)
+        return;
+
+    char name[DNS_CACHE_NAME_LEN];
+    u16 qtype;
+    int offset = dns_read_question(msg, len, name, sizeof(name), &qtype);
+    if (offset < 0)
+        return;
+
+    if ((qtype != DNS_TYPE_A) && (qtype != DNS_TYPE_AAAA))
+        return;
+
+    if (!dns_cache_take_query(name, qtype))
+        return;
+
+    u16 rcode = flags & DNS_RCODE_MASK;
+
+    if (rcode == DNS_RCODE_NAME_ERROR)
+    {
+        // The name doesn't exist, so it doesn't have addresses of any type
+        dns_cache_store(name, DNS_TYPE_A, NULL, dns_cache_negative_ttl_ms);
+        dns_cache_store(name, DNS_TYPE_AAAA, NULL, dns_cache_negative_ttl_ms);
+        return;
+    }
+
+    if (rcode != DNS_RCODE_NO_ERROR)
+        return;
+
+    // Use the lowest TTL of the chain of answers (including CNAME records)
+    bool found = false;
+    ip_addr_t addr;
+    u32 ttl = DNS_CACHE_MAX_TTL;
+
+    for (int i = 0; i < ancount; i++)
+    {
+        offset = dns_skip_name(msg, len, offset);
+        if ((offset < 0) || (offset + 10 > len))
+            return;
+
+        u16 type = (msg[offset] << 8) | msg[offset + 1];
+        u16 class = (msg[offset + 2] << 8) | msg[offset + 3];
+        u32 rr_ttl = ((u32)msg[offset + 4] << 24) | (msg[offset + 5] << 16) |
+                     (msg[offset + 6] << 8) | msg[offset + 7];
+        u16 rdlength = (msg[offset + 8] << 8) | msg[offset + 9];
+        offset += 10;
+
+        if (offset + rdlength > len)
+            return;
+
+        if (class == DNS_CLASS_IN)
+        {
+            if ((type == qtype) || (type == DNS_TYPE_CNAME))
+            {
+                if (rr_ttl < ttl)
+                    ttl = rr_ttl;
+            }
+
+            // Like lwIP, only use the first address
+            if (!found && (type == DNS_TYPE_A) && (qtype == DNS_TYPE_A) &&
+                (rdlength == 4))
+            {
+                u32 ip4;
+                memcpy(&ip4, &msg[offset], sizeof(ip4));
+                ip_addr_set_ip4_u32_val(addr, ip4);
+                found = true;
+            }
+            else if (!found && (type == DNS_TYPE_AAAA) &&
+                     (qtype == DNS_TYPE_AAAA) && (rdlength == 16))
+            {
+                u32 ip6[4];
+                memcpy(ip6, &msg[offset], sizeof(ip6));
+                IP_ADDR6(&addr, ip6[0], ip6[1], ip6[2], ip6[3]);
+                found = true;
+            }
+        }
+
+        offset += rdlength;
+    }
+
+    if (found)
+        dns_cache_store(name, qtype, &addr, ttl * 1000);
+    else
+        dns_cache_store(name, qtype, NULL, dns_cache_negative_ttl_ms);
+}
+
+// lwIP sends each query from a PCB bound to a random port. Replies sent to any
+// other port can't be answers to them.
+static bool dns_cache_port_in_use(u16 port)
+{
+    for (struct udp_pcb *pcb = udp_pcbs; pcb != NULL; pcb = pcb->next)
+    {
+        if (pcb->local_port == port)
+            return true;
+    }
+
+    return false;
+}
+
+// Called by lwIP for every UDP packet received. It returns 0 so that lwIP
+// handles the packet normally afterwards.
+static u8_t dns_cache_raw_recv(void *arg, struct raw_pcb *pcb, struct pbuf *p,
+                               const ip_addr_t *addr)
+{
+    (void)arg;
+    (void)pcb;
+
+    if (dns_cache == NULL)
+        return 0;
+
+    if (!dns_is_server(addr))
+        return 0;
+
+    // The payload points to the IP header. lwIP has already calculated the
+    // size of the header, including IPv6 extension headers.
+    u16 ip_hdr_len = ip_current_header_tot_len();
+
+    u8 udp_hdr[8];
+    if (pbuf_copy_partial(p, udp_hdr, sizeof(udp_hdr), ip_hdr_len) != sizeof(udp_hdr))
+        return 0;
+
+    u16 src_port = (udp_hdr[0] << 8) | udp_hdr[1];
+    u16 dst_port = (udp_hdr[2] << 8) | udp_hdr[3];
+    if (src_port != DNS_PORT)
+        return 0;
+
+    if (!dns_cache_port_in_use(dst_port))
+        return 0;
+
+    static u8 msg[512]; // Max size of a DNS message over UDP
+    u16 len = pbuf_copy_partial(p, msg, sizeof(msg), ip_hdr_len + sizeof(udp_hdr));
+
+    dns_cache_parse_reply(msg, len);
+
+    return 0;
+}
+
+// Public interface
+// ================
+
+static void dns_cache_setup_pcb(void *arg)
+{
+    (void)arg;
+
+    if (dns_cache_pcb != NULL)
+        return;
+
+    dns_cache_pcb = raw_new_ip_type(IPADDR_TYPE_ANY, IP_PROTO_UDP);
+    if (dns_cache_pcb == NULL)
+        return;
+
+    raw_recv(dns_cache_pcb, dns_cache_raw_recv, NULL);
+}
+
+int Wifi_SetDnsCache(int num_entries, unsigned int negative_ttl_sec)
+{
+    if (!wifi_lwip_enabled)
+        return -1;
+
+    if (num_entries < 0)
+        return -1;
+
+    free(dns_cache);
+    dns_cache = NULL;
+    dns_cache_size = 0;
+
+    if (num_entries == 0)
+        return 0;
+
+    dns_cache = calloc(num_entries, sizeof(dns_cache_entry));
+    if (dns_cache == NULL)
+        return -1;
+
+    dns_cache_size = num_entries;
+    dns_cache_negative_ttl_ms = negative_ttl_sec * 1000;
+
+    tcpip_callback(dns_cache_setup_pcb, NULL);
+
+    return 0;
+}
+
+void Wifi_FlushDnsCache(void)
+{
+    for (int i = 0; i < dns_cache_size; i++)
+        dns_cache[i].type = 0;
+
+    for (int i = 0; i < DNS_CACHE_MAX_QUERIES; i++)
+        dns_cache_queries[i].type = 0;
+
+    // Resolve the names again the next time a connection is available
+    dns_prefetch_done = false;
+}
+
+int Wifi_AddDnsPrefetch(const char *name)
+{
+    if (name == NULL)
+        return -1;
+
+    if (dns_prefetch_count == DNS_CACHE_MAX_PREFETCH)
+        return -1;
+
+    if (strlen(name) >= DNS_CACHE_NAME_LEN)
+        return -1;
+
+    char *copy = strdup(name);
+    if (copy == NULL)
+        return -1;
+
+    dns_prefetch_names[dns_prefetch_count++] = copy;
+    dns_prefetch_done = false;
+    return 0;
+}
+
+void Wifi_GetDnsCacheStats(u32 *hits, u32 *misses)
+{
+    if (hits != NULL)
+        *hits = dns_cache_hits;
+    if (misses != NULL)
+        *misses = dns_cache_misses;
+}
+
+static void dns_prefetch_found(const char *name, const ip_addr_t *ipaddr,
+                               void *arg)
+{
+    // The raw PCB has already seen the reply, there is nothing to do here.
+    (void)name;
+    (void)ipaddr;
+    (void)arg;
+}
+
+static void dns_prefetch_start(void *arg)
+{
+    (void)arg;
+
+    for (int i = 0; i < dns_prefetch_count; i++)
+    {
+        dns_cache_add_lookup(dns_prefetch_names[i], LWIP_DNS_ADDRTYPE_DEFAULT);
+
+        ip_addr_t addr;
+        dns_gethostbyname(dns_prefetch_names[i], &addr, dns_prefetch_found, NULL);
+    }
+}
+
+void wifi_dns_cache_prefetch(void)
+{
+    if (dns_prefetch_done || (dns_cache == NULL) || (dns_prefetch_count == 0))
+        return;
+
+    // Wait until there is a DNS server to send the requests to
+    if (wifi_get_dns(0) == 0)
+        return;
+
+    if (tcpip_callback(dns_prefetch_start, NULL) == ERR_OK)
+        dns_prefetch_done = true;
+}
+
+#endif // DSWIFI_ENABLE_LWIP
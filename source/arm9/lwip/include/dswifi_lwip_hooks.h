@@ -0,0 +1,15 @@
+// SPDX-License-Identifier: MIT
+//
+// Copyright (C) 2025 Antonio Niño Díaz
+
+#ifndef DSWIFI_LWIP_HOOKS_H__
+#define DSWIFI_LWIP_HOOKS_H__
+
+#include "lwip/err.h"
+#include "lwip/ip_addr.h"
+
+// Defined in dns_cache.c
+int dswifi_dns_cache_resolve(const char *name, ip_addr_t *addr, u8_t addrtype,
+                             err_t *err);
+
+#endif // DSWIFI_LWIP_HOOKS_H__
@@ -123,6 +123,11 @@
 
 #define LWIP_DNS_ADDRTYPE_DEFAULT   LWIP_DNS_ADDRTYPE_IPV6_IPV4
 
+// Check the DNS cache of DSWifi before asking lwIP to resolve a name
+#define LWIP_HOOK_FILENAME          "dswifi_lwip_hooks.h"
+#define LWIP_HOOK_NETCONN_EXTERNAL_RESOLVE(name, addr, addrtype, err) \
+        dswifi_dns_cache_resolve(name, addr, addrtype, err)
+
 // Socket settings
 // ===============
 
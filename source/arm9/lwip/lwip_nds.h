@@ -32,12 +32,23 @@ void wifi_lwip_deinit(void);
 void wifi_netif_set_up(void);
 // This must be called when the console disconnects from an AP.
 void wifi_netif_set_down(void);
+// This must be called when the connection with the AP is lost but it's expected
+// to be restored soon. It keeps the IP address and DHCP running.
+void wifi_netif_set_link_down(void);
 // Returns true if the netif is up.
 bool wifi_netif_is_up(void);
 
 // Returns true if DHCP is enabled, false if using manual IP settings.
 bool wifi_using_dhcp(void);
 
+// Saves the current DHCP lease to the cache provided by the user, if any.
+void wifi_dhcp_lease_save(void);
+
+// Resolves the names registered with Wifi_AddDnsPrefetch() if it hasn't been
+// done since the last time the DNS cache was flushed. It must be called
+// regularly while the console is connected to an AP.
+void wifi_dns_cache_prefetch(void);
+
 u32 wifi_get_ip(void);
 u32 wifi_get_dns(int index);
 
@@ -6,6 +6,8 @@
 
 #include <netinet/in.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 
 // This is defined in <netinet/in.h> but it's also defined in "lwip/def.h"
 #undef ntohs
@@ -14,6 +16,7 @@
 #include <nds.h>
 #include <dswifi9.h>
 
+#include "arm9/ipc.h"
 #include "arm9/lwip/lwip_nds.h"
 #include "arm9/wifi_arm9.h"
 
@@ -27,6 +30,7 @@
 #include "lwip/netifapi.h"
 #include "netif/ethernet.h"
 #include "lwip/apps/netbiosns.h"
+#include "lwip/prot/dhcp.h"
 #include "lwip/tcpip.h"
 
 // This is set to true if lwIP is enabled
@@ -38,6 +42,9 @@ static char dswifi_netif_hostname[64];
 
 static bool dswifi_link_is_up = false;
 static bool dswifi_use_dhcp = true;
+// True if the link is down but the DHCP client has been kept running because
+// the connection is expected to be restored soon.
+static bool dswifi_dhcp_kept = false;
 
 static err_t dswifi_link_output(struct netif *netif, struct pbuf *p)
 {
@@ -388,6 +395,191 @@ void Wifi_SetIP(u32 IPaddr, u32 gateway, u32 subnetmask, u32 dns1, u32 dns2)
     }
 }
 
+// DHCP lease cache
+// ================
+
+// Buffer provided by the user with Wifi_SetDhcpLeaseCache()
+static Wifi_DhcpLease *dswifi_lease_cache = NULL;
+static int dswifi_lease_cache_size = 0;
+
+int Wifi_SetDhcpLeaseCache(Wifi_DhcpLease *leases, int num_leases)
+{
+    if ((leases == NULL) || (num_leases <= 0))
+    {
+        dswifi_lease_cache = NULL;
+        dswifi_lease_cache_size = 0;
+        return (leases == NULL) ? 0 : -1;
+    }
+
+    dswifi_lease_cache = leases;
+    dswifi_lease_cache_size = num_leases;
+    return 0;
+}
+
+// Returns the entry of the cache that matches the current AP. An entry with the
+// same BSSID is preferred, but any entry with the same SSID is accepted. If the
+// AP has a different DHCP server the lease will be rejected and a regular DHCP
+// negotiation will start.
+static Wifi_DhcpLease *dswifi_lease_find(void)
+{
+    volatile Wifi_AccessPoint *ap = &WifiData->curAp;
+    Wifi_DhcpLease *found = NULL;
+
+    for (int i = 0; i < dswifi_lease_cache_size; i++)
+    {
+        Wifi_DhcpLease *lease = &dswifi_lease_cache[i];
+
+        if (lease->ip == 0)
+            continue;
+
+        if (lease->ssid_len != ap->ssid_len)
+            continue;
+        if (memcmp(lease->ssid, (const void *)ap->ssid, ap->ssid_len) != 0)
+            continue;
+
+        if (memcmp(lease->bssid, (const void *)ap->bssid, sizeof(lease->bssid)) == 0)
+            return lease;
+
+        if (found == NULL)
+            found = lease;
+    }
+
+    return found;
+}
+
+// Returns the number of seconds left in the lease, or 0 if it has expired.
+static u32 dswifi_lease_time_left(const Wifi_DhcpLease *lease)
+{
+    u32 elapsed = (u32)time(NULL) - lease->timestamp;
+
+    if (elapsed >= lease->lease_time_left)
+        return 0;
+
+    return lease->lease_time_left - elapsed;
+}
+
+// This runs in the thread of lwIP.
+static void dswifi_lease_save_fn(struct netif *netif)
+{
+    if (dswifi_lease_cache == NULL)
+        return;
+
+    if (!dhcp_supplied_address(netif))
+        return;
+
+    struct dhcp *dhcp = netif_dhcp_data(netif);
+
+    u32 used = dhcp->lease_used * DHCP_COARSE_TIMER_SECS;
+    if (used >= dhcp->offered_t0_lease)
+        return;
+
+    volatile Wifi_AccessPoint *ap = &WifiData->curAp;
+
+    // Replace the entry of this AP if it exists. If not, use a free entry or
+    // replace the oldest one.
+    Wifi_DhcpLease *lease = NULL;
+    Wifi_DhcpLease *free_entry = NULL;
+    Wifi_DhcpLease *oldest = NULL;
+
+    for (int i = 0; i < dswifi_lease_cache_size; i++)
+    {
+        Wifi_DhcpLease *l = &dswifi_lease_cache[i];
+
+        if (l->ip == 0)
+        {
+            if (free_entry == NULL)
+                free_entry = l;
+            continue;
+        }
+
+        if ((l->ssid_len == ap->ssid_len) &&
+            (memcmp(l->ssid, (const void *)ap->ssid, ap->ssid_len) == 0) &&
+            (memcmp(l->bssid, (const void *)ap->bssid, sizeof(l->bssid)) == 0))
+        {
+            lease = l;
+            break;
+        }
+
+        if ((oldest == NULL) || (l->timestamp < oldest->timestamp))
+            oldest = l;
+    }
+
+    if (lease == NULL)
+        lease = (free_entry != NULL) ? free_entry : oldest;
+
+    memset(lease, 0, sizeof(Wifi_DhcpLease));
+
+    memcpy(lease->bssid, (const void *)ap->bssid, sizeof(lease->bssid));
+    lease->ssid_len = ap->ssid_len;
+    memcpy(lease->ssid, (const void *)ap->ssid, ap->ssid_len);
+
+    lease->ip = ip4_addr_get_u32(&dhcp->offered_ip_addr);
+    lease->subnet_mask = ip4_addr_get_u32(&dhcp->offered_sn_mask);
+    lease->gateway = ip4_addr_get_u32(&dhcp->offered_gw_addr);
+    lease->dns_primary = wifi_get_dns(0);
+    lease->dns_secondary = wifi_get_dns(1);
+    lease->server_id = ip4_addr_get_u32(ip_2_ip4(&dhcp->server_ip_addr));
+
+    lease->lease_time_left = dhcp->offered_t0_lease - used;
+    lease->timestamp = (u32)time(NULL);
+}
+
+void wifi_dhcp_lease_save(void)
+{
+    if (!dswifi_use_dhcp || (dswifi_lease_cache == NULL))
+        return;
+
+    netifapi_netif_common(&dswifi_netif, dswifi_lease_save_fn, NULL);
+}
+
+// This runs in the thread of lwIP. It must be called while the link is down. If
+// there is a valid lease for the current AP, it starts DHCP in INIT-REBOOT
+// state, so that only a REQUEST/ACK exchange is needed to confirm the address
+// when the link goes up.
+static err_t dswifi_lease_reboot_fn(struct netif *netif)
+{
+    if (dswifi_lease_cache == NULL)
+        return ERR_VAL;
+
+    Wifi_DhcpLease *lease = dswifi_lease_find();
+    if (lease == NULL)
+        return ERR_VAL;
+
+    u32 time_left = dswifi_lease_time_left(lease);
+    if (time_left == 0)
+        return ERR_VAL;
+
+    // The link is down, so this only allocates the client and leaves it in
+    // INIT state.
+    err_t err = dhcp_start(netif);
+    if (err != ERR_OK)
+        return err;
+
+    struct dhcp *dhcp = netif_dhcp_data(netif);
+
+    ip4_addr_set_u32(&dhcp->offered_ip_addr, lease->ip);
+    ip4_addr_set_u32(&dhcp->offered_sn_mask, lease->subnet_mask);
+    ip4_addr_set_u32(&dhcp->offered_gw_addr, lease->gateway);
+    ip_addr_set_ip4_u32_val(dhcp->server_ip_addr, lease->server_id);
+
+    dhcp->offered_t0_lease = time_left;
+    dhcp->offered_t1_renew = time_left / 2;
+    dhcp->offered_t2_rebind = (time_left / 8) * 7;
+
+    // When the link goes up, netif_set_link_up() sends a DHCPREQUEST with the
+    // requested address instead of starting with a DHCPDISCOVER. If the server
+    // replies with a NAK, lwIP starts a regular negotiation.
+    dhcp->state = DHCP_STATE_REBOOTING;
+
+    // Use the cached DNS servers until the ACK provides new ones
+    if (lease->dns_primary != 0)
+        wifi_set_dns(0, lease->dns_primary);
+    if (lease->dns_secondary != 0)
+        wifi_set_dns(1, lease->dns_secondary);
+
+    return ERR_OK;
+}
+
 int wifi_lwip_init(void)
 {
     // Initialize lwIP once the ARM7 is ready
@@ -444,12 +636,30 @@ void wifi_netif_set_up(void)
     // everything related to the MAC address.
     wifi_refresh_mac();
 
+    // If there is a cached lease for this AP, DHCP needs to be started before
+    // the link goes up to skip the DISCOVER/OFFER exchange.
+    bool dhcp_started = false;
+    if (dswifi_use_dhcp && !dswifi_dhcp_kept)
+    {
+        if (netifapi_netif_common(&dswifi_netif, NULL, dswifi_lease_reboot_fn) == ERR_OK)
+            dhcp_started = true;
+    }
+
     // Thread-safe version of netif_set_link_up()
     netifapi_netif_set_link_up(&dswifi_netif);
 
+    // If DHCP has been kept running, lwIP will confirm the current lease when
+    // the link goes up, there is no need to start DHCP again.
+    if (dswifi_dhcp_kept)
+    {
+        dswifi_dhcp_kept = false;
+        return;
+    }
+
     if (dswifi_use_dhcp)
     {
-        netifapi_dhcp_start(&dswifi_netif);
+        if (!dhcp_started)
+            netifapi_dhcp_start(&dswifi_netif);
         dhcp6_enable_stateless(&dswifi_netif);
     }
 }
@@ -457,12 +667,40 @@ void wifi_netif_set_up(void)
 void wifi_netif_set_down(void)
 {
     if (!dswifi_link_is_up)
+    {
+        // The link is already down, but DHCP may have been kept running
+        if (dswifi_dhcp_kept)
+        {
+            dswifi_dhcp_kept = false;
+            Wifi_FlushDnsCache();
+            wifi_dhcp_lease_save();
+            netifapi_dhcp_stop(&dswifi_netif);
+        }
         return;
+    }
 
     dswifi_link_is_up = false;
 
+    // The next network may resolve names differently
+    Wifi_FlushDnsCache();
+
     if (dswifi_use_dhcp)
+    {
+        wifi_dhcp_lease_save();
         netifapi_dhcp_stop(&dswifi_netif);
+    }
+
+    // Thread-safe version of netif_set_link_down()
+    netifapi_netif_set_link_down(&dswifi_netif);
+}
+
+void wifi_netif_set_link_down(void)
+{
+    if (!dswifi_link_is_up)
+        return;
+
+    dswifi_link_is_up = false;
+    dswifi_dhcp_kept = dswifi_use_dhcp;
 
     // Thread-safe version of netif_set_link_down()
     netifapi_netif_set_link_down(&dswifi_netif);
@@ -9,6 +9,7 @@
 #include "lwip/sys.h"
 #include "lwip/tcpip.h"
 
+#include "arm9/access_point.h"
 #include "arm9/ipc.h"
 #include "arm9/lwip/lwip_nds.h"
 #include "arm9/wifi_arm9.h"
@@ -67,9 +68,19 @@ static int wifi_update_thread(void *arg)
 
                     // Only update lwIP when we're connected to the access point.
                     sys_check_timeouts();
+
+                    wifi_dns_cache_prefetch();
+                }
+                else if (Wifi_AutoReconnectActive())
+                {
+                    // The ARM7 is trying to restore the connection. Only tell
+                    // lwIP that the link is down, without stopping DHCP.
+                    wifi_netif_set_link_down();
                 }
-                else
+                else if (!Wifi_RoamInProgress())
                 {
+                    // Keep the interface up while switching to a different AP
+                    // so that the IP address and open connections are kept.
                     wifi_netif_set_down();
                 }
             }
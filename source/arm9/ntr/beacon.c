@@ -6,10 +6,12 @@
 
 #include "arm9/ipc.h"
 #include "arm9/wifi_arm9.h"
+#include "arm9/ntr/beacon.h"
 #include "arm9/ntr/rx_tx_queue.h"
 #include "common/common_ntr_defs.h"
 #include "common/ieee_defs.h"
 #include "common/mac_addresses.h"
+#include "common/spinlock.h"
 
 // Access points created by official games acting as multiplayer hosts have no
 // encryption and no BSSID.
@@ -176,6 +178,12 @@ int Wifi_BeaconStart(const char *ssid, u32 game_id)
         return -1;
     }
 
+    // The new beacon is built with the current settings. Discard changes that
+    // were meant for the previous beacon.
+    while (Spinlock_Acquire(WifiData->beaconPatch) != SPINLOCK_OK);
+    WifiData->beaconPatch.dirty = 0;
+    Spinlock_Release(WifiData->beaconPatch);
+
     u32 write_idx = alloc_idx;
 
     u8 *txbufData = (u8 *)WifiData->txbufData;
@@ -222,3 +230,40 @@ int Wifi_BeaconStart(const char *ssid, u32 game_id)
 
     return 0;
 }
+
+void Wifi_BeaconPatchVendorData(size_t offset, const void *src, size_t size)
+{
+    static_assert(sizeof(FieVendorNintendo) <= 64);
+
+    if ((offset + size) > sizeof(FieVendorNintendo))
+        return;
+
+    const u8 *data = src;
+
+    int oldIME = enterCriticalSection();
+    while (Spinlock_Acquire(WifiData->beaconPatch) != SPINLOCK_OK);
+
+    for (size_t i = 0; i < size; i++)
+    {
+        WifiData->beaconPatch.data[offset + i] = data[i];
+        WifiData->beaconPatch.dirty |= 1ULL << (offset + i);
+    }
+
+    Spinlock_Release(WifiData->beaconPatch);
+    leaveCriticalSection(oldIME);
+}
+
+int Wifi_BeaconSetGameId(u32 game_id)
+{
+    if (WifiData->curLibraryMode != DSWIFI_MULTIPLAYER_HOST)
+        return -1;
+
+    u8 data[4] = {
+        (game_id >> 24) & 0xFF, (game_id >> 16) & 0xFF,
+        (game_id >> 8) & 0xFF, (game_id >> 0) & 0xFF
+    };
+
+    Wifi_BeaconPatchVendorData(offsetof(FieVendorNintendo, game_id), data, sizeof(data));
+
+    return 0;
+}
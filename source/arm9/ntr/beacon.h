@@ -5,7 +5,11 @@
 #ifndef WIFI_ARM9_NTR_BEACON_H__
 #define WIFI_ARM9_NTR_BEACON_H__
 
-int Wifi_BeaconStart(const char *ssid);
-void Wifi_BeaconStop(void);
+#include <stddef.h>
+
+// Changes bytes of the Nintendo vendor information of the beacon frame that is
+// being sent by the ARM7. The offset is relative to the start of
+// FieVendorNintendo.
+void Wifi_BeaconPatchVendorData(size_t offset, const void *src, size_t size);
 
 #endif // WIFI_ARM9_NTR_BEACON_H__
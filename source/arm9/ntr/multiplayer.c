@@ -2,6 +2,9 @@
 //
 // Copyright (C) 2025 Antonio Niño Díaz
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <nds.h>
 #include <dswifi9.h>
 
@@ -137,6 +140,1114 @@ bool Wifi_MultiplayerClientMatchesMacAndAID(int aid, const void *macaddr)
     return ret;
 }
 
+// Reliable channel and delta compression
+// ======================================
+
+// Number of calls to Wifi_MultiplayerReliableUpdate() without an ack before a
+// message is sent again.
+#define WIFI_MP_RELIABLE_RESEND_UPDATES 4
+
+// Number of calls to Wifi_MultiplayerReliableUpdate() that an ack can wait for
+// a CMD, REPLY or reliable DATA frame to carry it before it's sent on its own.
+#define WIFI_MP_RELIABLE_ACK_UPDATES    2
+
+typedef struct {
+    const void *data; // Owned by the caller until the message is acknowledged
+    u16 size;
+    u8 seq;
+    u8 age; // Updates since the last time it was transmitted
+    bool used;
+} Wifi_MPReliableTxSlot;
+
+typedef struct {
+    Wifi_MPReliableTxSlot tx[WIFI_MP_RELIABLE_WINDOW];
+    u8 tx_next_seq; // Sequence number of the next new message
+    u8 tx_base_seq; // Oldest message that hasn't been acknowledged
+    u8 rx_next_seq; // Next message to be delivered in order
+    u8 rx_sack; // Bit N set: message rx_next_seq + 1 + N is in the reorder pool
+    u8 ack_age;
+    bool ack_pending;
+    u8 delta_rx_seq; // Last CMD/REPLY payload decoded from this peer
+    u8 delta_tx_acked; // Last CMD/REPLY payload that this peer has decoded
+} Wifi_MPReliablePeer;
+
+// Messages received out of order wait here until the missing ones arrive
+typedef struct {
+    u8 *data;
+    u16 size;
+    u8 aid;
+    u8 seq;
+    bool used;
+} Wifi_MPReorderSlot;
+
+static bool wifi_mp_reliable_enabled = false;
+
+// Hosts use the AID of each client as index. Clients use index 0 for the link
+// with the host.
+static Wifi_MPReliablePeer wifi_mp_reliable_peers[WIFI_MAX_MULTIPLAYER_CLIENTS + 1];
+
+// AID that the client had when the state of its link was last reset
+static u8 wifi_mp_reliable_client_aid;
+
+// Next client to check when adding ack records to CMD frames
+static u8 wifi_mp_reliable_ack_next_aid;
+
+static size_t wifi_mp_reliable_max_size;
+
+static Wifi_MPReorderSlot *wifi_mp_reorder_slots;
+static u8 *wifi_mp_reorder_data;
+static unsigned int wifi_mp_reorder_count;
+
+static WifiReliableRxHandler wifi_mp_reliable_rx_handler;
+static WifiReliableTxDoneHandler wifi_mp_reliable_tx_done_handler;
+
+// Number of CMD/REPLY payloads remembered by each encoder and decoder. The
+// delta of a payload can only be calculated against a payload that the peer
+// has acknowledged and that is still in the history of both sides.
+#define WIFI_MP_DELTA_HISTORY   4
+
+typedef struct {
+    u8 *data; // WIFI_MP_DELTA_HISTORY buffers of the maximum payload size
+    u16 size[WIFI_MP_DELTA_HISTORY];
+    u8 seq[WIFI_MP_DELTA_HISTORY]; // 0 means that the entry is empty
+    u8 pending[WIFI_MP_DELTA_HISTORY]; // Reserved, not in the TX queue yet (encoders only)
+    u8 next; // Entry to be used by the next payload
+    u8 last_seq; // Sequence number of the last payload sent (encoders only)
+} Wifi_MPDeltaHistory;
+
+static bool wifi_mp_delta_enabled = false;
+
+// Hosts use it to encode CMD payloads, clients to decode them
+static Wifi_MPDeltaHistory wifi_mp_delta_cmd;
+
+// Clients use index 0 to encode REPLY payloads. Hosts use the AID of each
+// client as index to decode them.
+static Wifi_MPDeltaHistory wifi_mp_delta_reply[WIFI_MAX_MULTIPLAYER_CLIENTS + 1];
+
+static size_t wifi_mp_delta_cmd_size;
+static size_t wifi_mp_delta_reply_size;
+
+static u8 *wifi_mp_delta_buffer;
+static size_t wifi_mp_delta_buffer_size;
+
+static bool Wifi_MPTransportEnabled(void)
+{
+    return wifi_mp_reliable_enabled || wifi_mp_delta_enabled;
+}
+
+static void Wifi_MPReliablePeerReset(Wifi_MPReliablePeer *peer, int aid)
+{
+    for (int i = 0; i < WIFI_MP_RELIABLE_WINDOW; i++)
+    {
+        Wifi_MPReliableTxSlot *slot = &peer->tx[i];
+
+        if (slot->used && wifi_mp_reliable_tx_done_handler)
+            wifi_mp_reliable_tx_done_handler(aid, slot->data, slot->size, false);
+    }
+
+    for (unsigned int i = 0; i < wifi_mp_reorder_count; i++)
+    {
+        if (wifi_mp_reorder_slots[i].aid == aid)
+            wifi_mp_reorder_slots[i].used = false;
+    }
+
+    memset(peer, 0, sizeof(Wifi_MPReliablePeer));
+}
+
+// Returns the state of the link with the specified peer. On clients the AID is
+// ignored, as the host is the only possible peer.
+static Wifi_MPReliablePeer *Wifi_MPReliableGetPeer(int aid)
+{
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+    {
+        if ((aid < 1) || (aid > WIFI_MAX_MULTIPLAYER_CLIENTS))
+            return NULL;
+
+        return &wifi_mp_reliable_peers[aid];
+    }
+
+    if (WifiData->curLibraryMode != DSWIFI_MULTIPLAYER_CLIENT)
+        return NULL;
+
+    u8 client_aid = WifiData->clients.curClientAID;
+    if (client_aid == 0)
+        return NULL;
+
+    // If we have reconnected to the host, the previous state is meaningless
+    if (client_aid != wifi_mp_reliable_client_aid)
+    {
+        Wifi_MPReliablePeerReset(&wifi_mp_reliable_peers[0], 0);
+        wifi_mp_reliable_client_aid = client_aid;
+    }
+
+    return &wifi_mp_reliable_peers[0];
+}
+
+// AID of the client that owns the link. It's the AID written in ack records.
+static u8 Wifi_MPReliableLinkAID(int aid)
+{
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+        return aid;
+
+    return WifiData->clients.curClientAID;
+}
+
+static size_t Wifi_MPReliableAddAckRecord(u8 *dst, Wifi_MPReliablePeer *peer, u8 link_aid)
+{
+    Wifi_MPAckRecord *rec = (Wifi_MPAckRecord *)dst;
+
+    rec->aid = link_aid;
+    rec->next_seq = peer->rx_next_seq;
+    rec->sack = peer->rx_sack;
+    rec->delta_seq = peer->delta_rx_seq;
+
+    peer->ack_pending = false;
+    peer->ack_age = 0;
+
+    return sizeof(Wifi_MPAckRecord);
+}
+
+// Builds a transport header in "dst" with as many pending acks as fit in
+// "room" bytes. If "aid" is -1 (host frames sent to more than one client) it
+// adds acks for any client in "aid_mask" that needs them. This must be called
+// with interrupts disabled.
+static size_t Wifi_MPReliableBuildHeader(u8 *dst, size_t room, int aid, u16 aid_mask,
+                                         u8 flags, u8 seq)
+{
+    Wifi_MPTransportHeader *hdr = (Wifi_MPTransportHeader *)dst;
+
+    hdr->flags = flags;
+    hdr->seq = seq;
+    hdr->num_acks = 0;
+    hdr->delta_base = 0;
+
+    size_t size = sizeof(Wifi_MPTransportHeader);
+
+    if (aid == -1)
+    {
+        for (int i = 0; i < WIFI_MAX_MULTIPLAYER_CLIENTS; i++)
+        {
+            if (size + sizeof(Wifi_MPAckRecord) > room)
+                break;
+
+            // Start where the previous frame stopped so that all clients get
+            // their acks even if the frame is too small to fit all of them.
+            int client_aid = 1 + ((wifi_mp_reliable_ack_next_aid + i)
+                                  % WIFI_MAX_MULTIPLAYER_CLIENTS);
+
+            // Clients that aren't addressed by the frame won't see the ack
+            if ((aid_mask & BIT(client_aid)) == 0)
+                continue;
+
+            Wifi_MPReliablePeer *peer = &wifi_mp_reliable_peers[client_aid];
+            if (!peer->ack_pending)
+                continue;
+
+            size += Wifi_MPReliableAddAckRecord(dst + size, peer, client_aid);
+            hdr->num_acks++;
+
+            wifi_mp_reliable_ack_next_aid = client_aid % WIFI_MAX_MULTIPLAYER_CLIENTS;
+        }
+    }
+    else
+    {
+        Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(aid);
+
+        if ((peer != NULL) && peer->ack_pending &&
+            (size + sizeof(Wifi_MPAckRecord) <= room))
+        {
+            size += Wifi_MPReliableAddAckRecord(dst + size, peer,
+                                                Wifi_MPReliableLinkAID(aid));
+            hdr->num_acks++;
+        }
+    }
+
+    return size;
+}
+
+static u8 *Wifi_MPDeltaFind(Wifi_MPDeltaHistory *hist, size_t max_size, u8 seq,
+                            size_t *size)
+{
+    if (seq == 0)
+        return NULL;
+
+    for (int i = 0; i < WIFI_MP_DELTA_HISTORY; i++)
+    {
+        if (hist->seq[i] == seq)
+        {
+            *size = hist->size[i];
+            return hist->data + i * max_size;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the entry of the history where the next payload has to be stored.
+// It never returns the entry that holds the base of the delta.
+static int Wifi_MPDeltaNextEntry(Wifi_MPDeltaHistory *hist, const u8 *base,
+                                 size_t max_size)
+{
+    int entry = hist->next;
+
+    if ((base != NULL) && (hist->data + entry * max_size == base))
+        entry = (entry + 1) % WIFI_MP_DELTA_HISTORY;
+
+    hist->next = (entry + 1) % WIFI_MP_DELTA_HISTORY;
+
+    return entry;
+}
+
+// The delta is the XOR of the payload and its base (the base is considered to
+// be padded with zeroes if it's shorter). It's stored as a sequence of blocks.
+// If bit 7 of the first byte of a block is set, the block represents a run of
+// (N & 0x7F) + 1 zeroes. If not, it's followed by N + 1 bytes to be copied.
+//
+// It returns the size of the encoded delta, or -1 if it doesn't fit in
+// "dst_size" bytes.
+static int Wifi_MPDeltaEncode(u8 *dst, size_t dst_size, const u8 *src, size_t size,
+                              const u8 *base, size_t base_size)
+{
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        size_t zeroes = 0;
+        while ((i + zeroes < size) && (zeroes < 128))
+        {
+            u8 b = src[i + zeroes] ^ ((i + zeroes < base_size) ? base[i + zeroes] : 0);
+            if (b != 0)
+                break;
+            zeroes++;
+        }
+
+        // A single zero costs the same inside a block of bytes to be copied,
+        // and it may avoid starting a new block.
+        if ((zeroes > 1) || ((zeroes == 1) && (i + 1 == size)))
+        {
+            if (out + 1 > dst_size)
+                return -1;
+
+            dst[out++] = 0x80 | (zeroes - 1);
+            i += zeroes;
+            continue;
+        }
+
+        size_t ctrl = out++;
+        size_t count = 0;
+
+        while ((i < size) && (count < 128))
+        {
+            // Stop if a run of zeroes starts here
+            if ((i + 1 < size) &&
+                ((src[i] ^ ((i < base_size) ? base[i] : 0)) == 0) &&
+                ((src[i + 1] ^ ((i + 1 < base_size) ? base[i + 1] : 0)) == 0))
+                break;
+
+            if (out + 1 > dst_size)
+                return -1;
+
+            dst[out++] = src[i] ^ ((i < base_size) ? base[i] : 0);
+            i++;
+            count++;
+        }
+
+        if (ctrl >= dst_size)
+            return -1;
+
+        dst[ctrl] = count - 1;
+    }
+
+    return out;
+}
+
+// It returns the size of the decoded payload, or -1 if the delta is invalid.
+static int Wifi_MPDeltaDecode(u8 *dst, size_t dst_size, const u8 *src, size_t size,
+                              const u8 *base, size_t base_size)
+{
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < size)
+    {
+        u8 ctrl = src[i++];
+        size_t count = (ctrl & 0x7F) + 1;
+
+        if (out + count > dst_size)
+            return -1;
+
+        if (ctrl & 0x80)
+        {
+            for (size_t j = 0; j < count; j++, out++)
+                dst[out] = (out < base_size) ? base[out] : 0;
+        }
+        else
+        {
+            if (i + count > size)
+                return -1;
+
+            for (size_t j = 0; j < count; j++, out++)
+                dst[out] = src[i++] ^ ((out < base_size) ? base[out] : 0);
+        }
+    }
+
+    return out;
+}
+
+// Looks for the most recent payload that all peers have acknowledged. It
+// returns 0 if a keyframe is needed. This must be called with interrupts
+// disabled.
+static u8 Wifi_MPDeltaChooseBase(Wifi_MPPacketType type)
+{
+    if (type == WIFI_MPTYPE_REPLY)
+    {
+        Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(0);
+        if (peer == NULL)
+            return 0;
+
+        return peer->delta_tx_acked;
+    }
+
+    u16 mask = WifiData->clients.aid_mask;
+    u8 last_seq = wifi_mp_delta_cmd.last_seq;
+
+    u8 base = 0;
+    u8 base_age = 0;
+
+    for (int aid = 1; aid <= WIFI_MAX_MULTIPLAYER_CLIENTS; aid++)
+    {
+        Wifi_MPReliablePeer *peer = &wifi_mp_reliable_peers[aid];
+
+        // Forget the state of clients that have left
+        if ((mask & BIT(aid)) == 0)
+        {
+            peer->delta_tx_acked = 0;
+            peer->delta_rx_seq = 0;
+            memset(wifi_mp_delta_reply[aid].seq, 0, sizeof(wifi_mp_delta_reply[aid].seq));
+            continue;
+        }
+
+        // New clients need a keyframe
+        if (peer->delta_tx_acked == 0)
+            return 0;
+
+        u8 age = last_seq - peer->delta_tx_acked;
+        if ((base == 0) || (age > base_age))
+        {
+            base = peer->delta_tx_acked;
+            base_age = age;
+        }
+    }
+
+    // Payloads that are too old aren't in the history of the peers anymore
+    if (base_age >= WIFI_MP_DELTA_HISTORY)
+        return 0;
+
+    return base;
+}
+
+// Replaces the CMD/REPLY payload by its delta if that makes it smaller. It
+// returns the flags of the transport header. The sequence number and the entry
+// of the history are reserved here so that frames prepared before this one is
+// added to the TX queue (from an interrupt handler, for example) get different
+// ones. The entry can't be used as base until Wifi_MultiplayerTransportCommit()
+// is called. This must be called with interrupts disabled.
+static u8 Wifi_MPDeltaPrepare(Wifi_MPPacketType type, const void **data_src,
+                              size_t *data_size, void *scratch, size_t scratch_size,
+                              u8 *seq, u8 *delta_base)
+{
+    Wifi_MPDeltaHistory *hist;
+    size_t max_size;
+
+    if (type == WIFI_MPTYPE_CMD)
+    {
+        hist = &wifi_mp_delta_cmd;
+        max_size = wifi_mp_delta_cmd_size;
+    }
+    else
+    {
+        hist = &wifi_mp_delta_reply[0];
+        max_size = wifi_mp_delta_reply_size;
+    }
+
+    // Payloads that don't fit in the history are sent as they are
+    if ((*data_size == 0) || (*data_size > max_size))
+        return 0;
+
+    u8 base_seq = Wifi_MPDeltaChooseBase(type);
+
+    size_t base_size = 0;
+    const u8 *base = Wifi_MPDeltaFind(hist, max_size, base_seq, &base_size);
+
+    *seq = hist->last_seq + 1;
+    if (*seq == 0)
+        *seq = 1;
+
+    hist->last_seq = *seq;
+
+    int entry = Wifi_MPDeltaNextEntry(hist, base, max_size);
+
+    hist->seq[entry] = 0;
+    hist->pending[entry] = *seq;
+    hist->size[entry] = *data_size;
+    memcpy(hist->data + entry * max_size, *data_src, *data_size);
+
+    if (base == NULL)
+        return WIFI_MP_TRANSPORT_KEYFRAME;
+
+    // Only use the delta if it's smaller than the original payload
+    size_t room = *data_size - 1;
+    if (room > scratch_size)
+        room = scratch_size;
+
+    int size = Wifi_MPDeltaEncode(scratch, room, *data_src, *data_size, base, base_size);
+    if (size < 0)
+        return WIFI_MP_TRANSPORT_KEYFRAME;
+
+    *data_src = scratch;
+    *data_size = size;
+    *delta_base = base_seq;
+
+    return WIFI_MP_TRANSPORT_DELTA;
+}
+
+// Stores a keyframe in the history of the decoder, or decodes a delta and
+// stores the result. It returns true if the payload needs to be passed to the
+// packet handler, and it updates "data" and "size" to point to the decoded
+// payload. This must be called with interrupts disabled.
+static bool Wifi_MPDeltaReceive(Wifi_MPReliablePeer *peer, int aid,
+                                const Wifi_MPTransportHeader *hdr,
+                                const u8 **data, size_t *size)
+{
+    Wifi_MPDeltaHistory *hist;
+    size_t max_size;
+
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+    {
+        hist = &wifi_mp_delta_reply[aid];
+        max_size = wifi_mp_delta_reply_size;
+    }
+    else
+    {
+        hist = &wifi_mp_delta_cmd;
+        max_size = wifi_mp_delta_cmd_size;
+    }
+
+    size_t base_size = 0;
+    const u8 *base = NULL;
+
+    if (hdr->flags & WIFI_MP_TRANSPORT_DELTA)
+    {
+        base = Wifi_MPDeltaFind(hist, max_size, hdr->delta_base, &base_size);
+        if (base == NULL)
+            goto error;
+    }
+    else if (*size > max_size)
+    {
+        goto error;
+    }
+
+    int entry = Wifi_MPDeltaNextEntry(hist, base, max_size);
+    u8 *dst = hist->data + entry * max_size;
+
+    int dst_size;
+
+    if (base != NULL)
+    {
+        dst_size = Wifi_MPDeltaDecode(dst, max_size, *data, *size, base, base_size);
+        if (dst_size <= 0)
+        {
+            hist->seq[entry] = 0;
+            goto error;
+        }
+    }
+    else
+    {
+        memcpy(dst, *data, *size);
+        dst_size = *size;
+    }
+
+    hist->seq[entry] = hdr->seq;
+    hist->size[entry] = dst_size;
+
+    peer->delta_rx_seq = hdr->seq;
+    peer->ack_pending = true;
+
+    *data = dst;
+    *size = dst_size;
+
+    return true;
+
+error:
+    // Ask the peer for a keyframe
+    peer->delta_rx_seq = 0;
+    peer->ack_pending = true;
+    return false;
+}
+
+int Wifi_MultiplayerTransportPrepare(Wifi_MPPacketType type, int aid, u16 aid_mask,
+                                     void *hdr, const void **data_src, size_t *data_size,
+                                     void *scratch, size_t scratch_size)
+{
+    if (!Wifi_MPTransportEnabled())
+        return 0;
+
+    // Space available for user data in frames with a fixed size
+    int room;
+
+    if (type == WIFI_MPTYPE_CMD)
+    {
+        // IEEE header, client time, client bits, user data, FCS
+        room = WifiData->curCmdDataSize - (HDR_DATA_MAC_SIZE + 2 + 2 + 4);
+        aid = -1;
+        aid_mask = WifiData->clients.aid_mask;
+    }
+    else if (type == WIFI_MPTYPE_REPLY)
+    {
+        // IEEE header, client AID, user data, FCS
+        room = WifiData->curReplyDataSize - (HDR_DATA_MAC_SIZE + 1 + 4);
+    }
+    else
+    {
+        room = *data_size + WIFI_MP_TRANSPORT_MAX_HEADER_SIZE;
+    }
+
+    int oldIME = enterCriticalSection();
+
+    u8 flags = 0;
+    u8 seq = 0;
+    u8 delta_base = 0;
+
+    if (wifi_mp_delta_enabled && (type != WIFI_MPTYPE_DATA))
+    {
+        flags = Wifi_MPDeltaPrepare(type, data_src, data_size, scratch,
+                                    scratch_size, &seq, &delta_base);
+    }
+
+    room -= *data_size;
+    if (room < (int)sizeof(Wifi_MPTransportHeader))
+    {
+        leaveCriticalSection(oldIME);
+        return -1;
+    }
+
+    int size = Wifi_MPReliableBuildHeader(hdr, room, aid, aid_mask, flags, seq);
+
+    ((Wifi_MPTransportHeader *)hdr)->delta_base = delta_base;
+
+    leaveCriticalSection(oldIME);
+
+    return size;
+}
+
+void Wifi_MultiplayerTransportCommit(Wifi_MPPacketType type, const void *hdr,
+                                     size_t hdr_size)
+{
+    if ((hdr_size < sizeof(Wifi_MPTransportHeader)) || (type == WIFI_MPTYPE_DATA))
+        return;
+
+    const Wifi_MPTransportHeader *h = hdr;
+
+    if ((h->flags & (WIFI_MP_TRANSPORT_KEYFRAME | WIFI_MP_TRANSPORT_DELTA)) == 0)
+        return;
+
+    int oldIME = enterCriticalSection();
+
+    // The history may have been freed after the header was prepared
+    if (wifi_mp_delta_enabled)
+    {
+        Wifi_MPDeltaHistory *hist = (type == WIFI_MPTYPE_CMD) ?
+                                    &wifi_mp_delta_cmd : &wifi_mp_delta_reply[0];
+
+        // If the entry has been reserved again by a more recent frame it isn't
+        // there anymore, and nothing needs to be done.
+        for (int i = 0; i < WIFI_MP_DELTA_HISTORY; i++)
+        {
+            if (hist->pending[i] == h->seq)
+            {
+                hist->seq[i] = h->seq;
+                hist->pending[i] = 0;
+                break;
+            }
+        }
+    }
+
+    leaveCriticalSection(oldIME);
+}
+
+static int Wifi_MPReliableSendFrame(int aid, u8 flags, u8 seq, const void *data, size_t size)
+{
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    size_t hdr_size = Wifi_MPReliableBuildHeader(hdr, sizeof(hdr), aid, 0, flags, seq);
+
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+        return Wifi_MultiplayerHostToClientDataTxFrameParts(aid, hdr, hdr_size, data, size);
+    else
+        return Wifi_MultiplayerClientToHostDataTxFrameParts(hdr, hdr_size, data, size);
+}
+
+static void Wifi_MPReliableProcessAck(Wifi_MPReliablePeer *peer, int aid,
+                                      const Wifi_MPAckRecord *rec)
+{
+    u8 in_flight = peer->tx_next_seq - peer->tx_base_seq;
+    u8 acked = rec->next_seq - peer->tx_base_seq;
+
+    // Ignore acks that refer to messages that haven't been sent yet
+    if (acked > in_flight)
+        return;
+
+    for (int i = 0; i < WIFI_MP_RELIABLE_WINDOW; i++)
+    {
+        Wifi_MPReliableTxSlot *slot = &peer->tx[i];
+
+        if (!slot->used)
+            continue;
+
+        bool done = (u8)(slot->seq - peer->tx_base_seq) < acked;
+        if (!done)
+        {
+            u8 ahead = slot->seq - rec->next_seq;
+            if ((ahead >= 1) && (ahead <= WIFI_MP_RELIABLE_WINDOW) &&
+                (rec->sack & BIT(ahead - 1)))
+                done = true;
+        }
+
+        if (!done)
+            continue;
+
+        slot->used = false;
+
+        if (wifi_mp_reliable_tx_done_handler)
+            wifi_mp_reliable_tx_done_handler(aid, slot->data, slot->size, true);
+    }
+
+    while (peer->tx_base_seq != peer->tx_next_seq)
+    {
+        if (peer->tx[peer->tx_base_seq % WIFI_MP_RELIABLE_WINDOW].used)
+            break;
+
+        peer->tx_base_seq++;
+    }
+}
+
+static Wifi_MPReorderSlot *Wifi_MPReorderFind(int aid, u8 seq)
+{
+    for (unsigned int i = 0; i < wifi_mp_reorder_count; i++)
+    {
+        Wifi_MPReorderSlot *slot = &wifi_mp_reorder_slots[i];
+
+        if (slot->used && (slot->aid == aid) && (slot->seq == seq))
+            return slot;
+    }
+
+    return NULL;
+}
+
+static void Wifi_MPReliableReceive(Wifi_MPReliablePeer *peer, int aid, u8 seq,
+                                   const u8 *data, size_t size)
+{
+    // Acknowledge duplicates too, the previous ack may have been lost
+    peer->ack_pending = true;
+
+    u8 ahead = seq - peer->rx_next_seq;
+
+    if (ahead == 0)
+    {
+        // Messages received in order are passed to the handler straight from
+        // the RX buffer.
+        wifi_mp_reliable_rx_handler(aid, data, size);
+        peer->rx_next_seq++;
+
+        // Deliver any message that was waiting for this one
+        while (peer->rx_sack & 1)
+        {
+            Wifi_MPReorderSlot *slot = Wifi_MPReorderFind(aid, peer->rx_next_seq);
+            if (slot != NULL)
+            {
+                wifi_mp_reliable_rx_handler(aid, slot->data, slot->size);
+                slot->used = false;
+            }
+
+            peer->rx_next_seq++;
+            peer->rx_sack >>= 1;
+        }
+
+        // Now bit 0 refers to the message after rx_next_seq again
+        peer->rx_sack >>= 1;
+    }
+    else if (ahead <= WIFI_MP_RELIABLE_WINDOW)
+    {
+        if (peer->rx_sack & BIT(ahead - 1))
+            return; // Duplicate
+
+        if (size > wifi_mp_reliable_max_size)
+            return;
+
+        // If there is no space to remember it, drop it without acknowledging
+        // it. The sender will send it again later.
+        for (unsigned int i = 0; i < wifi_mp_reorder_count; i++)
+        {
+            Wifi_MPReorderSlot *slot = &wifi_mp_reorder_slots[i];
+
+            if (slot->used)
+                continue;
+
+            memcpy(slot->data, data, size);
+            slot->size = size;
+            slot->aid = aid;
+            slot->seq = seq;
+            slot->used = true;
+
+            peer->rx_sack |= BIT(ahead - 1);
+            break;
+        }
+    }
+    else
+    {
+        // This is an old message that has already been delivered
+    }
+}
+
+// Processes the transport header of a received frame. It returns true if the
+// rest of the frame needs to be passed to the user packet handler, and it
+// updates "data" and "size" to point to the user data.
+static bool Wifi_MultiplayerTransportReceive(Wifi_MPPacketType type, int aid,
+                                             const u8 **data, size_t *size)
+{
+    if (!Wifi_MPTransportEnabled())
+        return true;
+
+    if (*size < sizeof(Wifi_MPTransportHeader))
+        return false;
+
+    const Wifi_MPTransportHeader *hdr = (const void *)*data;
+
+    size_t hdr_size = sizeof(Wifi_MPTransportHeader)
+                    + hdr->num_acks * sizeof(Wifi_MPAckRecord);
+    if (*size < hdr_size)
+        return false;
+
+    Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(aid);
+    if (peer == NULL)
+        return false;
+
+    u8 link_aid = Wifi_MPReliableLinkAID(aid);
+
+    const Wifi_MPAckRecord *rec = (const void *)(*data + sizeof(Wifi_MPTransportHeader));
+
+    for (int i = 0; i < hdr->num_acks; i++)
+    {
+        // CMD frames carry acks for all clients, skip the ones of other clients
+        if (rec[i].aid != link_aid)
+            continue;
+
+        if (wifi_mp_reliable_enabled)
+            Wifi_MPReliableProcessAck(peer, aid, &rec[i]);
+
+        if (wifi_mp_delta_enabled)
+            peer->delta_tx_acked = rec[i].delta_seq;
+    }
+
+    const u8 *payload = *data + hdr_size;
+    size_t payload_size = *size - hdr_size;
+
+    if (hdr->flags & WIFI_MP_TRANSPORT_RELIABLE)
+    {
+        if (wifi_mp_reliable_enabled && (type == WIFI_MPTYPE_DATA))
+            Wifi_MPReliableReceive(peer, aid, hdr->seq, payload, payload_size);
+        return false;
+    }
+
+    if (hdr->flags & WIFI_MP_TRANSPORT_ACK_ONLY)
+        return false;
+
+    *data = payload;
+    *size = payload_size;
+
+    if ((hdr->flags & (WIFI_MP_TRANSPORT_KEYFRAME | WIFI_MP_TRANSPORT_DELTA)) &&
+        (type != WIFI_MPTYPE_DATA))
+    {
+        // Deltas can't be decoded without the base, drop them
+        if (!wifi_mp_delta_enabled)
+            return (hdr->flags & WIFI_MP_TRANSPORT_DELTA) == 0;
+
+        return Wifi_MPDeltaReceive(peer, aid, hdr, data, size);
+    }
+
+    return true;
+}
+
+int Wifi_MultiplayerReliableInit(size_t max_size, unsigned int reorder_slots,
+                                 WifiReliableRxHandler rx_handler,
+                                 WifiReliableTxDoneHandler tx_done_handler)
+{
+    if ((max_size == 0) || (max_size > WIFI_MP_RELIABLE_MAX_SIZE))
+        return -1;
+
+    if (rx_handler == NULL)
+        return -1;
+
+    Wifi_MultiplayerReliableDeinit();
+
+    if (reorder_slots > 0)
+    {
+        wifi_mp_reorder_slots = calloc(reorder_slots, sizeof(Wifi_MPReorderSlot));
+        wifi_mp_reorder_data = malloc(reorder_slots * max_size);
+
+        if ((wifi_mp_reorder_slots == NULL) || (wifi_mp_reorder_data == NULL))
+        {
+            free(wifi_mp_reorder_slots);
+            free(wifi_mp_reorder_data);
+            wifi_mp_reorder_slots = NULL;
+            wifi_mp_reorder_data = NULL;
+            return -1;
+        }
+
+        for (unsigned int i = 0; i < reorder_slots; i++)
+            wifi_mp_reorder_slots[i].data = wifi_mp_reorder_data + i * max_size;
+    }
+
+    int oldIME = enterCriticalSection();
+
+    memset(wifi_mp_reliable_peers, 0, sizeof(wifi_mp_reliable_peers));
+    wifi_mp_reliable_client_aid = 0;
+    wifi_mp_reliable_ack_next_aid = 0;
+
+    wifi_mp_reliable_max_size = max_size;
+    wifi_mp_reorder_count = reorder_slots;
+
+    wifi_mp_reliable_rx_handler = rx_handler;
+    wifi_mp_reliable_tx_done_handler = tx_done_handler;
+
+    wifi_mp_reliable_enabled = true;
+
+    leaveCriticalSection(oldIME);
+
+    return 0;
+}
+
+void Wifi_MultiplayerReliableDeinit(void)
+{
+    int oldIME = enterCriticalSection();
+
+    if (wifi_mp_reliable_enabled)
+    {
+        // Give all buffers back to the caller
+        for (int i = 0; i <= WIFI_MAX_MULTIPLAYER_CLIENTS; i++)
+            Wifi_MPReliablePeerReset(&wifi_mp_reliable_peers[i], i);
+    }
+
+    wifi_mp_reliable_enabled = false;
+
+    wifi_mp_reorder_count = 0;
+
+    leaveCriticalSection(oldIME);
+
+    free(wifi_mp_reorder_slots);
+    free(wifi_mp_reorder_data);
+    wifi_mp_reorder_slots = NULL;
+    wifi_mp_reorder_data = NULL;
+}
+
+int Wifi_MultiplayerReliableSend(int aid, const void *data, size_t size)
+{
+    if (!wifi_mp_reliable_enabled)
+        return -1;
+
+    if ((data == NULL) || (size == 0) || (size > wifi_mp_reliable_max_size))
+        return -1;
+
+    int oldIME = enterCriticalSection();
+
+    Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(aid);
+    if (peer == NULL)
+    {
+        leaveCriticalSection(oldIME);
+        return -1;
+    }
+
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_CLIENT)
+        aid = 0;
+
+    // The window is full, the caller needs to wait for some acks
+    if ((u8)(peer->tx_next_seq - peer->tx_base_seq) >= WIFI_MP_RELIABLE_WINDOW)
+    {
+        leaveCriticalSection(oldIME);
+        return -1;
+    }
+
+    Wifi_MPReliableTxSlot *slot = &peer->tx[peer->tx_next_seq % WIFI_MP_RELIABLE_WINDOW];
+
+    slot->data = data;
+    slot->size = size;
+    slot->seq = peer->tx_next_seq++;
+    slot->age = 0;
+    slot->used = true;
+
+    // If the TX buffer is full, try again in the next update
+    if (Wifi_MPReliableSendFrame(aid, WIFI_MP_TRANSPORT_RELIABLE, slot->seq,
+                                 data, size) != 0)
+        slot->age = WIFI_MP_RELIABLE_RESEND_UPDATES - 1;
+
+    leaveCriticalSection(oldIME);
+
+    return 0;
+}
+
+int Wifi_MultiplayerReliableFreeSlots(int aid)
+{
+    if (!wifi_mp_reliable_enabled)
+        return -1;
+
+    int oldIME = enterCriticalSection();
+
+    Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(aid);
+
+    int ret = -1;
+    if (peer != NULL)
+        ret = WIFI_MP_RELIABLE_WINDOW - (u8)(peer->tx_next_seq - peer->tx_base_seq);
+
+    leaveCriticalSection(oldIME);
+
+    return ret;
+}
+
+static void Wifi_MPReliableUpdatePeer(Wifi_MPReliablePeer *peer, int aid)
+{
+    // Only messages that haven't been acknowledged are still in the window, so
+    // this only sends the ones that the peer is missing.
+    for (int i = 0; i < WIFI_MP_RELIABLE_WINDOW; i++)
+    {
+        Wifi_MPReliableTxSlot *slot = &peer->tx[i];
+
+        if (!slot->used)
+            continue;
+
+        if (++slot->age < WIFI_MP_RELIABLE_RESEND_UPDATES)
+            continue;
+
+        if (Wifi_MPReliableSendFrame(aid, WIFI_MP_TRANSPORT_RELIABLE, slot->seq,
+                                     slot->data, slot->size) == 0)
+            slot->age = 0;
+    }
+
+    if (peer->ack_pending)
+    {
+        if (++peer->ack_age >= WIFI_MP_RELIABLE_ACK_UPDATES)
+            Wifi_MPReliableSendFrame(aid, WIFI_MP_TRANSPORT_ACK_ONLY, 0, NULL, 0);
+    }
+}
+
+void Wifi_MultiplayerReliableUpdate(void)
+{
+    if (!wifi_mp_reliable_enabled)
+        return;
+
+    int oldIME = enterCriticalSection();
+
+    if (WifiData->curLibraryMode == DSWIFI_MULTIPLAYER_HOST)
+    {
+        u16 mask = WifiData->clients.aid_mask;
+
+        for (int aid = 1; aid <= WIFI_MAX_MULTIPLAYER_CLIENTS; aid++)
+        {
+            Wifi_MPReliablePeer *peer = &wifi_mp_reliable_peers[aid];
+
+            // Forget the state of clients that have left
+            if ((mask & BIT(aid)) == 0)
+            {
+                if ((peer->tx_next_seq != 0) || (peer->rx_next_seq != 0) ||
+                    (peer->tx_base_seq != 0) || peer->ack_pending)
+                    Wifi_MPReliablePeerReset(peer, aid);
+                continue;
+            }
+
+            Wifi_MPReliableUpdatePeer(peer, aid);
+        }
+    }
+    else
+    {
+        Wifi_MPReliablePeer *peer = Wifi_MPReliableGetPeer(0);
+        if (peer != NULL)
+            Wifi_MPReliableUpdatePeer(peer, 0);
+    }
+
+    leaveCriticalSection(oldIME);
+}
+
+int Wifi_MultiplayerDeltaInit(size_t cmd_size, size_t reply_size)
+{
+    if ((cmd_size == 0) || (cmd_size > MAC_CMDBUF_SIZE))
+        return -1;
+
+    if ((reply_size == 0) || (reply_size > MAC_CLIENT_RX_SIZE))
+        return -1;
+
+    Wifi_MultiplayerDeltaDeinit();
+
+    size_t cmd_total = WIFI_MP_DELTA_HISTORY * cmd_size;
+    size_t reply_total = WIFI_MP_DELTA_HISTORY * reply_size;
+
+    size_t total = cmd_total + (WIFI_MAX_MULTIPLAYER_CLIENTS + 1) * reply_total;
+
+    u8 *buffer = malloc(total);
+    if (buffer == NULL)
+        return -1;
+
+    int oldIME = enterCriticalSection();
+
+    wifi_mp_delta_buffer = buffer;
+    wifi_mp_delta_buffer_size = total;
+    wifi_mp_delta_cmd_size = cmd_size;
+    wifi_mp_delta_reply_size = reply_size;
+
+    memset(&wifi_mp_delta_cmd, 0, sizeof(wifi_mp_delta_cmd));
+    wifi_mp_delta_cmd.data = buffer;
+
+    for (int i = 0; i <= WIFI_MAX_MULTIPLAYER_CLIENTS; i++)
+    {
+        memset(&wifi_mp_delta_reply[i], 0, sizeof(wifi_mp_delta_reply[i]));
+        wifi_mp_delta_reply[i].data = buffer + cmd_total + i * reply_total;
+
+        // Start with keyframes in both directions
+        wifi_mp_reliable_peers[i].delta_rx_seq = 0;
+        wifi_mp_reliable_peers[i].delta_tx_acked = 0;
+    }
+
+    wifi_mp_delta_enabled = true;
+
+    leaveCriticalSection(oldIME);
+
+    return 0;
+}
+
+void Wifi_MultiplayerDeltaDeinit(void)
+{
+    int oldIME = enterCriticalSection();
+
+    wifi_mp_delta_enabled = false;
+
+    u8 *buffer = wifi_mp_delta_buffer;
+    wifi_mp_delta_buffer = NULL;
+    wifi_mp_delta_buffer_size = 0;
+
+    leaveCriticalSection(oldIME);
+
+    free(buffer);
+}
+
+bool Wifi_MultiplayerDeltaContains(u32 address, u32 size)
+{
+    u32 start = (u32)wifi_mp_delta_buffer;
+    u32 end = start + wifi_mp_delta_buffer_size;
+
+    if (wifi_mp_delta_buffer == NULL)
+        return false;
+
+    return (address >= start) && (address <= end) && (size <= end - address);
+}
+
 // Multiplayer mode packet handlers
 // ================================
 
@@ -155,7 +1266,7 @@ void Wifi_MultiplayerFromClientSetPacketHandler(WifiFromClientPacketHandler func
 
 void Wifi_MultiplayerHandlePacketFromClient(const u8 *packet, size_t size)
 {
-    if (wifi_from_client_packet_handler == NULL)
+    if ((wifi_from_client_packet_handler == NULL) && !Wifi_MPTransportEnabled())
         return;
 
     if (size < sizeof(MultiplayerClientIeeeDataFrame))
@@ -201,13 +1312,21 @@ void Wifi_MultiplayerHandlePacketFromClient(const u8 *packet, size_t size)
     if (!Wifi_MultiplayerClientMatchesMacAndAID(aid, ieee->addr_2))
         return;
 
-    (*wifi_from_client_packet_handler)(type, aid, (u32)(packet + header_size),
-                                       size - header_size);
+    const u8 *data = packet + header_size;
+    size_t data_size = size - header_size;
+
+    if (!Wifi_MultiplayerTransportReceive(type, aid, &data, &data_size))
+        return;
+
+    if (wifi_from_client_packet_handler == NULL)
+        return;
+
+    (*wifi_from_client_packet_handler)(type, aid, (u32)data, data_size);
 }
 
 void Wifi_MultiplayerHandlePacketFromHost(const u8 *packet, size_t size)
 {
-    if (wifi_from_host_packet_handler == NULL)
+    if ((wifi_from_host_packet_handler == NULL) && !Wifi_MPTransportEnabled())
         return;
 
     if (size < sizeof(MultiplayerHostIeeeDataFrame))
@@ -246,15 +1365,30 @@ void Wifi_MultiplayerHandlePacketFromHost(const u8 *packet, size_t size)
     {
         header_size = sizeof(IEEE_DataFrameHeader);
 
-        // Check if it was sent to us
+        // Check if it was sent to us, or to a group of clients that includes us
         if (Wifi_CmpMacAddr(ieee->addr_1, WifiData->MacAddr) == 0)
-            return;
+        {
+            if ((ieee->addr_1[0] != wifi_group_data_mac[0]) ||
+                (ieee->addr_1[1] != wifi_group_data_mac[1]))
+                return;
+
+            if ((ieee->addr_1[2] & BIT(WifiData->clients.curClientAID)) == 0)
+                return;
+        }
     }
 
     // Check that the source MAC is the BSSID we're connected to
     if (Wifi_CmpMacAddr(ieee->addr_3, WifiData->curAp.bssid) == 0)
         return;
 
-    (*wifi_from_host_packet_handler)(type, (u32)(packet + header_size),
-                                     size - header_size);
+    const u8 *data = packet + header_size;
+    size_t data_size = size - header_size;
+
+    if (!Wifi_MultiplayerTransportReceive(type, 0, &data, &data_size))
+        return;
+
+    if (wifi_from_host_packet_handler == NULL)
+        return;
+
+    (*wifi_from_host_packet_handler)(type, (u32)data, data_size);
 }
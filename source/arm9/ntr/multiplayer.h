@@ -5,6 +5,7 @@
 #ifndef DSWIFI_ARM9_NTR_MULTIPLAYER_H__
 #define DSWIFI_ARM9_NTR_MULTIPLAYER_H__
 
+#include <dswifi9.h>
 #include <dswifi_common.h>
 
 #include "common/common_ntr_defs.h"
@@ -50,6 +51,34 @@ typedef struct {
     u8 body[0];
 } MultiplayerClientIeeeDataFrame;
 
+// Header added to the start of the user data of all multiplayer frames while
+// the reliable channel or delta compression are enabled. It's followed by
+// "num_acks" ack records. Everything is stored as bytes because the user data
+// of REPLY frames isn't aligned.
+
+#define WIFI_MP_TRANSPORT_RELIABLE  BIT(0) // The frame carries a reliable message
+#define WIFI_MP_TRANSPORT_ACK_ONLY  BIT(1) // Only acks, no user data
+#define WIFI_MP_TRANSPORT_KEYFRAME  BIT(2) // Full CMD/REPLY payload to be used as base
+#define WIFI_MP_TRANSPORT_DELTA     BIT(3) // CMD/REPLY payload encoded as a delta
+
+typedef struct {
+    u8 flags;
+    u8 seq; // Sequence number of the reliable message or CMD/REPLY payload
+    u8 num_acks;
+    u8 delta_base; // Sequence number of the payload used as base of the delta
+} Wifi_MPTransportHeader;
+
+typedef struct {
+    u8 aid; // AID of the client of the link this record refers to
+    u8 next_seq; // All messages before this one have been received
+    u8 sack; // Bit N set: message next_seq + 1 + N has been received
+    u8 delta_seq; // Last CMD/REPLY payload decoded (0 if a keyframe is needed)
+} Wifi_MPAckRecord;
+
+#define WIFI_MP_TRANSPORT_MAX_HEADER_SIZE \
+    (sizeof(Wifi_MPTransportHeader) + \
+     WIFI_MAX_MULTIPLAYER_CLIENTS * sizeof(Wifi_MPAckRecord))
+
 bool Wifi_MultiplayerClientGetMacFromAID(int aid, void *dest_macaddr);
 bool Wifi_MultiplayerClientMatchesMacAndAID(int aid, const void *macaddr);
 
@@ -59,4 +88,39 @@ bool Wifi_MultiplayerClientMatchesMacAndAID(int aid, const void *macaddr);
 void Wifi_MultiplayerHandlePacketFromClient(const u8 *packet, size_t size);
 void Wifi_MultiplayerHandlePacketFromHost(const u8 *packet, size_t size);
 
+// Fills the transport header that needs to go before the user data in a
+// multiplayer frame of the specified type. The AID is only used for DATA frames
+// sent by the host. If it's -1, the frame is sent to a group of clients, and
+// only the clients in "aid_mask" get ack records. It returns the size of the
+// header (0 if the transport layer isn't enabled), or -1 if the header and the
+// user data don't fit in the frame.
+//
+// If delta compression is enabled, CMD and REPLY payloads may be encoded into
+// "scratch". In that case "data_src" and "data_size" are updated to point to
+// the encoded payload.
+int Wifi_MultiplayerTransportPrepare(Wifi_MPPacketType type, int aid, u16 aid_mask,
+                                     void *hdr, const void **data_src, size_t *data_size,
+                                     void *scratch, size_t scratch_size);
+
+// Marks the CMD/REPLY payload of a frame prepared with
+// Wifi_MultiplayerTransportPrepare() as valid base for future deltas. It must
+// be called after the frame has been added to the TX queue successfully, never
+// if that fails.
+void Wifi_MultiplayerTransportCommit(Wifi_MPPacketType type, const void *hdr,
+                                     size_t hdr_size);
+
+// Returns true if the memory range is inside the history buffers used by delta
+// compression, where the decoded CMD/REPLY payloads are stored.
+bool Wifi_MultiplayerDeltaContains(u32 address, u32 size);
+
+// Versions of the TX functions that write a header before the user data
+int Wifi_MultiplayerHostCmdTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                        const void *data_src, size_t data_size);
+int Wifi_MultiplayerClientReplyTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                            const void *data_src, size_t data_size);
+int Wifi_MultiplayerHostToClientDataTxFrameParts(int aid, const void *hdr_src, size_t hdr_size,
+                                                 const void *data_src, size_t data_size);
+int Wifi_MultiplayerClientToHostDataTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                                 const void *data_src, size_t data_size);
+
 #endif // DSWIFI_ARM9_NTR_MULTIPLAYER_H__
@@ -92,11 +92,13 @@ int Wifi_RawTxFrame(size_t data_size, u16 rate, const void *data_src)
     return 0;
 }
 
-int Wifi_MultiplayerHostCmdTxFrame(const void *data_src, size_t data_size)
+int Wifi_MultiplayerHostCmdTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                        const void *data_src, size_t data_size)
 {
     // Total size to add to the buffer
     size_t frame_size =
         sizeof(TxMultiplayerHostIeeeDataFrame) +
+        hdr_size + // Transport header, if any
         data_size + // Actual size of the data in the memory block
         4; // FCS
 
@@ -144,6 +146,12 @@ int Wifi_MultiplayerHostCmdTxFrame(const void *data_src, size_t data_size)
     // Data
     // ----
 
+    if (hdr_size > 0)
+    {
+        memcpy(txbufData + write_idx, hdr_src, hdr_size);
+        write_idx += hdr_size;
+    }
+
     memcpy(txbufData + write_idx, data_src, data_size);
     write_idx += data_size;
 
@@ -171,18 +179,38 @@ int Wifi_MultiplayerHostCmdTxFrame(const void *data_src, size_t data_size)
     leaveCriticalSection(oldIME);
 
     WifiData->stats[WSTAT_TXQUEUEDPACKETS]++;
-    WifiData->stats[WSTAT_TXQUEUEDBYTES] += data_size;
+    WifiData->stats[WSTAT_TXQUEUEDBYTES] += hdr_size + data_size;
 
     Wifi_CallSyncHandler();
 
     return 0;
 }
 
-int Wifi_MultiplayerClientReplyTxFrame(const void *data_src, size_t data_size)
+int Wifi_MultiplayerHostCmdTxFrame(const void *data_src, size_t data_size)
+{
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    u8 delta[MAC_CMDBUF_SIZE];
+    int hdr_size = Wifi_MultiplayerTransportPrepare(WIFI_MPTYPE_CMD, 0, 0, hdr,
+                                                    &data_src, &data_size,
+                                                    delta, sizeof(delta));
+    if (hdr_size < 0)
+        return -1;
+
+    if (Wifi_MultiplayerHostCmdTxFrameParts(hdr, hdr_size, data_src, data_size) != 0)
+        return -1;
+
+    Wifi_MultiplayerTransportCommit(WIFI_MPTYPE_CMD, hdr, hdr_size);
+
+    return 0;
+}
+
+int Wifi_MultiplayerClientReplyTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                            const void *data_src, size_t data_size)
 {
     // Total size to add to the buffer
     size_t frame_size =
         sizeof(TxMultiplayerClientIeeeDataFrame) +
+        hdr_size + // Transport header, if any
         data_size + // Actual size of the data in the memory block
         4; // FCS
 
@@ -232,6 +260,12 @@ int Wifi_MultiplayerClientReplyTxFrame(const void *data_src, size_t data_size)
     // Data
     // ----
 
+    if (hdr_size > 0)
+    {
+        memcpy(txbufData + write_idx, hdr_src, hdr_size);
+        write_idx += hdr_size;
+    }
+
     memcpy(txbufData + write_idx, data_src, data_size);
     write_idx += data_size;
 
@@ -259,22 +293,39 @@ int Wifi_MultiplayerClientReplyTxFrame(const void *data_src, size_t data_size)
     leaveCriticalSection(oldIME);
 
     WifiData->stats[WSTAT_TXQUEUEDPACKETS]++;
-    WifiData->stats[WSTAT_TXQUEUEDBYTES] += data_size;
+    WifiData->stats[WSTAT_TXQUEUEDBYTES] += hdr_size + data_size;
 
     Wifi_CallSyncHandler();
 
     return 0;
 }
 
-int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_t data_size)
+int Wifi_MultiplayerClientReplyTxFrame(const void *data_src, size_t data_size)
 {
-    u16 client_macaddr[3];
-    if (!Wifi_MultiplayerClientGetMacFromAID(aid, &client_macaddr))
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    u8 delta[MAC_CLIENT_RX_SIZE];
+    int hdr_size = Wifi_MultiplayerTransportPrepare(WIFI_MPTYPE_REPLY, 0, 0, hdr,
+                                                    &data_src, &data_size,
+                                                    delta, sizeof(delta));
+    if (hdr_size < 0)
+        return -1;
+
+    if (Wifi_MultiplayerClientReplyTxFrameParts(hdr, hdr_size, data_src, data_size) != 0)
         return -1;
 
+    Wifi_MultiplayerTransportCommit(WIFI_MPTYPE_REPLY, hdr, hdr_size);
+
+    return 0;
+}
+
+static int Wifi_MultiplayerHostDataTxFrameToAddr(const u16 *dst_macaddr,
+                                                 const void *hdr_src, size_t hdr_size,
+                                                 const void *data_src, size_t data_size)
+{
     // Total size to add to the buffer
     size_t frame_size =
         sizeof(TxIeeeDataFrame) +
+        hdr_size + // Transport header, if any
         data_size + // Actual size of the data in the memory block
         4; // FCS
 
@@ -308,7 +359,7 @@ int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_
 
     frame.ieee.frame_control = TYPE_DATA | FC_FROM_DS;
     //frame.ieee.duration = 0; // Filled by ARM7
-    Wifi_CopyMacAddr(frame.ieee.addr_1, client_macaddr);
+    Wifi_CopyMacAddr(frame.ieee.addr_1, dst_macaddr);
     Wifi_CopyMacAddr(frame.ieee.addr_2, WifiData->MacAddr);
     Wifi_CopyMacAddr(frame.ieee.addr_3, WifiData->MacAddr);
     frame.ieee.seq_ctl = 0;
@@ -319,6 +370,12 @@ int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_
     // Data
     // ----
 
+    if (hdr_size > 0)
+    {
+        memcpy(txbufData + write_idx, hdr_src, hdr_size);
+        write_idx += hdr_size;
+    }
+
     memcpy(txbufData + write_idx, data_src, data_size);
     write_idx += data_size;
 
@@ -346,18 +403,71 @@ int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_
     leaveCriticalSection(oldIME);
 
     WifiData->stats[WSTAT_TXQUEUEDPACKETS]++;
-    WifiData->stats[WSTAT_TXQUEUEDBYTES] += data_size;
+    WifiData->stats[WSTAT_TXQUEUEDBYTES] += hdr_size + data_size;
 
     Wifi_CallSyncHandler();
 
     return 0;
 }
 
-int Wifi_MultiplayerClientToHostDataTxFrame(const void *data_src, size_t data_size)
+int Wifi_MultiplayerHostToClientDataTxFrameParts(int aid, const void *hdr_src, size_t hdr_size,
+                                                 const void *data_src, size_t data_size)
+{
+    u16 client_macaddr[3];
+    if (!Wifi_MultiplayerClientGetMacFromAID(aid, &client_macaddr))
+        return -1;
+
+    return Wifi_MultiplayerHostDataTxFrameToAddr(client_macaddr, hdr_src, hdr_size,
+                                                 data_src, data_size);
+}
+
+int Wifi_MultiplayerHostToClientDataTxFrame(int aid, const void *data_src, size_t data_size)
+{
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    int hdr_size = Wifi_MultiplayerTransportPrepare(WIFI_MPTYPE_DATA, aid, 0, hdr,
+                                                    &data_src, &data_size, NULL, 0);
+    if (hdr_size < 0)
+        return -1;
+
+    return Wifi_MultiplayerHostToClientDataTxFrameParts(aid, hdr, hdr_size, data_src, data_size);
+}
+
+int Wifi_MultiplayerHostToClientsDataTxFrame(u16 aid_mask, const void *data_src,
+                                             size_t data_size)
+{
+    if (WifiData->curLibraryMode != DSWIFI_MULTIPLAYER_HOST)
+        return -1;
+
+    // AID 0 is the host
+    aid_mask &= ~BIT(0);
+    if (aid_mask == 0)
+        return -1;
+
+    // The frame is sent once to a group address. Clients check their bit in
+    // the mask stored in the address.
+    u16 group_macaddr[3] = {
+        wifi_group_data_mac[0], wifi_group_data_mac[1], aid_mask
+    };
+
+    // Ack records for the clients in the mask can go in the header, like in CMD
+    // frames. Other clients drop the frame, so they must not get any.
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    int hdr_size = Wifi_MultiplayerTransportPrepare(WIFI_MPTYPE_DATA, -1, aid_mask, hdr,
+                                                    &data_src, &data_size, NULL, 0);
+    if (hdr_size < 0)
+        return -1;
+
+    return Wifi_MultiplayerHostDataTxFrameToAddr(group_macaddr, hdr, hdr_size,
+                                                 data_src, data_size);
+}
+
+int Wifi_MultiplayerClientToHostDataTxFrameParts(const void *hdr_src, size_t hdr_size,
+                                                 const void *data_src, size_t data_size)
 {
     // Total size to add to the buffer
     size_t frame_size =
         sizeof(TxMultiplayerClientIeeeDataFrame) +
+        hdr_size + // Transport header, if any
         data_size + // Actual size of the data in the memory block
         4; // FCS
 
@@ -407,6 +517,12 @@ int Wifi_MultiplayerClientToHostDataTxFrame(const void *data_src, size_t data_si
     // Data
     // ----
 
+    if (hdr_size > 0)
+    {
+        memcpy(txbufData + write_idx, hdr_src, hdr_size);
+        write_idx += hdr_size;
+    }
+
     memcpy(txbufData + write_idx, data_src, data_size);
     write_idx += data_size;
 
@@ -434,23 +550,39 @@ int Wifi_MultiplayerClientToHostDataTxFrame(const void *data_src, size_t data_si
     leaveCriticalSection(oldIME);
 
     WifiData->stats[WSTAT_TXQUEUEDPACKETS]++;
-    WifiData->stats[WSTAT_TXQUEUEDBYTES] += data_size;
+    WifiData->stats[WSTAT_TXQUEUEDBYTES] += hdr_size + data_size;
 
     Wifi_CallSyncHandler();
 
     return 0;
 }
 
+int Wifi_MultiplayerClientToHostDataTxFrame(const void *data_src, size_t data_size)
+{
+    u8 hdr[WIFI_MP_TRANSPORT_MAX_HEADER_SIZE];
+    int hdr_size = Wifi_MultiplayerTransportPrepare(WIFI_MPTYPE_DATA, 0, 0, hdr,
+                                                    &data_src, &data_size, NULL, 0);
+    if (hdr_size < 0)
+        return -1;
+
+    return Wifi_MultiplayerClientToHostDataTxFrameParts(hdr, hdr_size, data_src, data_size);
+}
+
 // RX functions
 // ============
 
 void Wifi_RxRawReadPacket(u32 address, u32 size, void *dst)
 {
+    u32 rxbufStart = (u32)(WifiData->rxbufData);
     u32 rxbufEnd = (u32)(WifiData->rxbufData + sizeof(WifiData->rxbufData));
 
-    // If they have asked for too much memory, return. We could return a partial
-    // result but that would be way more confusing.
-    if (address + size > rxbufEnd)
+    // If they have asked for memory outside of the buffer, return. We could
+    // return a partial result but that would be way more confusing. Packets
+    // decoded by the multiplayer transport layer aren't stored in the RX
+    // buffer, they are stored in the history of the delta decoder.
+    bool in_rxbuf = (address >= rxbufStart) && (address <= rxbufEnd) &&
+                    (size <= rxbufEnd - address);
+    if (!in_rxbuf && !Wifi_MultiplayerDeltaContains(address, size))
     {
         assert(0);
         return;
@@ -5,6 +5,7 @@
 
 #include <dswifi9.h>
 
+#include "arm9/access_point.h"
 #include "arm9/wifi_arm9.h"
 #include "arm9/ntr/multiplayer.h"
 #include "arm9/ntr/rx_tx_queue.h"
@@ -19,6 +20,73 @@ void Wifi_RawSetPacketHandler(WifiPacketHandler wphfunc)
     wifi_rawpackethandler = wphfunc;
 }
 
+// Events sent by the ARM7
+// =======================
+
+static WifiEventHandler wifi_event_handler = NULL;
+
+// Last value of the counter of dropped events seen by the ARM9
+static u8 wifi_event_dropped;
+
+void Wifi_EventInit(void)
+{
+    volatile Wifi_EventQueueIpc *queue = &WifiData->events;
+
+    // Stop the ARM7 from adding events before modifying the queue
+    queue->enabled = 0;
+
+    if (wifi_event_handler == NULL)
+        return;
+
+    // Discard any old event
+    queue->read = queue->write;
+    wifi_event_dropped = queue->dropped;
+
+    queue->enabled = 1;
+}
+
+void Wifi_SetEventHandler(WifiEventHandler handler)
+{
+    wifi_event_handler = handler;
+
+    if (WifiData != NULL)
+        Wifi_EventInit();
+}
+
+static void Wifi_EventDispatch(void)
+{
+    volatile Wifi_EventQueueIpc *queue = &WifiData->events;
+
+    if (!queue->enabled)
+        return;
+
+    if (queue->dropped != wifi_event_dropped)
+    {
+        wifi_event_dropped = queue->dropped;
+
+        Wifi_Event event = { 0 };
+        event.type = WIFI_EVENT_OVERFLOW;
+
+        if (wifi_event_handler)
+            wifi_event_handler(&event);
+    }
+
+    u8 read = queue->read;
+
+    while (read != queue->write)
+    {
+        Wifi_Event event = queue->list[read]; // Struct copy
+
+        // Free the entry before calling the handler so that the ARM7 can reuse
+        // it as soon as possible.
+        read = (read + 1) % WIFI_EVENT_QUEUE_SIZE;
+        queue->read = read;
+
+        if (wifi_event_handler)
+            wifi_event_handler(&event);
+    }
+}
+
 // Functions that behave differently with lwIP and without it
 // ==========================================================
 
@@ -115,6 +183,14 @@ TWL_CODE static void Wifi_TWL_Update(void)
         }
         read_idx += sizeof(uint32_t);
 
+        // Packets written straight from the card still have the MBOX header
+        size_t offset = 0;
+        if (size & WIFI_RXBUF_FLAG_MBOX_HDR)
+        {
+            size &= ~WIFI_RXBUF_FLAG_MBOX_HDR;
+            offset = WIFI_RXBUF_MBOX_HDR_SIZE;
+        }
+
 #ifdef DSWIFI_ENABLE_LWIP
         if (wifi_lwip_enabled)
         {
@@ -122,11 +198,11 @@ TWL_CODE static void Wifi_TWL_Update(void)
             if (WifiData->curLibraryMode == DSWIFI_INTERNET)
             {
                 if (wifi_netif_is_up())
-                    Wifi_SendPacketToLwip((u8*)(rxbufData + read_idx), size);
+                    Wifi_SendPacketToLwip((u8*)(rxbufData + read_idx + offset), size);
             }
         }
 #endif
-        read_idx += round_up_32(size);
+        read_idx += round_up_32(offset + size);
 
         assert(read_idx <= (WIFI_RXBUFFER_SIZE - sizeof(u32)));
 
@@ -147,6 +223,9 @@ void Wifi_Update(void)
     if (!WifiData)
         return;
 
+    Wifi_EventDispatch();
+    Wifi_RoamUpdate();
+
     if (WifiData->reqFlags & WFLAG_REQ_DSI_MODE)
         Wifi_TWL_Update();
     else
@@ -13,4 +13,8 @@
 // Checks for new data from the ARM7 and initiates routing if data is available.
 void Wifi_Update(void);
 
+// Tells the ARM7 to start sending events if there is an event handler. It must
+// be called after initializing the IPC struct.
+void Wifi_EventInit(void);
+
 #endif // DSWIFI_ARM9_WIFI_ARM9_H__
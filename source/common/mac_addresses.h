@@ -18,6 +18,11 @@ extern const u16 wifi_cmd_mac[3];
 // Client REPLY packets are sent to MAC address 03:09:BF:00:00:10
 extern const u16 wifi_reply_mac[3];
 
+// Host DATA packets sent to a group of clients are sent to MAC address
+// 03:09:BF:01:XX:XX, where XX:XX is the AID mask of the clients (little endian).
+// Only the first 4 bytes are stored here.
+extern const u16 wifi_group_data_mac[2];
+
 // Host and client ACK packets are sent to MAC address 03:09:BF:00:00:03
 extern const u16 wifi_ack_mac[3];
 
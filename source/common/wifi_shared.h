@@ -12,6 +12,8 @@
 #include <nds/arm9/cp15_asm.h>
 #include <dswifi_common.h>
 
+#include "common/ieee_defs.h"
+
 // Space reserved for incoming and outgoing packets
 #define WIFI_RXBUFFER_SIZE  (1024 * 12)
 #define WIFI_TXBUFFER_SIZE  (1024 * 24)
@@ -19,7 +21,14 @@
 // Value written in RX/TX buffers to restart the pointer to the beginning
 #define WIFI_SIZE_WRAP      0xFFFFFFFF
 
-// Max number of Access Points that the library will keep track of
+// Flag set in the size of a packet in the RX buffer in DSi mode if the packet
+// has been written with NDMA straight from the card. The packet is preceded by
+// the MBOX header, which isn't included in the size.
+#define WIFI_RXBUF_FLAG_MBOX_HDR    0x80000000
+#define WIFI_RXBUF_MBOX_HDR_SIZE    6
+
+// Max number of Access Points that the library will keep track of. It can't be
+// higher than 32 because active entries are tracked with a 32-bit mask.
 #define WIFI_MAX_AP         32
 
 // Max number of saved WFC configurations
@@ -32,15 +41,19 @@
 #define WIFI_AP_TIMEOUT (13 * 2 + 1)
 
 // Flags that inform us of the state of the ARM7
-#define WFLAG_ARM7_ACTIVE  0x0001
-#define WFLAG_ARM7_RUNNING 0x0002 // TODO: Delete? It seems redundant
+#define WFLAG_ARM7_ACTIVE           0x0001
+#define WFLAG_ARM7_RUNNING          0x0002 // TODO: Delete? It seems redundant
+#define WFLAG_ARM7_RECONNECTING     0x0004 // The connection was lost, retrying
+#define WFLAG_ARM7_RECONNECT_FAILED 0x0008 // Automatic reconnection gave up
 
 // Requests from the ARM9 to the ARM7
-#define WFLAG_REQ_USELED        0x0001 // NTR only
-#define WFLAG_REQ_PROMISC       0x0010 // NTR only
-#define WFLAG_REQ_ALLOWCLIENTS  0x0040 // NTR only
-#define WFLAG_REQ_DSI_MODE      0x0080
-#define WFLAG_REQ_LOAD_WFC_KEY  0x0100 // Ask ARM7 to load the key from WFC data
+#define WFLAG_REQ_USELED         0x0001 // NTR only
+#define WFLAG_REQ_PROMISC        0x0010 // NTR only
+#define WFLAG_REQ_ALLOWCLIENTS   0x0040 // NTR only
+#define WFLAG_REQ_DSI_MODE       0x0080
+#define WFLAG_REQ_LOAD_WFC_KEY   0x0100 // Ask ARM7 to load the key from WFC data
+#define WFLAG_REQ_ROAM_SCAN      0x0200 // Look for other APs while connected (NTR)
+#define WFLAG_REQ_AUTO_RECONNECT 0x0400 // Reconnect if the connection is lost
 
 // Enum values for the FIFO WiFi commands (FIFO_DSWIFI).
 typedef enum
@@ -147,6 +160,81 @@ typedef struct {
     u32 spinlock;
 } Wifi_ClientsInfoIpc;
 
+// Table of APs provided by the application. The ARM9 writes the requested table
+// to "reqEntries" and "reqNumEntries", and the ARM7 starts using it from its
+// update loop. "reqEntries" is set to NULL while "reqNumEntries" is modified.
+// The table in main RAM is only accessed by the ARM7.
+#define WIFI_APTABLE_BUCKETS    64
+#define WIFI_APTABLE_NONE       0xFFFF
+
+typedef struct {
+    Wifi_AccessPointCompact *reqEntries;
+    u16 reqNumEntries;
+
+    Wifi_AccessPointCompact *curEntries;
+    u16 curNumEntries;
+
+    u16 num_used;
+    u16 free_head; // Free entries are linked with their "hash_next" field
+    u16 lru_head; // Most recently updated AP
+    u16 lru_tail; // Least recently updated AP
+    u16 buckets[WIFI_APTABLE_BUCKETS]; // First entry of each hash chain
+
+    // Query requested by the ARM9. The ARM9 increments "reqQueryId" after
+    // filling the rest of the fields. The ARM7 sets "curQueryId" to the same
+    // value once the results have been written.
+    Wifi_AccessPointCompact *queryResults;
+    u16 queryMaxResults;
+    u16 queryFilter;
+    u16 queryNumResults;
+    u8 reqQueryId, curQueryId;
+} Wifi_ApTableIpc;
+
+// Changes to the Nintendo vendor information of the beacon frame saved in MAC
+// RAM (NTR only). The ARM9 writes the new values to "data" and sets the bits of
+// "dirty" of the bytes that have changed. The ARM7 writes those bytes to MAC RAM
+// without stopping beacon transmission and clears "dirty".
+typedef struct {
+    u8 data[sizeof(FieVendorNintendo)];
+    u64 dirty;
+
+    // Internal lock to access this struct. Both CPUs need to acquire it.
+    u32 spinlock;
+} Wifi_BeaconPatchIpc;
+
+// Queue of events sent from the ARM7 to the ARM9. The ARM7 only writes to
+// "write" and "dropped", the ARM9 only writes to "read" and "enabled". The ARM7
+// doesn't add events to the queue unless the ARM9 has enabled it.
+#define WIFI_EVENT_QUEUE_SIZE   32
+
+typedef struct {
+    Wifi_Event list[WIFI_EVENT_QUEUE_SIZE];
+    u8 write;
+    u8 read;
+    u8 enabled;
+    u8 dropped; // Number of events that didn't fit in the queue
+} Wifi_EventQueueIpc;
+
+// Settings of the automatic reconnection. They are only written by the ARM9.
+// The ARM7 retries to connect to the same BSSID "same_bssid_retries" times.
+// After that, it scans all channels looking for the AP with the best signal
+// with the same SSID before every new attempt. The delay between attempts
+// starts at "base_delay_ms" and doubles every time, up to "max_delay_ms". If
+// "max_attempts" isn't zero, the ARM7 gives up after that many attempts.
+typedef struct {
+    u16 base_delay_ms;
+    u16 max_delay_ms;
+    u8 same_bssid_retries;
+    u8 max_attempts;
+} Wifi_ReconnectIpc;
+
+// Settings of the scan of the DSi firmware. They are only written by the ARM9.
+// A value of zero means that the ARM7 uses its default value.
+typedef struct {
+    u16 active_dwell_ms;  // Max time on a channel sending probe requests
+    u16 passive_dwell_ms; // Time on a channel listening to beacons
+} Wifi_ScanIpc;
+
 // Security information about an AP
 typedef struct {
     u8 pass_len; // Length of the password. For WEP it must be 5, 13 or 16.
@@ -200,6 +288,10 @@ typedef struct WIFI_MAINSTRUCT
     // Security information of the current AP
     Wifi_ApSecurity curApSecurity;
 
+    // While WFLAG_REQ_ROAM_SCAN is set, the ARM7 only looks for other APs if
+    // the RSSI of the current AP is lower than this. Written by the ARM9.
+    s16 roamRssiThreshold;
+
     u8 maxrate7;
     bool realRates;
     u8 rssi;
@@ -209,6 +301,19 @@ typedef struct WIFI_MAINSTRUCT
 
     // Scanned AP data
     Wifi_AccessPoint aplist[WIFI_MAX_AP];
+
+    // Bit N is set if aplist[N] is active. Only the ARM7 modifies it.
+    u32 aplist_active_mask;
+
+    // The ARM7 increments it before and after modifying aplist, so it's odd
+    // while the list is being modified. The ARM9 uses it to check that the
+    // list hasn't changed while it was copying it.
+    u32 aplist_generation;
+
+    // Incremented by the ARM7 every time it finishes scanning all channels
+    u32 scan_sweep_count;
+
+    Wifi_ApTableIpc aptable;
     u8 curApScanFlags, reqApScanFlags;
 
     // WFC data
@@ -255,6 +360,23 @@ typedef struct WIFI_MAINSTRUCT
     u16 hostPlayerName[10]; // UTF-16LE
     u8 hostPlayerNameLen;
 
+    Wifi_BeaconPatchIpc beaconPatch;
+
+    // Events
+    // ------
+
+    Wifi_EventQueueIpc events;
+
+    // Automatic reconnection
+    // ----------------------
+
+    Wifi_ReconnectIpc reconnect;
+
+    // Scan settings (TWL mode only)
+    // -----------------------------
+
+    Wifi_ScanIpc scan;
+
     // Other information
     // -----------------
 